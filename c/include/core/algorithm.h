@@ -5,9 +5,50 @@
 
 #include "automaton.h"
 #include "parser.h"
+#include "table.h"
+
+/**
+ * Boolean combination of patterns, read as a sum of products: the clauses
+ * joined by BoolAnd form a product, and products are joined by BoolOr.
+ */
+typedef enum BoolOp { BoolOr, BoolAnd } BoolOp;
+
+/**
+ * How the DFA of a pattern is built: thompson's NFA, determinized then
+ * minimized by brzozowski, or the derivatives of the pattern, minimized by
+ * moore. Both give the same minimal DFA.
+ */
+typedef enum Construction { ConstructionThompson, ConstructionDerivatives } Construction;
+
+static const char *const CONSTRUCTION_STR[] = {
+    [ConstructionThompson] = "thompson",
+    [ConstructionDerivatives] = "derivatives",
+};
+
+typedef struct Clause {
+    const char *pattern;
+    bool negated;
+    BoolOp op;  // joining the clause to the previous ones
+} Clause;
 
 extern DFA *brzozowski(DFA *dfa);
 
+extern DFA *moore(DFA *dfa);
+
 extern NFA *thompson(AST *ast);
 
+extern Table *regex_compile(const char *regex, Construction construction);
+
+extern DFA *regex_compile_empty(Construction construction);
+
+extern DFA *regex_compile_dfa(const char *regex, Construction construction,
+                              bool *counted);
+
+extern Table *regex_compile_confirmed(const char *regex, DFA *dfa);
+
+extern Table *regex_compile_approx(const char *regex, int k, bool fold);
+
+extern Table *regex_compile_clauses(const Clause *clauses, int count, bool invert,
+                                    bool fold, Construction construction);
+
 #endif  // ALGORITHM_H
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef APPROX_H
+#define APPROX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+extern const int APPROX_MAX_ERRORS;
+
+extern const int APPROX_MAX_POSITIONS;
+
+/**
+ * Bit-parallel matcher of the lines within k edits (insertions, deletions
+ * or substitutions of a byte) of the pattern, in the manner of Wu-Manber.
+ * The states are the Glushkov positions of the pattern, one bit each, and
+ * the automaton is never built for the errors: a bit vector of the active
+ * positions is kept per number of errors, and stepped with a few table
+ * lookups per byte.
+ */
+typedef struct Approx Approx;
+
+extern Approx *approx_create(AST *ast, int k);
+
+extern bool approx_accept(const Approx *a, const char *head, size_t head_len,
+                          const char *s, size_t n);
+
+extern void approx_free(Approx *a);
+
+#endif  // APPROX_H
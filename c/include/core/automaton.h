@@ -9,6 +9,7 @@
 
 extern const char EPSILON;
 extern const char ALPHABET[];
+extern const char SYMBOLS[];
 
 /**
  * Deterministic Finite Automaton
@@ -27,6 +28,10 @@ extern MultiType dfa_delta(DFA* dfa, MultiType state, char a);
 
 extern bool dfa_accept(DFA* dfa, char* word);
 
+extern void dfa_complement(DFA* dfa);
+
+extern DFA* dfa_product(DFA* a, DFA* b, bool intersect);
+
 extern void dfa_free(DFA* dfa, bool deep);
 
 /**
@@ -0,0 +1,31 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "table.h"
+
+/**
+ * Compiled table of a pattern, shared by the users of a cache. An entry
+ * evicted while in use is freed by its last cache_release.
+ */
+typedef struct CacheEntry {
+    char *pattern;
+    Table *table;
+    int refs;
+    struct CacheEntry *prev;  // more recently used
+    struct CacheEntry *next;  // less recently used
+} CacheEntry;
+
+/**
+ * Thread-safe LRU cache of compiled patterns, keyed by pattern.
+ */
+typedef struct PatternCache PatternCache;
+
+extern PatternCache *cache_create(int capacity);
+
+extern CacheEntry *cache_acquire(PatternCache *cache, const char *pattern);
+
+extern void cache_release(PatternCache *cache, CacheEntry *entry);
+
+extern void cache_free(PatternCache *cache);
+
+#endif  // CACHE_H
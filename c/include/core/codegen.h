@@ -0,0 +1,17 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdbool.h>
+
+#include "table.h"
+
+extern const int CODEGEN_MAX_RANGES;
+
+/**
+ * Writes a compiled table as standalone C code: <prefix>.c, <prefix>.h and
+ * <prefix>.mk, a Makefile rule building <prefix>.o. The functions are named
+ * after the last component of prefix.
+ */
+extern bool codegen_emit(Table *t, const char *pattern, const char *prefix);
+
+#endif  // CODEGEN_H
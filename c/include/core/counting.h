@@ -0,0 +1,30 @@
+#ifndef COUNTING_H
+#define COUNTING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+/**
+ * Automaton with counters for the Repeat nodes left by ast_simplify. The
+ * DFA of such a pattern is built from an approximation where x{m,n} is
+ * x+ (or x* when m is 0), so its size does not depend on the counts; the
+ * lines it accepts are then confirmed here. A counted character group is
+ * a bit vector of max bits, bit i telling that i + 1 bytes of the group
+ * were read, so it costs max / 64 words per byte instead of max states.
+ * Any other counted body keeps such a vector per state of the body, bit i
+ * telling that the state is active in copy i + 1.
+ */
+typedef struct Counting Counting;
+
+extern Counting *counting_create(AST *ast);
+
+extern AST *counting_approximate(AST *ast);
+
+extern bool counting_accept(const Counting *c, const char *head, size_t head_len,
+                            const char *s, size_t n);
+
+extern void counting_free(Counting *c);
+
+#endif  // COUNTING_H
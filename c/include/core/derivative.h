@@ -0,0 +1,19 @@
+#ifndef DERIVATIVE_H
+#define DERIVATIVE_H
+
+#include "automaton.h"
+#include "parser.h"
+
+/**
+ * DFA of a simplified AST built from Brzozowski derivatives, without an
+ * NFA. Expressions are hash-consed terms kept in a normal form by their
+ * constructors (unions sorted and without duplicates, concatenations
+ * nested to the right, empty sets and epsilons dropped), so that every
+ * state is a distinct term and the DFA is finite and close to minimal.
+ * The bytes of a state are split once into the classes whose derivatives
+ * are equal, and each class is derived once. Unicode nodes are read as
+ * the unions of their UTF-8 byte sequences.
+ */
+extern DFA *derivative_dfa(AST *ast);
+
+#endif  // DERIVATIVE_H
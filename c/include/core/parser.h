@@ -1,32 +1,53 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdbool.h>
+
 #include "vector.h"
 
-typedef enum ASTTag { CharGroup, Concat, Union, Star } ASTTag;
+typedef enum ASTTag { CharGroup, Concat, Union, Star, Epsilon, Repeat, Unicode } ASTTag;
 
 static const char *const AST_TAG_STR[] = {
     [CharGroup] = "CharGroup",
     [Concat] = "Concat",
     [Union] = "Union",
     [Star] = "Star",
+    [Epsilon] = "Epsilon",
+    [Repeat] = "Repeat",
+    [Unicode] = "Unicode",
 };
 
+extern const int PARSE_MAX_REPEAT;
+
+/**
+ * Regex syntax tree. Concat and Union have two or more children (two as
+ * parsed, more once simplified), Star and Repeat one, Epsilon and Unicode
+ * none. A Unicode node is a range of non-ASCII code points, compiled to
+ * the UTF-8 bytes encoding them.
+ */
 typedef struct AST {
     enum ASTTag tag;
     int arity;
     union {
         char *c;         // CharGroup
-        struct AST **a;  // Concat, Union, Star
+        struct AST **a;  // Concat, Union, Star, Repeat
     } childs;
+    int min, max;  // Repeat: bounds of the count, max -1 when unbounded
+                   // Unicode: first and last code points
 } AST;
 
 extern AST *ast_create(ASTTag tag, int arity, int argc, ...);
 
+extern AST *ast_copy(AST *ast);
+
 extern void ast_free(AST *ast);
 
 extern void ast_print(AST *ast, int indent);
 
-extern AST *parse(char *regex);
+extern bool parse_check(const char *regex);
+
+extern AST *parse(const char *regex);
+
+extern AST *parse_fold(const char *regex);
 
 #endif  // PARSER_H
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef PATTERNSET_H
+#define PATTERNSET_H
+
+#include <stdbool.h>
+
+#include "algorithm.h"
+#include "table.h"
+
+/**
+ * Set of patterns compiled into the table of their union, which changes a
+ * few patterns at a time. The minimal DFA of every pattern is kept at a
+ * leaf of a binary tree, and every node keeps the minimal DFA of the union
+ * below it. Adding or removing a pattern only marks the nodes on its path,
+ * and patternset_compile rebuilds these, a union of two DFAs each, instead
+ * of the union of all the patterns. Patterns are numbered from 0 in the
+ * order added, the numbers of removed ones being given again.
+ */
+typedef struct PatternSet PatternSet;
+
+extern PatternSet *patternset_create(void);
+
+extern int patternset_add(PatternSet *set, const char *pattern,
+                          Construction construction);
+
+extern bool patternset_remove(PatternSet *set, int id);
+
+extern int patternset_size(PatternSet *set);
+
+extern Table *patternset_compile(PatternSet *set);
+
+extern void patternset_free(PatternSet *set);
+
+#endif  // PATTERNSET_H
@@ -0,0 +1,46 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+/**
+ * Called on every matching line. A line crossing chunks is given as the
+ * copied head of its previous chunks followed by the rest in the current
+ * one, which is followed by its newline unless it is NULL; offset is the
+ * position of the line in the stream.
+ */
+typedef bool (*ScanFn)(const char *head, size_t head_len, const char *line,
+                       size_t len, uint64_t offset, void *context);
+
+/**
+ * Resumable line matcher over a stream fed in arbitrary chunks. The DFA
+ * state is carried from a chunk to the next, so a line is never rescanned.
+ */
+typedef struct Scanner {
+    Table *table;
+    uint64_t *counts;  // visits of the states, when not NULL
+    uint32_t state;
+    uint64_t offset;  // stream offset of the current line
+    size_t line_len;  // bytes of the current line in previous chunks
+    char *head;       // copy of these bytes, while the line can match
+    size_t head_len;
+    size_t head_capacity;
+    int threads;  // walking lines of SPECULATE_MIN_SEGMENT bytes and more
+} Scanner;
+
+extern Scanner *scanner_create(Table *table, uint64_t *counts);
+
+extern bool scanner_feed(Scanner *scanner, const char *s, size_t n, ScanFn fn,
+                         void *context);
+
+extern bool scanner_finish(Scanner *scanner, ScanFn fn, void *context);
+
+extern void scanner_reset(Scanner *scanner);
+
+extern void scanner_free(Scanner *scanner);
+
+#endif  // SCANNER_H
@@ -0,0 +1,30 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "parser.h"
+
+extern const int SIMPLIFY_MAX_UNROLL;
+
+/**
+ * Rewrites a parsed AST into an equivalent smaller one, for a smaller NFA:
+ *    - nested Concat and Union nodes are flattened into n-ary ones
+ *    - character groups of a union are merged into a single group
+ *    - common prefixes of the alternatives of a union are factored out
+ *    - nested and redundant stars are collapsed
+ *    - epsilon disappears from concatenations, and from unions that can
+ *      already match the empty string
+ *    - counted repetitions are unrolled, but for those of more than
+ *      SIMPLIFY_MAX_UNROLL copies, which stay Repeat nodes
+ * The AST given is consumed.
+ */
+extern AST *ast_simplify(AST *ast);
+
+extern AST *ast_unroll(AST *ast);
+
+extern void ast_lower(AST *ast);
+
+extern bool ast_equal(AST *a, AST *b);
+
+extern bool ast_nullable(AST *ast);
+
+#endif  // SIMPLIFY_H
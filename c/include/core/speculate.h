@@ -0,0 +1,20 @@
+#ifndef SPECULATE_H
+#define SPECULATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+extern const size_t SPECULATE_MIN_SEGMENT;
+
+/**
+ * Same as table_run, on several threads. The text is cut into segments,
+ * and every segment but the first is walked from all the states it can
+ * start in, giving a map from start to end state. The maps are then
+ * composed in order, which only costs one lookup per segment.
+ */
+extern uint32_t speculate_run(Table *t, uint32_t state, const char *s, size_t n,
+                              int threads);
+
+#endif  // SPECULATE_H
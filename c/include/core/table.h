@@ -0,0 +1,126 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "approx.h"
+#include "automaton.h"
+#include "counting.h"
+
+extern const size_t TABLE_DENSE_LIMIT;
+
+/**
+ * Layouts of a compiled transition table:
+ *    - TableDense16: states x classes matrix of 16-bit state ids
+ *    - TableDense32: states x classes matrix of 32-bit state ids
+ *    - TableDisplaced: rows packed with row displacement, transitions to
+ *      the dead state are left implicit
+ */
+typedef enum TableKind { TableDense16, TableDense32, TableDisplaced } TableKind;
+
+static const char *const TABLE_KIND_STR[] = {
+    [TableDense16] = "dense16",
+    [TableDense32] = "dense32",
+    [TableDisplaced] = "displaced",
+};
+
+/**
+ * Boolean combination of tables, confirming the lines of a table whose DFA
+ * only approximates it, when patterns with counted repetitions are
+ * combined. It reads as a sum of products: table i is joined to the
+ * previous one by and when joined[i], by or otherwise, and negated when
+ * negated[i]; the whole sum is negated when invert. The tables are owned.
+ */
+typedef struct TableCombination {
+    int count;
+    struct Table **tables;
+    bool *negated;
+    bool *joined;
+    bool invert;
+} TableCombination;
+
+/**
+ * Compiled DFA used by the scan loop. States are numbered 0..size-1 and
+ * bytes are mapped to equivalence classes before indexing the table. With
+ * counted repetitions, the DFA only approximates the pattern, and a line
+ * ending in a final state is a match once counting accepts it too, or
+ * once the combination does for combined patterns. For approximate
+ * matching, the DFA accepts any line and approx decides.
+ */
+typedef struct Table {
+    TableKind kind;
+    int size;      // number of states
+    int classes;   // number of byte classes
+    uint32_t initial;
+    uint32_t dead;  // non accepting sink state
+    uint8_t map[256];  // byte -> class
+    uint8_t *final;    // state -> accepting
+    union {
+        uint16_t *d16;  // TableDense16
+        uint32_t *d32;  // TableDense32
+    } delta;
+    int slots;       // TableDisplaced: length of next and check
+    int32_t *base;   // TableDisplaced: state -> offset of its row
+    uint32_t *next;  // TableDisplaced: packed transitions
+    uint32_t *check;  // TableDisplaced: owner of each slot
+    Counting *counting;  // confirms the accepted lines, when not NULL
+    Approx *approx;      // same, for the lines within some errors
+    TableCombination *combination;  // same, for combined counted patterns
+} Table;
+
+extern Table *table_create(DFA *dfa);
+
+extern Table *table_create_kind(DFA *dfa, TableKind kind);
+
+extern void table_fold_case(Table *t);
+
+extern size_t table_bytes(Table *t);
+
+extern uint32_t table_run(Table *t, uint32_t state, const char *s, size_t n);
+
+extern bool table_accept(Table *t, const char *s, size_t n);
+
+extern bool table_confirm(Table *t, const char *head, size_t head_len,
+                          const char *s, size_t n);
+
+extern void table_accept_batch(Table *t, const char *const *strings,
+                               const size_t *lengths, size_t count,
+                               uint64_t *results);
+
+extern uint32_t table_profile(Table *t, uint32_t state, const char *s, size_t n,
+                              uint64_t *counts);
+
+extern void table_reorder(Table *t, const uint64_t *counts);
+
+extern void table_write_counts(FILE *file, Table *t, const uint64_t *counts);
+
+extern uint64_t *table_read_counts(FILE *file, Table *t);
+
+extern TableCombination *table_combination_create(int count, bool invert);
+
+extern void table_free(Table *t);
+
+/* Transition on a byte class, for callers that need their own loop */
+static inline uint32_t table_step_class(Table *t, uint32_t state, uint8_t a)
+{
+    switch (t->kind) {
+        case TableDense16:
+            return t->delta.d16[state * t->classes + a];
+        case TableDense32:
+            return t->delta.d32[state * t->classes + a];
+        default: {
+            int32_t i = t->base[state] + a;
+            return t->check[i] == state ? t->next[i] : t->dead;
+        }
+    }
+}
+
+static inline uint32_t table_step(Table *t, uint32_t state, unsigned char c)
+{
+    return table_step_class(t, state, t->map[c]);
+}
+
+#endif  // TABLE_H
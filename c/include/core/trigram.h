@@ -0,0 +1,36 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdint.h>
+
+#include "parser.h"
+
+typedef enum QueryOp { QueryAll, QueryAnd, QueryOr, QueryTrigram } QueryOp;
+
+static const char *const QUERY_OP_STR[] = {
+    [QueryAll] = "All",
+    [QueryAnd] = "And",
+    [QueryOr] = "Or",
+    [QueryTrigram] = "Trigram",
+};
+
+/**
+ * Boolean combination of trigrams that any line matching a pattern must
+ * contain. QueryAll matches everything.
+ */
+typedef struct Query {
+    QueryOp op;
+    uint32_t trigram;  // QueryTrigram: 3 bytes, first one in the high bits
+    int size;          // QueryAnd, QueryOr
+    struct Query **args;
+} Query;
+
+extern uint32_t trigram_pack(const char *s);
+
+extern Query *trigram_query(AST *ast);
+
+extern void query_print(Query *q, int indent);
+
+extern void query_free(Query *q);
+
+#endif  // TRIGRAM_H
@@ -0,0 +1,25 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stdint.h>
+
+extern const uint32_t UTF8_MAX;
+
+/**
+ * Byte ranges of UTF-8 sequences of a same length: the sequences of len
+ * bytes b[0..len-1] with lo[i] <= b[i] <= hi[i] encode exactly a range of
+ * code points. Any range of code points is a union of such sequences, so
+ * it compiles to a byte automaton and the scan never decodes.
+ */
+typedef struct Utf8Range {
+    int len;
+    unsigned char lo[4], hi[4];
+} Utf8Range;
+
+extern int utf8_decode(const char *s, uint32_t *cp);
+
+extern int utf8_encode(uint32_t cp, unsigned char *s);
+
+extern Utf8Range *utf8_ranges(uint32_t lo, uint32_t hi, int *count);
+
+#endif  // UTF8_H
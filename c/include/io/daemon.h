@@ -0,0 +1,19 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+
+extern const int DAEMON_CACHE_SIZE;
+
+/**
+ * Local search server. A client connects to a Unix socket and passes its
+ * working directory, stdin, stdout and stderr as file descriptors, then the
+ * pattern and the files. The server writes the output straight to these
+ * descriptors and answers with the exit status.
+ */
+extern bool daemon_serve(const char *socket_path, int workers);
+
+extern int daemon_forward(const char *socket_path, const char *pattern,
+                          char **files, int nfiles);
+
+#endif  // DAEMON_H
@@ -0,0 +1,37 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+extern const size_t FOLLOW_CHUNK_SIZE;
+
+/**
+ * Events of a followed file:
+ *    - FollowData: bytes were appended, data holds the next len of them
+ *    - FollowRestart: the file was truncated or replaced by a new one, whose
+ *      data starts over
+ */
+typedef enum FollowEvent { FollowData, FollowRestart } FollowEvent;
+
+static const char *const FOLLOW_EVENT_STR[] = {
+    [FollowData] = "data",
+    [FollowRestart] = "restart",
+};
+
+typedef void (*FollowFn)(FollowEvent event, int file, const char *data,
+                         size_t len, void *context);
+
+/**
+ * Watches growing files with inotify, like tail -F: only the appended
+ * ranges are read, and files are reopened when rotated.
+ */
+typedef struct Follower Follower;
+
+extern Follower *follower_create(char **paths, int count);
+
+extern bool follower_run(Follower *f, FollowFn fn, void *context);
+
+extern void follower_free(Follower *f);
+
+#endif  // FOLLOW_H
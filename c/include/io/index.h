@@ -0,0 +1,46 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trigram.h"
+
+extern const char INDEX_FILENAME[];
+extern const size_t INDEX_BLOCK_SIZE;
+
+/**
+ * On-disk trigram index of the files of a directory, mapped in memory.
+ * Files are cut into blocks of whole lines, and every trigram of the
+ * corpus has a posting list of the blocks containing it.
+ */
+typedef struct Index Index;
+
+/**
+ * Block of a file, as stored in the index.
+ */
+typedef struct IndexBlock {
+    const char *path;  // relative to the indexed directory
+    bool stale;        // the file changed since it was indexed
+    uint64_t offset;
+    uint32_t len;
+} IndexBlock;
+
+extern bool index_build(const char *dir);
+
+extern Index *index_open(const char *dir);
+
+extern int index_size(Index *index);
+
+extern uint32_t *index_candidates(Index *index, Query *q, int *count);
+
+extern char **index_unindexed(Index *index, int *count);
+
+extern IndexBlock index_block(Index *index, uint32_t id);
+
+extern char *index_load(Index *index, IndexBlock block, size_t *len);
+
+extern void index_close(Index *index);
+
+#endif  // INDEX_H
@@ -0,0 +1,38 @@
+#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+extern const int INFLATER_BUFFERS;
+extern const size_t INFLATER_BUFFER_SIZE;
+
+typedef enum Codec { CodecNone, CodecGzip, CodecZstd } Codec;
+
+static const char *const CODEC_STR[] = {
+    [CodecNone] = "none",
+    [CodecGzip] = "gzip",
+    [CodecZstd] = "zstd",
+};
+
+/**
+ * Decompresses a buffer on its own thread into a ring of output buffers,
+ * which are consumed in order with inflater_next and inflater_release.
+ */
+typedef struct Inflater Inflater;
+
+extern Codec codec_detect(const char *data, size_t len);
+
+extern bool codec_supported(Codec codec);
+
+extern Inflater *inflater_create(const char *data, size_t len, Codec codec);
+
+extern const char *inflater_next(Inflater *z, size_t *len);
+
+extern void inflater_release(Inflater *z);
+
+extern const char *inflater_error(Inflater *z);
+
+extern void inflater_free(Inflater *z);
+
+#endif  // INFLATER_H
@@ -0,0 +1,48 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern const int READER_DEFAULT_DEPTH;
+extern const size_t READER_ALIGNMENT;
+extern const size_t READER_CHUNK_SIZE;
+
+typedef enum ReaderBackend { ReaderAuto, ReaderUring, ReaderThreads } ReaderBackend;
+
+static const char *const READER_BACKEND_STR[] = {
+    [ReaderAuto] = "auto",
+    [ReaderUring] = "io_uring",
+    [ReaderThreads] = "threads",
+};
+
+/**
+ * Chunk of a file, in a buffer owned by the reader. The chunks of a file
+ * come in order, and only the last one, which may be empty, holds less
+ * than the chunk size or an error.
+ */
+typedef struct Block {
+    int index;         // position of the file in the list given to the reader
+    const char *path;
+    int error;         // errno of the failed open or read, 0 on success
+    char *data;        // aligned on READER_ALIGNMENT
+    size_t len;
+    uint64_t offset;   // of data in the file
+    bool last;         // of its file
+} Block;
+
+typedef struct Reader Reader;
+
+extern Reader *reader_create(char **paths, int count, int depth,
+                             ReaderBackend backend, size_t chunk);
+
+extern ReaderBackend reader_backend(Reader *r);
+
+extern Block *reader_next(Reader *r);
+
+extern void reader_release(Reader *r, Block *block);
+
+extern void reader_free(Reader *r);
+
+#endif  // READER_H
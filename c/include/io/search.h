@@ -0,0 +1,68 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "histogram.h"
+#include "scanner.h"
+#include "table.h"
+#include "writer.h"
+
+/**
+ * Where the lines accepted by a table are printed, each after prefix when
+ * it is not NULL. Lines are added to out as slices of the input, which is
+ * synced before the input is released. Visits of the states are added to
+ * counts when it is not NULL. Long lines are walked on up to threads
+ * threads. The scan time of every input and of every buffer fed to the
+ * scanner is recorded in the histograms that are not NULL.
+ */
+typedef struct Search {
+    Table *table;
+    uint64_t *counts;
+    Writer *out;  // matching lines
+    FILE *err;    // diagnostics
+    const char *prefix;
+    int threads;
+    Histogram *file_latency;
+    Histogram *chunk_latency;
+} Search;
+
+/**
+ * Input fed chunk by chunk. Plain text goes through the scanner as it
+ * comes, out being synced after every chunk so that its buffer can be
+ * reused, while compressed input is gathered whole for the inflater, which
+ * the first chunk tells.
+ */
+typedef struct SearchStream {
+    Search *search;
+    const char *name;
+    Scanner *scanner;  // plain text, once the first chunk came
+    char *gathered;    // compressed input, when compressed
+    size_t len, capacity;
+    bool compressed;
+    bool ok;
+    uint64_t start;  // of the scan, when s keeps latencies
+} SearchStream;
+
+extern char *read_all(FILE *file, size_t *len);
+
+extern bool search_print(const char *head, size_t head_len, const char *line,
+                         size_t len, uint64_t offset, void *context);
+
+extern void search_feed(Search *s, Scanner *scanner, const char *data, size_t len);
+
+extern void search_text(Search *s, const char *text, size_t len);
+
+extern bool search_input(Search *s, const char *data, size_t len,
+                         const char *name);
+
+extern void search_stream_begin(SearchStream *st, Search *s, const char *name);
+
+extern void search_stream_feed(SearchStream *st, const char *data, size_t len);
+
+extern bool search_stream_end(SearchStream *st);
+
+#endif  // SEARCH_H
@@ -0,0 +1,29 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+extern const size_t WRITER_SPLICE_MIN;
+
+/**
+ * Output gathered as slices of the caller's buffers, written with writev
+ * once a batch is full. Slices that follow each other in memory are merged,
+ * so a run of matching lines is a single slice. When the descriptor is a
+ * pipe, slices of WRITER_SPLICE_MIN bytes and more are vmspliced instead
+ * of copied: the pipe then references the caller's pages until they are
+ * read, so writer_sync waits for the pipe to drain.
+ */
+typedef struct Writer Writer;
+
+extern Writer *writer_create(int fd);
+
+extern void writer_add(Writer *w, const char *data, size_t len);
+
+extern void writer_copy(Writer *w, const char *data, size_t len);
+
+extern bool writer_sync(Writer *w);
+
+extern void writer_free(Writer *w);
+
+#endif  // WRITER_H
@@ -0,0 +1,92 @@
+#ifndef LIBMYGREP_H
+#define LIBMYGREP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define MG_API __attribute__((visibility("default")))
+#else
+#define MG_API
+#endif
+
+/**
+ * Embeddable matcher. A pattern is compiled once into an immutable
+ * MgPattern, which any number of threads may then use concurrently:
+ *    - mg_match and mg_find work on whole buffers and never allocate
+ *    - mg_match_batch matches many short strings, walked together so
+ *      their table lookups overlap, into a bitmap
+ *    - mg_scan feeds a stream chunk by chunk, keeping the DFA state and the
+ *      partial last line in a per-thread MgScratch of the pattern, and
+ *      mg_scratch_failed tells a scan stopped on an error
+ * Like the command line tool, a line matches when the whole line is
+ * accepted by the pattern.
+ *
+ * An MgSet is a pattern list that changes while other threads match: writers
+ * add and remove patterns then commit, which compiles the union of the list
+ * reusing what the previous commits built, and readers take the last commit
+ * with mg_set_acquire, as an MgPattern matching any pattern of the list.
+ *
+ * The _with variants choose how the DFA of a pattern is built, as
+ * --construction does; both constructions match the same lines.
+ */
+typedef struct MgPattern MgPattern;
+
+typedef struct MgScratch MgScratch;
+
+typedef struct MgSet MgSet;
+
+typedef enum MgConstruction { MG_THOMPSON, MG_DERIVATIVES } MgConstruction;
+
+/* Called on every matching line, whose offset counts from the stream start */
+typedef bool (*MgLineFn)(const char *line, size_t len, uint64_t offset,
+                         void *context);
+
+MG_API extern MgPattern *mg_compile(const char *pattern, const char **error);
+
+MG_API extern MgPattern *mg_compile_with(const char *pattern,
+                                         MgConstruction construction,
+                                         const char **error);
+
+MG_API extern void mg_free(MgPattern *p);
+
+MG_API extern bool mg_match(const MgPattern *p, const char *s, size_t n);
+
+MG_API extern void mg_match_batch(const MgPattern *p, const char *const *strings,
+                                  const size_t *lengths, size_t count,
+                                  uint64_t *results);
+
+MG_API extern bool mg_find(const MgPattern *p, const char *s, size_t n,
+                           size_t *start, size_t *end);
+
+MG_API extern MgScratch *mg_scratch_create(const MgPattern *p);
+
+MG_API extern void mg_scratch_free(MgScratch *scratch);
+
+MG_API extern bool mg_scratch_failed(const MgScratch *scratch);
+
+MG_API extern bool mg_scan(const MgPattern *p, MgScratch *scratch,
+                           const char *s, size_t n, MgLineFn fn, void *context);
+
+MG_API extern bool mg_scan_end(const MgPattern *p, MgScratch *scratch,
+                               MgLineFn fn, void *context);
+
+MG_API extern MgSet *mg_set_create(void);
+
+MG_API extern int mg_set_add(MgSet *set, const char *pattern, const char **error);
+
+MG_API extern int mg_set_add_with(MgSet *set, const char *pattern,
+                                  MgConstruction construction, const char **error);
+
+MG_API extern bool mg_set_remove(MgSet *set, int id);
+
+MG_API extern bool mg_set_commit(MgSet *set);
+
+MG_API extern MgPattern *mg_set_acquire(MgSet *set);
+
+MG_API extern void mg_set_release(MgPattern *p);
+
+MG_API extern void mg_set_free(MgSet *set);
+
+#endif  // LIBMYGREP_H
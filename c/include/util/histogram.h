@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum { HISTOGRAM_SUB_BITS = 4 };  // 16 buckets per power of two, within 6.25%
+
+enum { HISTOGRAM_BUCKETS = (64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS };
+
+/**
+ * Log-linear histogram of durations in nanoseconds, in the manner of HDR
+ * histograms: the values below 16 have a bucket each, and every power of
+ * two above is split into 16 buckets. Threads record into it concurrently
+ * with atomic increments.
+ */
+typedef struct Histogram {
+    const char *name;
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+extern Histogram *histogram_create(const char *name);
+
+extern void histogram_record(Histogram *h, uint64_t ns);
+
+extern uint64_t histogram_percentile(const Histogram *h, double percentile);
+
+extern void histogram_print(FILE *file, const Histogram *h);
+
+extern void histogram_free(Histogram *h);
+
+extern uint64_t clock_ns(void);
+
+#endif  // HISTOGRAM_H
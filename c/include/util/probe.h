@@ -0,0 +1,28 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+/**
+ * Static tracepoints of the mygrep provider, for perf and bpftrace:
+ *    - compile_start(regex) and compile_phase(name, states) after each
+ *      phase of a compilation, the size of what it built
+ *    - scan_start(name, len) and scan_end(name, len, ok) around an input
+ *    - chunk_start(len) and chunk_end(len) around every buffer scanned
+ *    - dfa_state(id, subset size) for every state of a determinization
+ *    - cache_miss(pattern) when the daemon compiles a pattern
+ * With sys/sdt.h (HAVE_SDT), a probe is a nop and an ELF note until a
+ * tracer attaches. Without it, probes compile to nothing and their
+ * arguments are not evaluated.
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE1(name, a) DTRACE_PROBE1(mygrep, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(mygrep, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(mygrep, name, a, b, c)
+#else
+#define PROBE1(name, a) ((void)sizeof(a))
+#define PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#endif
+
+#endif  // PROBE_H
@@ -1,11 +1,20 @@
 #include "algorithm.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>  // strchr
 
+#include "approx.h"
 #include "automaton.h"
+#include "counting.h"
+#include "derivative.h"
 #include "parser.h"
+#include "probe.h"
+#include "simplify.h"
+#include "table.h"
+#include "utf8.h"
 
 DFA *brzozowski(DFA *dfa)
 {
@@ -19,68 +28,526 @@ DFA *brzozowski(DFA *dfa)
     return dfa_minimized;
 }
 
-NFA *thompson(AST *ast)
+/* A state with its (class, by) key, sorted by key then state */
+typedef struct {
+    int64_t key;
+    int state;
+} MooreKey;
+
+static int compare_moore_keys(const void *a, const void *b)
+{
+    const MooreKey *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return (x->state > y->state) - (x->state < y->state);
+}
+
+/*
+ * Splits every class by the value of by, returning the number of classes.
+ * The key class * n + by exceeds an int past 46341 states, so it is an
+ * int64_t and the states are sorted by it. Classes are then numbered in
+ * the order of their first state, as the hashed keys were.
+ */
+static int moore_refine(int *class, const int *by, int n)
+{
+    MooreKey *keys = malloc(n * sizeof(MooreKey));
+    for (int s = 0; s < n; s++)
+        keys[s] = (MooreKey){(int64_t)class[s] * n + by[s], s};
+    qsort(keys, n, sizeof(MooreKey), compare_moore_keys);
+
+    int groups = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || keys[i].key != keys[i - 1].key)
+            groups++;
+        class[keys[i].state] = groups - 1;
+    }
+    int *id = malloc(groups * sizeof(int)), count = 0;  // (group -> class)
+    for (int g = 0; g < groups; g++)
+        id[g] = -1;
+    for (int s = 0; s < n; s++) {
+        if (id[class[s]] < 0)
+            id[class[s]] = count++;
+        class[s] = id[class[s]];
+    }
+    free(keys);
+    free(id);
+    return count;
+}
+
+/*
+ * Minimal DFA of a complete DFA with states 0..n-1, all reachable, such as
+ * a product or the DFA of derivative_dfa. States are split until no symbol
+ * separates two states of a class, which costs a few passes over the
+ * transitions where brzozowski determinizes the mirror of the DFA, much
+ * larger for unions of patterns.
+ */
+DFA *moore(DFA *dfa)
+{
+    int n = dfa->_transitions->size, k = strlen(SYMBOLS);
+    int *delta = malloc((size_t)n * k * sizeof(int));
+    int *class = calloc(n, sizeof(int)), *by = malloc(n * sizeof(int));
+    for (int s = 0; s < n; s++) {
+        for (int a = 0; a < k; a++)
+            delta[s * k + a] = dfa_delta(dfa, multi_int(s), SYMBOLS[a]).value.i;
+        by[s] = hashtable_contains(dfa->final, multi_int(s));
+    }
+
+    int count = moore_refine(class, by, n), before = 0;
+    while (count > before) {
+        before = count;
+        for (int a = 0; a < k; a++) {
+            for (int s = 0; s < n; s++)
+                by[s] = class[delta[s * k + a]];
+            count = moore_refine(class, by, n);
+        }
+    }
+
+    DFA *minimal = dfa_create(multi_int(class[dfa->initial.value.i]));
+    for (int s = 0; s < n; s++) {
+        MultiType state = multi_int(class[s]);
+        if (hashtable_contains(dfa->final, multi_int(s)))
+            hashtable_set(minimal->final, state, state);
+        if (hashtable_contains(minimal->_transitions, state))
+            continue;
+        for (int a = 0; a < k; a++)
+            dfa_set_transition(minimal, state, SYMBOLS[a],
+                               multi_int(class[delta[s * k + a]]));
+    }
+    free(delta);
+    free(class);
+    free(by);
+    return minimal;
+}
+
+/* Adds a fresh state, reached from every final state on the bytes of group */
+static void thompson_append(NFA *nfa, AST *group, int *state)
 {
-    static int state = 0;
+    MultiType next = multi_int((*state)++);
+    Vector *final = hashtable_to_vector(nfa->final);
+    for (int i = 0; i < final->size; i++) {
+        for (int j = 0; j < group->arity; j++)
+            nfa_set_transition(nfa, final->array[i], group->childs.c[j], next);
+        hashtable_remove(nfa->final, final->array[i]);
+    }
+    vector_free(final);
+    hashtable_set(nfa->final, next, next);
+}
 
+/* Links the final states of nfa to the initial states of nfa2, into nfa */
+static void thompson_link(NFA *nfa, NFA *nfa2)
+{
+    Vector *final = hashtable_to_vector(nfa->final);
+    Vector *initial = hashtable_to_vector(nfa2->initial);
+    for (int i = 0; i < final->size; i++) {
+        for (int j = 0; j < initial->size; j++)
+            nfa_set_transition(nfa, final->array[i], EPSILON, initial->array[j]);
+    }
+    vector_free(initial);
+    vector_free(final);
+    hashtable_update(nfa->_transitions, nfa2->_transitions);
+    Set *tmp = nfa->final;
+    nfa->final = nfa2->final;
+    nfa2->final = tmp;
+    nfa_free(nfa2, false);
+}
+
+/* A state of a UTF-8 automaton, reached on bytes lo to hi of its sources */
+typedef struct Suffix {
+    unsigned char lo, hi;
+    int target;  // where the range leads
+    int state;   // the state taking the range to target
+} Suffix;
+
+/*
+ * Automaton of the code points of Unicode nodes, reading their UTF-8 bytes.
+ * The sequences are built from their last byte, and a state reading a
+ * range of bytes into a given state is shared by all of them, so that the
+ * continuation bytes common to many sequences are only built once.
+ */
+static NFA *thompson_unicode(AST **ranges, int count, int *state)
+{
+    NFA *nfa = nfa_create();
+    MultiType init = multi_int((*state)++), final = multi_int((*state)++);
+    hashtable_set(nfa->initial, init, init);
+    hashtable_set(nfa->final, final, final);
+    Vector *suffixes = vector_create(8);
+
+    for (int r = 0; r < count; r++) {
+        int n;
+        Utf8Range *seqs = utf8_ranges(ranges[r]->min, ranges[r]->max, &n);
+        for (int s = 0; s < n; s++) {
+            int target = final.value.i;
+            for (int k = seqs[s].len - 1; k > 0; k--) {
+                Suffix *shared = NULL;
+                for (int j = 0; j < suffixes->size && shared == NULL; j++) {
+                    Suffix *x = suffixes->array[j].value.p;
+                    if (x->lo == seqs[s].lo[k] && x->hi == seqs[s].hi[k]
+                        && x->target == target)
+                        shared = x;
+                }
+                if (shared == NULL) {
+                    shared = malloc(sizeof(Suffix));
+                    *shared = (Suffix){seqs[s].lo[k], seqs[s].hi[k], target, (*state)++};
+                    for (int c = shared->lo; c <= shared->hi; c++)
+                        nfa_set_transition(nfa, multi_int(shared->state), c,
+                                           multi_int(target));
+                    vector_push(suffixes, multi_pointer(shared));
+                }
+                target = shared->state;
+            }
+            for (int c = seqs[s].lo[0]; c <= seqs[s].hi[0]; c++)
+                nfa_set_transition(nfa, init, c, multi_int(target));
+        }
+        free(seqs);
+    }
+    for (int j = 0; j < suffixes->size; j++)
+        free(suffixes->array[j].value.p);
+    vector_free(suffixes);
+    return nfa;
+}
+
+/* Adds the states and transitions of nfa2 to nfa as an alternative */
+static void thompson_merge(NFA *nfa, NFA *nfa2)
+{
+    hashtable_update(nfa->_transitions, nfa2->_transitions);
+    hashtable_update(nfa->initial, nfa2->initial);
+    hashtable_update(nfa->final, nfa2->final);
+    nfa_free(nfa2, false);
+}
+
+/*
+ * Thompson's construction, numbering the new states from *state. Character
+ * groups of a concatenation extend the current final state instead of
+ * being linked by an epsilon transition, so literal runs are plain chains.
+ */
+static NFA *thompson_from(AST *ast, int *state)
+{
     switch (ast->tag) {
+        case Epsilon: {
+            NFA *nfa = nfa_create();
+            MultiType q = multi_int((*state)++);
+            hashtable_set(nfa->initial, q, q);
+            hashtable_set(nfa->final, q, q);
+            return nfa;
+        }
         case CharGroup: {
             NFA *nfa = nfa_create();
-            MultiType init = multi_int(state++), final = multi_int(state++);
+            MultiType init = multi_int((*state)++);
             hashtable_set(nfa->initial, init, init);
-            hashtable_set(nfa->final, final, final);
-
-            for (int i = 0; i < ast->arity; i++)
-                nfa_set_transition(nfa, init, ast->childs.c[i], final);
+            hashtable_set(nfa->final, init, init);
+            thompson_append(nfa, ast, state);
             return nfa;
         }
+        case Unicode:
+            return thompson_unicode(&ast, 1, state);
         case Union: {
-            NFA *nfa = thompson(ast->childs.a[0]);
-            NFA *nfa2 = thompson(ast->childs.a[1]);
-            hashtable_update(nfa->_transitions, nfa2->_transitions);
-            hashtable_update(nfa->initial, nfa2->initial);
-            hashtable_update(nfa->final, nfa2->final);
-            nfa_free(nfa2, false);
+            // The Unicode alternatives share a single UTF-8 automaton
+            AST **ranges = malloc(ast->arity * sizeof(AST *));
+            int count = 0;
+            NFA *nfa = NULL;
+            for (int i = 0; i < ast->arity; i++) {
+                if (ast->childs.a[i]->tag == Unicode) {
+                    ranges[count++] = ast->childs.a[i];
+                    continue;
+                }
+                NFA *nfa2 = thompson_from(ast->childs.a[i], state);
+                if (nfa == NULL)
+                    nfa = nfa2;
+                else
+                    thompson_merge(nfa, nfa2);
+            }
+            if (count > 0) {
+                NFA *nfa2 = thompson_unicode(ranges, count, state);
+                if (nfa == NULL)
+                    nfa = nfa2;
+                else
+                    thompson_merge(nfa, nfa2);
+            }
+            free(ranges);
             return nfa;
         }
         case Concat: {
-            NFA *nfa = thompson(ast->childs.a[0]);
-            NFA *nfa2 = thompson(ast->childs.a[1]);
-
-            Vector *final = hashtable_to_vector(nfa->final);
-            for (int i = 0; i < final->size; i++) {
-                Vector *initial = hashtable_to_vector(nfa2->initial);
-
-                for (int j = 0; j < initial->size; j++)
-                    nfa_set_transition(nfa, final->array[i], EPSILON,
-                                       initial->array[j]);
-                vector_free(initial);
+            NFA *nfa = thompson_from(ast->childs.a[0], state);
+            for (int i = 1; i < ast->arity; i++) {
+                if (ast->childs.a[i]->tag == CharGroup)
+                    thompson_append(nfa, ast->childs.a[i], state);
+                else
+                    thompson_link(nfa, thompson_from(ast->childs.a[i], state));
             }
-            vector_free(final);
-            nfa->final = nfa2->final;
-            nfa_free(nfa2, false);
             return nfa;
         }
         case Star: {
-            NFA *nfa = thompson(ast->childs.a[0]);
-
+            // A fresh state, initial and final, entering and ending the loop
+            NFA *nfa = thompson_from(ast->childs.a[0], state);
+            MultiType loop = multi_int((*state)++);
+            Vector *initial = hashtable_to_vector(nfa->initial);
+            for (int i = 0; i < initial->size; i++) {
+                nfa_set_transition(nfa, loop, EPSILON, initial->array[i]);
+                hashtable_remove(nfa->initial, initial->array[i]);
+            }
+            vector_free(initial);
             Vector *final = hashtable_to_vector(nfa->final);
             for (int i = 0; i < final->size; i++) {
-                MultiType q_f = final->array[i];
-                Vector *initial = hashtable_to_vector(nfa->initial);
-
-                for (int j = 0; j < initial->size; j++) {
-                    MultiType q_i = initial->array[j];
-                    nfa_set_transition(nfa, q_i, EPSILON, q_f);
-                    nfa_set_transition(nfa, q_f, EPSILON, q_i);
-                }
-                vector_free(initial);
+                nfa_set_transition(nfa, final->array[i], EPSILON, loop);
+                hashtable_remove(nfa->final, final->array[i]);
             }
             vector_free(final);
+            hashtable_set(nfa->initial, loop, loop);
+            hashtable_set(nfa->final, loop, loop);
             return nfa;
         }
         default:
             fprintf(stderr, "Invalid AST tag");
             exit(EXIT_FAILURE);
     }
-}
\ No newline at end of file
+}
+
+NFA *thompson(AST *ast)
+{
+    int state = 0;
+    return thompson_from(ast, &state);
+}
+
+/* Simplified AST of a regex, its letters standing for both cases when fold */
+static AST *parse_simplified(const char *regex, bool fold)
+{
+    PROBE1(compile_start, regex);
+    AST *ast = ast_simplify(fold ? parse_fold(regex) : parse(regex));
+    PROBE2(compile_phase, "parse", 0);
+    return ast;
+}
+
+/*
+ * Minimal DFA of a simplified AST, consuming ast. When fold, the DFA only
+ * reads lowercase ASCII letters, for a table folding the uppercase ones.
+ */
+static DFA *compile_dfa(AST *ast, bool fold, Construction construction)
+{
+    if (fold)
+        ast_lower(ast);
+    if (construction == ConstructionDerivatives) {
+        DFA *dfa = derivative_dfa(ast);
+        ast_free(ast);
+        PROBE2(compile_phase, "derivatives", dfa->_transitions->size);
+        DFA *minimal = moore(dfa);
+        dfa_free(dfa, true);
+        PROBE2(compile_phase, "minimize", minimal->_transitions->size);
+        return minimal;
+    }
+    NFA *nfa = thompson(ast);
+    ast_free(ast);
+    PROBE2(compile_phase, "thompson", nfa->_transitions->size);
+    DFA *dfa = nfa_determinize(nfa);
+    nfa_free(nfa, true);
+    PROBE2(compile_phase, "determinize", dfa->_transitions->size);
+    DFA *minimal = brzozowski(dfa);
+    dfa_free(dfa, true);
+    PROBE2(compile_phase, "minimize", minimal->_transitions->size);
+    return minimal;
+}
+
+/* Transition table of a minimal DFA */
+static Table *table_of(DFA *minimal, bool fold)
+{
+    Table *table = table_create(minimal);
+    if (fold)
+        table_fold_case(table);
+    table_reorder(table, NULL);
+    PROBE2(compile_phase, "table", table->size);
+    return table;
+}
+
+/* Same, consuming the DFA */
+static Table *compile_table(DFA *minimal, bool fold)
+{
+    Table *table = table_of(minimal, fold);
+    dfa_free(minimal, true);
+    return table;
+}
+
+/* Minimal DFA of a simplified AST, as a transition table, consuming ast */
+static Table *compile_ast(AST *ast, bool fold, Construction construction)
+{
+    return compile_table(compile_dfa(ast, fold, construction), fold);
+}
+
+static Table *compile_regex(const char *regex, bool fold, Construction construction)
+{
+    AST *ast = parse_simplified(regex, fold);
+    Counting *counting = counting_create(ast);
+    if (counting != NULL)
+        ast = counting_approximate(ast);
+    Table *table = compile_ast(ast, fold, construction);
+    table->counting = counting;
+    return table;
+}
+
+/* Compiles a regex down to a minimal DFA and its transition table */
+Table *regex_compile(const char *regex, Construction construction)
+{
+    return compile_regex(regex, false, construction);
+}
+
+/*
+ * Table of the lines within k errors of a regex, ignoring case when fold:
+ * its DFA accepts any line, which approx then checks. NULL when the regex
+ * is too long for approx.
+ */
+Table *regex_compile_approx(const char *regex, int k, bool fold)
+{
+    AST *ast = parse_simplified(regex, fold);
+    Approx *approx = approx_create(ast, k);
+    ast_free(ast);
+    if (approx == NULL)
+        return NULL;
+    Table *table = compile_ast(ast_create(Star, 1, 1, parse(".")), false,
+                               ConstructionThompson);
+    // The DFA only reads ALPHABET, but a substitution can be any byte
+    for (int c = 0; c < 256; c++)
+        table->map[c] = table->map[(unsigned char)ALPHABET[0]];
+    table->approx = approx;
+    return table;
+}
+
+/* Minimal DFA accepting no line, which no regex denotes */
+DFA *regex_compile_empty(Construction construction)
+{
+    return compile_dfa(ast_create(CharGroup, 0, 0), false, construction);
+}
+
+/*
+ * Minimal DFA of a regex. Counted repetitions stand for their x+
+ * approximation, and *counted then tells that the DFA accepts more lines
+ * than the regex, for regex_compile_confirmed to confirm.
+ */
+DFA *regex_compile_dfa(const char *regex, Construction construction, bool *counted)
+{
+    AST *ast = parse_simplified(regex, false);
+    Counting *counting = counting_create(ast);
+    *counted = counting != NULL;
+    if (counting != NULL) {
+        counting_free(counting);
+        ast = counting_approximate(ast);
+    }
+    return compile_dfa(ast, false, construction);
+}
+
+/*
+ * Table of dfa, as regex_compile_dfa built it for a counted regex, whose
+ * lines the counting automaton of the regex confirms. dfa is not consumed.
+ */
+Table *regex_compile_confirmed(const char *regex, DFA *dfa)
+{
+    AST *ast = parse_simplified(regex, false);
+    Table *table = table_of(dfa, false);
+    table->counting = counting_create(ast);
+    ast_free(ast);
+    return table;
+}
+
+/* Minimal DFA of the product of a and b, consuming them */
+static DFA *combine(DFA *a, DFA *b, bool intersect)
+{
+    DFA *product = dfa_product(a, b, intersect);
+    dfa_free(a, true);
+    dfa_free(b, true);
+    PROBE2(compile_phase, "product", product->_transitions->size);
+    DFA *minimal = moore(product);
+    dfa_free(product, true);
+    PROBE2(compile_phase, "minimize", minimal->_transitions->size);
+    return minimal;
+}
+
+/*
+ * Sends the bytes outside SYMBOLS, missing from the DFA, to an accepting
+ * sink. The patterns never match such a byte, so once it is read, every
+ * clause has the value it has on a line it does not match. NUL is the
+ * EPSILON letter of the automata, so the table maps it to the sink apart.
+ */
+static void accept_other_bytes(DFA *dfa)
+{
+    int sink = dfa->_transitions->size;  // states are numbered 0..n-1
+    hashtable_set(dfa->final, multi_int(sink), multi_int(sink));
+    for (int q = 0; q <= sink; q++) {
+        for (int c = 1; c < 256; c++) {
+            if (c != '\n' && (q == sink || strchr(SYMBOLS, c) == NULL))
+                dfa_set_transition(dfa, multi_int(q), (char)c, multi_int(sink));
+        }
+    }
+}
+
+/*
+ * Compiles a boolean combination of regexes into a single DFA, inverted
+ * when invert and ignoring case when fold. A product of clauses is the
+ * intersection of their DFAs, negated clauses being complemented, and the
+ * sum is the union of the products.
+ *
+ * A clause with counted repetitions stands for the DFA of its x+
+ * approximation where it counts positively, and for no line where it
+ * counts negatively, once negation and invert are applied. The DFA then
+ * accepts more lines than the combination, and the table confirms them
+ * with the exact combination of the clause tables.
+ */
+Table *regex_compile_clauses(const Clause *clauses, int count, bool invert,
+                             bool fold, Construction construction)
+{
+    if (count == 1 && !clauses[0].negated && !invert)
+        return compile_regex(clauses[0].pattern, fold, construction);
+
+    AST **asts = malloc(count * sizeof(AST *));
+    Counting **countings = malloc(count * sizeof(Counting *));
+    TableCombination *combination = NULL;
+    for (int i = 0; i < count; i++) {
+        asts[i] = parse_simplified(clauses[i].pattern, fold);
+        countings[i] = counting_create(asts[i]);
+        if (countings[i] != NULL && combination == NULL)
+            combination = table_combination_create(count, invert);
+    }
+
+    DFA *sum = NULL, *product = NULL;
+    bool all_negated = true;  // in the current product
+    bool other = false;       // value of the combination on any other byte
+    for (int i = 0; i < count; i++) {
+        AST *ast = countings[i] != NULL ? counting_approximate(asts[i]) : asts[i];
+        DFA *dfa = compile_dfa(ast, fold, construction);
+        if (combination != NULL) {
+            Table *table = table_of(dfa, fold);
+            table->counting = countings[i];
+            combination->tables[i] = table;
+            combination->negated[i] = clauses[i].negated;
+            combination->joined[i] = clauses[i].op == BoolAnd;
+        }
+        if (countings[i] != NULL && clauses[i].negated != invert) {
+            dfa_free(dfa, true);  // for no line, below the clause
+            dfa = regex_compile_empty(construction);
+        }
+        if (clauses[i].negated)
+            dfa_complement(dfa);
+        if (product != NULL && clauses[i].op == BoolOr) {
+            sum = sum == NULL ? product : combine(sum, product, false);
+            other |= all_negated;
+            product = NULL;
+            all_negated = true;
+        }
+        product = product == NULL ? dfa : combine(product, dfa, true);
+        all_negated &= clauses[i].negated;
+    }
+    sum = sum == NULL ? product : combine(sum, product, false);
+    other |= all_negated;
+    free(asts);
+    free(countings);
+
+    if (invert) {
+        dfa_complement(sum);
+        other = !other;
+    }
+    DFA *minimal = moore(sum);
+    dfa_free(sum, true);
+    if (other)
+        accept_other_bytes(minimal);
+    Table *table = compile_table(minimal, fold);
+    if (other)
+        table->map[0] = table->map[1];  // NUL, as byte 1, goes to the sink
+    table->combination = combination;
+    return table;
+}
@@ -0,0 +1,350 @@
+/**
+ * Approximate matching on the Glushkov positions of the pattern. Position
+ * 0 is the start, and every other position is a character group, entered
+ * only on a byte of its group. With R[j] the positions reached with j
+ * errors and F(R) the positions following R, a byte c leads to:
+ *    - R'[0] = F(R[0]) & B[c], B[c] being the positions of the groups of c
+ *    - R'[j] = F(R[j]) & B[c]   match
+ *            | R[j - 1]         insertion of c
+ *            | F(R[j - 1])      substitution of c
+ *            | F(R'[j - 1])     deletion of a position
+ * F is the union of the follow sets of the positions in a set, looked up
+ * 8 positions at a time, and F(R[j]) is kept from a byte to the next.
+ */
+
+#include "approx.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>  // memcpy, memset
+
+#include "parser.h"
+#include "utf8.h"
+
+enum { MAX_ERRORS = 16, MAX_WORDS = 8 };
+
+const int APPROX_MAX_ERRORS = MAX_ERRORS;
+
+const int APPROX_MAX_POSITIONS = MAX_WORDS * 64 - 1;  // and the start
+
+// Vectors of approx_accept for the largest k and pattern
+enum { STACK_WORDS = 2 * (MAX_ERRORS + 2) * MAX_WORDS };
+
+struct Approx {
+    int k;
+    int words;          // of a set of positions
+    uint64_t *match;    // byte -> positions of the groups holding it
+    uint64_t *follow;   // (8 positions, their bits in a set) -> following
+    uint64_t *final;    // positions ending a match
+    uint64_t *start;    // j -> positions reached from the start by j deletions
+};
+
+/* Follow sets of the positions while they are computed */
+typedef struct Builder {
+    Approx *a;
+    uint64_t *follow;  // position -> following positions
+    int next;          // next free position
+} Builder;
+
+static void set_bit(uint64_t *set, int i)
+{
+    set[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+static void set_union(uint64_t *set, const uint64_t *other, int words)
+{
+    for (int w = 0; w < words; w++)
+        set[w] |= other[w];
+}
+
+static int count_positions(AST *ast)
+{
+    if (ast->tag == CharGroup)
+        return 1;
+    if (ast->tag == Repeat) {  // a copy of the body per count
+        int body = count_positions(ast->childs.a[0]);
+        return body > 0 && ast->max > APPROX_MAX_POSITIONS / body
+                   ? APPROX_MAX_POSITIONS + 1
+                   : ast->max * body;
+    }
+    if (ast->tag == Unicode) {  // a position per byte of its UTF-8 ranges
+        int n, count = 0;
+        Utf8Range *seqs = utf8_ranges(ast->min, ast->max, &n);
+        for (int s = 0; s < n; s++)
+            count += seqs[s].len;
+        free(seqs);
+        return count;
+    }
+    int count = 0;
+    for (int i = 0; i < ast->arity; i++)
+        count += count_positions(ast->childs.a[i]);
+    return count;
+}
+
+/* Adds a position for the bytes of group */
+static int add_position(Builder *b, AST *group)
+{
+    int p = b->next++;
+    for (int i = 0; i < group->arity; i++) {
+        unsigned char c = group->childs.c[i];
+        set_bit(b->a->match + (size_t)c * b->a->words, p);
+    }
+    return p;
+}
+
+/* Adds a position for the bytes lo to hi */
+static int add_range(Builder *b, int lo, int hi)
+{
+    int p = b->next++;
+    for (int c = lo; c <= hi; c++)
+        set_bit(b->a->match + (size_t)c * b->a->words, p);
+    return p;
+}
+
+/* Makes the positions of first follow every position of last */
+static void add_follow(Builder *b, const uint64_t *last, const uint64_t *first)
+{
+    int words = b->a->words;
+    for (int w = 0; w < words; w++) {
+        for (uint64_t bits = last[w]; bits != 0; bits &= bits - 1) {
+            int p = w * 64 + __builtin_ctzll(bits);
+            set_union(b->follow + (size_t)p * words, first, words);
+        }
+    }
+}
+
+/*
+ * Appends a factor, of sets factor_first and factor_last, to a
+ * concatenation of sets first and last, nullable telling whether the
+ * concatenation so far and empty whether the factor match the empty string
+ */
+static void concat_factor(Builder *b, uint64_t *first, uint64_t *last,
+                          const uint64_t *factor_first, const uint64_t *factor_last,
+                          bool nullable, bool empty)
+{
+    int words = b->a->words;
+    add_follow(b, last, factor_first);
+    if (nullable)
+        set_union(first, factor_first, words);
+    if (!empty)
+        memset(last, 0, words * sizeof(uint64_t));
+    set_union(last, factor_last, words);
+}
+
+/*
+ * Numbers the positions of ast and links them, filling the cleared sets
+ * first and last. Returns whether ast matches the empty string.
+ */
+static bool glushkov(Builder *b, AST *ast, uint64_t *first, uint64_t *last)
+{
+    int words = b->a->words;
+    switch (ast->tag) {
+        case CharGroup: {
+            int p = add_position(b, ast);
+            set_bit(first, p);
+            set_bit(last, p);
+            return false;
+        }
+        case Repeat: {  // max copies of the body, those past min being optional
+            uint64_t *copy_first = malloc(2 * words * sizeof(uint64_t));
+            uint64_t *copy_last = copy_first + words;
+            bool nullable = true;
+            for (int i = 0; i < ast->max; i++) {
+                memset(copy_first, 0, 2 * words * sizeof(uint64_t));
+                bool empty = glushkov(b, ast->childs.a[0], copy_first, copy_last);
+                empty |= i >= ast->min;
+                concat_factor(b, first, last, copy_first, copy_last, nullable, empty);
+                nullable &= empty;
+            }
+            free(copy_first);
+            return nullable;
+        }
+        case Unicode: {  // a chain of positions per UTF-8 range
+            int n;
+            Utf8Range *seqs = utf8_ranges(ast->min, ast->max, &n);
+            for (int s = 0; s < n; s++) {
+                int p = add_range(b, seqs[s].lo[0], seqs[s].hi[0]);
+                set_bit(first, p);
+                for (int k = 1; k < seqs[s].len; k++) {
+                    int q = add_range(b, seqs[s].lo[k], seqs[s].hi[k]);
+                    set_bit(b->follow + (size_t)p * words, q);
+                    p = q;
+                }
+                set_bit(last, p);
+            }
+            free(seqs);
+            return false;
+        }
+        case Star:
+            glushkov(b, ast->childs.a[0], first, last);
+            add_follow(b, last, first);
+            return true;
+        case Epsilon:
+            return true;
+        default: {  // Concat, Union
+            uint64_t *child_first = malloc(2 * words * sizeof(uint64_t));
+            uint64_t *child_last = child_first + words;
+            bool nullable = ast->tag == Concat;
+            for (int i = 0; i < ast->arity; i++) {
+                memset(child_first, 0, 2 * words * sizeof(uint64_t));
+                bool empty = glushkov(b, ast->childs.a[i], child_first, child_last);
+                if (ast->tag == Union) {
+                    set_union(first, child_first, words);
+                    set_union(last, child_last, words);
+                    nullable |= empty;
+                    continue;
+                }
+                concat_factor(b, first, last, child_first, child_last, nullable, empty);
+                nullable &= empty;
+            }
+            free(child_first);
+            return nullable;
+        }
+    }
+}
+
+/* Union of the follow sets of the positions in set, into out */
+static inline void follow_of(const Approx *a, int words, const uint64_t *set,
+                             uint64_t *out)
+{
+    memset(out, 0, words * sizeof(uint64_t));
+    for (int w = 0; w < words; w++) {
+        // Only the non-zero bytes of the set, as few positions are active
+        for (uint64_t bits = set[w]; bits != 0;) {
+            int k = __builtin_ctzll(bits) / 8;
+            size_t chunk = (size_t)(w * 8 + k) * 256 + (bits >> 8 * k & 255);
+            set_union(out, a->follow + chunk * words, words);
+            bits &= ~(UINT64_C(255) << 8 * k);
+        }
+    }
+}
+
+/* Tables of the unions of follow sets, for every 8 positions */
+static void fill_follow(Approx *a, const uint64_t *follow)
+{
+    int words = a->words;
+    a->follow = calloc((size_t)words * 8 * 256 * words, sizeof(uint64_t));
+    for (int chunk = 0; chunk < words * 8; chunk++) {
+        uint64_t *table = a->follow + (size_t)chunk * 256 * words;
+        for (int v = 1; v < 256; v++) {
+            int p = chunk * 8 + __builtin_ctz(v);
+            memcpy(table + (size_t)v * words, table + (size_t)(v & (v - 1)) * words,
+                   words * sizeof(uint64_t));
+            set_union(table + (size_t)v * words, follow + (size_t)p * words, words);
+        }
+    }
+}
+
+/*
+ * Matcher of the lines within k errors of a simplified AST, NULL when k
+ * exceeds APPROX_MAX_ERRORS or the AST APPROX_MAX_POSITIONS positions.
+ */
+Approx *approx_create(AST *ast, int k)
+{
+    int positions = count_positions(ast);
+    if (k < 0 || k > APPROX_MAX_ERRORS || positions > APPROX_MAX_POSITIONS)
+        return NULL;
+    Approx *a = calloc(1, sizeof(Approx));
+    a->k = k;
+    a->words = (positions + 1 + 63) / 64;
+    int words = a->words;
+    a->match = calloc((size_t)256 * words, sizeof(uint64_t));
+    a->final = calloc(words, sizeof(uint64_t));
+    Builder b = {a, calloc((size_t)words * 64 * words, sizeof(uint64_t)), 1};
+
+    uint64_t *first = calloc(words, sizeof(uint64_t));
+    if (glushkov(&b, ast, first, a->final))
+        set_bit(a->final, 0);
+    set_union(b.follow, first, words);  // the start is followed by first
+    free(first);
+    fill_follow(a, b.follow);
+    free(b.follow);
+
+    a->start = calloc((size_t)(k + 1) * words, sizeof(uint64_t));
+    set_bit(a->start, 0);
+    uint64_t *next = malloc(words * sizeof(uint64_t));
+    for (int j = 1; j <= k; j++) {
+        uint64_t *row = a->start + (size_t)j * words;
+        follow_of(a, words, row - words, next);
+        memcpy(row, row - words, words * sizeof(uint64_t));
+        set_union(row, next, words);
+    }
+    free(next);
+    return a;
+}
+
+/* Steps the rows over the bytes of s, false once no row is active */
+static inline bool approx_run(const Approx *a, int words, uint64_t *rows,
+                              uint64_t *follows, uint64_t *saved,
+                              const char *s, size_t n)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    uint64_t *last = rows + (size_t)a->k * words;
+    for (size_t i = 0; i < n; i++) {
+        const uint64_t *match = a->match + (size_t)u[i] * words;
+        uint64_t *prev_row = saved, *prev_follow = saved + words;  // of row j - 1
+        for (int j = 0; j <= a->k; j++) {
+            uint64_t *row = rows + (size_t)j * words;
+            uint64_t *follow = follows + (size_t)j * words;
+            for (int w = 0; w < words; w++) {
+                uint64_t next = follow[w] & match[w];
+                if (j > 0)
+                    next |= prev_row[w] | prev_follow[w] | follow[w - words];
+                prev_row[w] = row[w];
+                prev_follow[w] = follow[w];
+                row[w] = next;
+            }
+            follow_of(a, words, row, follow);
+        }
+        bool active = false;
+        for (int w = 0; w < words; w++)
+            active |= last[w] != 0;
+        if (!active)
+            return false;
+    }
+    return true;
+}
+
+static inline bool approx_lines(const Approx *a, int words, const char *head,
+                                size_t head_len, const char *s, size_t n)
+{
+    uint64_t vectors[STACK_WORDS];
+    uint64_t *rows = vectors;
+    uint64_t *follows = rows + (size_t)(a->k + 1) * words;
+    uint64_t *saved = follows + (size_t)(a->k + 1) * words;
+    memcpy(rows, a->start, (size_t)(a->k + 1) * words * sizeof(uint64_t));
+    for (int j = 0; j <= a->k; j++)
+        follow_of(a, words, rows + (size_t)j * words, follows + (size_t)j * words);
+
+    if (!approx_run(a, words, rows, follows, saved, head, head_len)
+        || !approx_run(a, words, rows, follows, saved, s, n))
+        return false;
+    const uint64_t *last = rows + (size_t)a->k * words;
+    for (int w = 0; w < words; w++) {
+        if (last[w] & a->final[w])
+            return true;
+    }
+    return false;
+}
+
+/* Whether the line made of head then s is within k errors of the pattern */
+bool approx_accept(const Approx *a, const char *head, size_t head_len,
+                   const char *s, size_t n)
+{
+    if (a->words == 1)  // specialized for the usual short patterns
+        return approx_lines(a, 1, head, head_len, s, n);
+    return approx_lines(a, a->words, head, head_len, s, n);
+}
+
+void approx_free(Approx *a)
+{
+    if (a == NULL)
+        return;
+    free(a->match);
+    free(a->follow);
+    free(a->final);
+    free(a->start);
+    free(a);
+}
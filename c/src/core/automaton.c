@@ -11,12 +11,24 @@
 
 #include "hashtable.h"
 #include "multitype.h"
+#include "probe.h"
 #include "vector.h"
 
 const char EPSILON = '\0';
 const int HT_INIT_SIZE = 2;
 const char ALPHABET[] =
     "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+// ALPHABET, then every byte of a multibyte UTF-8 character
+const char SYMBOLS[] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "\x80\x81\x82\x83\x84\x85\x86\x87\x88\x89\x8A\x8B\x8C\x8D\x8E\x8F"
+    "\x90\x91\x92\x93\x94\x95\x96\x97\x98\x99\x9A\x9B\x9C\x9D\x9E\x9F"
+    "\xA0\xA1\xA2\xA3\xA4\xA5\xA6\xA7\xA8\xA9\xAA\xAB\xAC\xAD\xAE\xAF"
+    "\xB0\xB1\xB2\xB3\xB4\xB5\xB6\xB7\xB8\xB9\xBA\xBB\xBC\xBD\xBE\xBF"
+    "\xC0\xC1\xC2\xC3\xC4\xC5\xC6\xC7\xC8\xC9\xCA\xCB\xCC\xCD\xCE\xCF"
+    "\xD0\xD1\xD2\xD3\xD4\xD5\xD6\xD7\xD8\xD9\xDA\xDB\xDC\xDD\xDE\xDF"
+    "\xE0\xE1\xE2\xE3\xE4\xE5\xE6\xE7\xE8\xE9\xEA\xEB\xEC\xED\xEE\xEF"
+    "\xF0\xF1\xF2\xF3\xF4";
 
 /* Creates a Deterministic Finite Automaton */
 DFA* dfa_create(MultiType initial)
@@ -36,15 +48,17 @@ void dfa_set_transition(DFA* dfa, MultiType state, char a, MultiType p)
 
 MultiType dfa_delta(DFA* dfa, MultiType state, char a)
 {
-    HashTable* h = hashtable_get_or_create(dfa->_transitions, state);
     if (a == EPSILON)
         return state;
-    return hashtable_get(h, multi_char(a));
+    MultiType h = hashtable_get(dfa->_transitions, state);
+    if (h.type == NullType)
+        return MULTI_NULL;
+    return hashtable_get((HashTable*)h.value.p, multi_char(a));
 }
 
 static MultiType dfa_delta_star(DFA* dfa, MultiType state, char* u)
 {
-    for (int i = 0; u[i] != '\0'; i++)
+    for (int i = 0; u[i] != '\0' && state.type != NullType; i++)
         state = dfa_delta(dfa, state, u[i]);
 
     return state;
@@ -53,14 +67,79 @@ static MultiType dfa_delta_star(DFA* dfa, MultiType state, char* u)
 bool dfa_accept(DFA* dfa, char* u)
 {
     MultiType state = dfa_delta_star(dfa, dfa->initial, u);
-    return hashtable_contains(dfa->final, state);
+    return state.type != NullType && hashtable_contains(dfa->final, state);
+}
+
+/*
+ * Makes dfa accept the words it rejected. The DFA must be complete over
+ * SYMBOLS, as built by nfa_determinize, so that every state has a row.
+ */
+void dfa_complement(DFA* dfa)
+{
+    Set* final = hashtable_create(HT_INIT_SIZE);
+    Vector* states = hashtable_to_vector(dfa->_transitions);
+    for (int i = 0; i < states->size; i++) {
+        if (!hashtable_contains(dfa->final, states->array[i]))
+            hashtable_set(final, states->array[i], states->array[i]);
+    }
+    vector_free(states);
+    hashtable_free(dfa->final, false);
+    dfa->final = final;
+}
+
+/*
+ * State of the pair (p, q), numbered on first sight. Pairs are found through
+ * a row of q per p, as a key p * nb + q would overflow an int on large DFAs.
+ */
+static MultiType product_state(HashTable* ids, Vector* pairs, int p, int q)
+{
+    HashTable* row = hashtable_get_or_create(ids, multi_int(p));
+    MultiType state = hashtable_get(row, multi_int(q));
+    if (state.type == NullType) {
+        state = multi_int(pairs->size / 2);
+        hashtable_set(row, multi_int(q), state);
+        vector_push(pairs, multi_int(p));
+        vector_push(pairs, multi_int(q));
+    }
+    return state;
+}
+
+/*
+ * Product of two complete DFAs with states numbered 0..n-1, accepting the
+ * words both accept when intersect, the words either accepts otherwise.
+ * Only the reachable pairs are built, numbered from 0 in the order they are
+ * reached.
+ */
+DFA* dfa_product(DFA* a, DFA* b, bool intersect)
+{
+    DFA* dfa = dfa_create(multi_int(0));
+    HashTable* ids = hashtable_create(HT_INIT_SIZE);  // (p -> (q -> state))
+    Vector* pairs = vector_create(HT_INIT_SIZE);      // p and q of each state
+
+    product_state(ids, pairs, a->initial.value.i, b->initial.value.i);
+    for (int s = 0; s < pairs->size / 2; s++) {
+        MultiType state = multi_int(s);
+        MultiType p = pairs->array[2 * s], q = pairs->array[2 * s + 1];
+        bool final_a = hashtable_contains(a->final, p);
+        bool final_b = hashtable_contains(b->final, q);
+        if (intersect ? final_a && final_b : final_a || final_b)
+            hashtable_set(dfa->final, state, state);
+
+        for (int i = 0; i < (int)strlen(SYMBOLS); i++) {
+            int p2 = dfa_delta(a, p, SYMBOLS[i]).value.i;
+            int q2 = dfa_delta(b, q, SYMBOLS[i]).value.i;
+            dfa_set_transition(dfa, state, SYMBOLS[i], product_state(ids, pairs, p2, q2));
+        }
+    }
+    vector_free(pairs);
+    hashtable_free(ids, true);
+    return dfa;
 }
 
 NFA* dfa_transpose(DFA* dfa)
 {
     NFA* nfa_tr = nfa_create();
-    nfa_tr->initial = hashtable_copy(dfa->final);
-    nfa_tr->final = hashtable_create(2);
+    hashtable_update(nfa_tr->initial, dfa->final);
     hashtable_set(nfa_tr->final, dfa->initial, dfa->initial);
 
     Vector* states = hashtable_to_vector(dfa->_transitions);
@@ -108,10 +187,7 @@ void nfa_set_transition(NFA* nfa, MultiType state, char a, MultiType p)
 Set* nfa_delta(NFA* nfa, MultiType state, char a)
 {
     HashTable* h = hashtable_get_or_create(nfa->_transitions, state);
-    Set* states = hashtable_get_or_create(h, multi_char(a));
-    if (a == EPSILON)
-        hashtable_set(states, multi_char(EPSILON), multi_char(EPSILON));
-    return states;
+    return hashtable_get_or_create(h, multi_char(a));
 }
 
 static Set* nfa_epsilon_closure(NFA* nfa, Set* states)
@@ -130,7 +206,6 @@ static Set* nfa_epsilon_closure(NFA* nfa, Set* states)
             for (Entry* e = q_closure->array[b]; e != NULL; e = e->next)
                 vector_push(stack, e->key);
         }
-        hashtable_free(q_closure, false);
     }
     vector_free(stack);
     return closure;
@@ -144,7 +219,13 @@ static Set* nfa_delta_states(NFA* nfa, Set* states, char a)
         for (Entry* e = states->array[b]; e != NULL; e = e->next) {
             if (e->key.type == NullType)
                 continue;
-            hashtable_update(next_states, nfa_delta(nfa, e->key, a));
+            // Looked up without creating the missing rows, unlike nfa_delta
+            MultiType row = hashtable_get(nfa->_transitions, e->key);
+            MultiType targets = row.type == NullType
+                                    ? MULTI_NULL
+                                    : hashtable_get((HashTable*)row.value.p, multi_char(a));
+            if (targets.type != NullType)
+                hashtable_update(next_states, (Set*)targets.value.p);
         }
     }
     Set* closure = nfa_epsilon_closure(nfa, next_states);
@@ -182,25 +263,362 @@ bool nfa_accept(NFA* nfa, char* u)
     return accept;
 }
 
+/*
+ * NFA with states numbered 0..n-1 and its transitions on SYMBOLS in arrays,
+ * the epsilon closure of every state computed once, when first needed.
+ */
+typedef struct Compact {
+    int n;
+    int* start;  // transitions of q at start[q]..start[q+1]-1, EPSILON excluded
+    unsigned char* letters;
+    int* targets;
+    int* eps_start;  // same for the epsilon transitions
+    int* eps;
+    bool* final;
+    int** closure;  // sorted, NULL until computed
+    int* closure_size;
+    int* seen;  // stamp of the last closure a state was put in
+    int seen_stamp;
+    int* mark;  // same for the unions of closures
+    int stamp;
+} Compact;
+
+/* Number of state, numbered when first seen */
+static int compact_index(HashTable* ids, MultiType state)
+{
+    MultiType id = hashtable_get(ids, state);
+    if (id.type == NullType) {
+        id = multi_int(ids->size);
+        hashtable_set(ids, state, id);
+    }
+    return id.value.i;
+}
+
+/* Transitions on EPSILON or SYMBOLS, in the order of the NFA tables */
+typedef struct Edges {
+    int* from;
+    int* to;
+    unsigned char* letters;
+    int size;
+    int capacity;
+} Edges;
+
+static void edges_push(Edges* e, int q, unsigned char a, int p)
+{
+    if (e->size == e->capacity) {
+        e->capacity = e->capacity == 0 ? 64 : 2 * e->capacity;
+        e->from = realloc(e->from, e->capacity * sizeof(int));
+        e->to = realloc(e->to, e->capacity * sizeof(int));
+        e->letters = realloc(e->letters, e->capacity);
+    }
+    e->from[e->size] = q;
+    e->to[e->size] = p;
+    e->letters[e->size++] = a;
+}
+
+static Edges compact_edges(NFA* nfa, HashTable* ids)
+{
+    bool symbol[256] = {false};
+    symbol[(unsigned char)EPSILON] = true;
+    for (int i = 0; SYMBOLS[i] != '\0'; i++)
+        symbol[(unsigned char)SYMBOLS[i]] = true;
+
+    Edges edges = {0};
+    for (int b = 0; b < nfa->_transitions->capacity; b++) {
+        for (Entry* e = nfa->_transitions->array[b]; e != NULL; e = e->next) {
+            int q = compact_index(ids, e->key);
+            HashTable* row = e->value.value.p;
+            for (int rb = 0; rb < row->capacity; rb++) {
+                for (Entry* r = row->array[rb]; r != NULL; r = r->next) {
+                    unsigned char a = r->key.value.c;
+                    if (!symbol[a])
+                        continue;
+                    Set* to = r->value.value.p;
+                    for (int tb = 0; tb < to->capacity; tb++) {
+                        for (Entry* t = to->array[tb]; t != NULL; t = t->next)
+                            edges_push(&edges, q, a, compact_index(ids, t->key));
+                    }
+                }
+            }
+        }
+    }
+    return edges;
+}
+
+static Compact* compact_create(NFA* nfa, HashTable* ids)
+{
+    Compact* c = calloc(1, sizeof(Compact));
+    Edges edges = compact_edges(nfa, ids);
+    Vector* initial = hashtable_to_vector(nfa->initial);
+    for (int i = 0; i < initial->size; i++)
+        compact_index(ids, initial->array[i]);
+    vector_free(initial);
+
+    // Counting sort of the transitions by state, through start[q + 1]
+    c->n = ids->size;
+    c->start = calloc(c->n + 1, sizeof(int));
+    c->eps_start = calloc(c->n + 1, sizeof(int));
+    for (int i = 0; i < edges.size; i++) {
+        if (edges.letters[i] == (unsigned char)EPSILON)
+            c->eps_start[edges.from[i] + 1]++;
+        else
+            c->start[edges.from[i] + 1]++;
+    }
+    for (int q = 0; q < c->n; q++) {
+        c->start[q + 1] += c->start[q];
+        c->eps_start[q + 1] += c->eps_start[q];
+    }
+    c->letters = malloc(c->start[c->n] + 1);
+    c->targets = malloc((c->start[c->n] + 1) * sizeof(int));
+    c->eps = malloc((c->eps_start[c->n] + 1) * sizeof(int));
+    for (int i = 0; i < edges.size; i++) {  // start[q] moves to the next state
+        int q = edges.from[i];
+        if (edges.letters[i] == (unsigned char)EPSILON)
+            c->eps[c->eps_start[q]++] = edges.to[i];
+        else {
+            c->letters[c->start[q]] = edges.letters[i];
+            c->targets[c->start[q]++] = edges.to[i];
+        }
+    }
+    for (int q = c->n; q > 0; q--) {
+        c->start[q] = c->start[q - 1];
+        c->eps_start[q] = c->eps_start[q - 1];
+    }
+    c->start[0] = c->eps_start[0] = 0;
+    free(edges.from);
+    free(edges.to);
+    free(edges.letters);
+
+    c->final = calloc(c->n, sizeof(bool));
+    Vector* final = hashtable_to_vector(nfa->final);
+    for (int i = 0; i < final->size; i++) {
+        MultiType id = hashtable_get(ids, final->array[i]);
+        if (id.type != NullType)
+            c->final[id.value.i] = true;
+    }
+    vector_free(final);
+    c->closure = calloc(c->n, sizeof(int*));
+    c->closure_size = calloc(c->n, sizeof(int));
+    c->seen = calloc(c->n, sizeof(int));
+    c->mark = calloc(c->n, sizeof(int));
+    return c;
+}
+
+static void compact_free(Compact* c)
+{
+    for (int q = 0; q < c->n; q++)
+        free(c->closure[q]);
+    free(c->closure);
+    free(c->closure_size);
+    free(c->seen);
+    free(c->mark);
+    free(c->final);
+    free(c->start);
+    free(c->letters);
+    free(c->targets);
+    free(c->eps_start);
+    free(c->eps);
+    free(c);
+}
+
+static int compare_int(const void* a, const void* b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/* Epsilon closure of q, sorted */
+static int* compact_closure(Compact* c, int q, int* size)
+{
+    if (c->closure[q] == NULL) {
+        int* closure = malloc(c->n * sizeof(int));
+        int n = 0, stamp = ++c->seen_stamp;
+        closure[n++] = q;
+        c->seen[q] = stamp;
+        for (int i = 0; i < n; i++) {  // closure is the queue
+            for (int j = c->eps_start[closure[i]]; j < c->eps_start[closure[i] + 1]; j++) {
+                int p = c->eps[j];
+                if (c->seen[p] != stamp) {
+                    c->seen[p] = stamp;
+                    closure[n++] = p;
+                }
+            }
+        }
+        qsort(closure, n, sizeof(int), compare_int);
+        c->closure[q] = realloc(closure, n * sizeof(int));
+        c->closure_size[q] = n;
+    }
+    *size = c->closure_size[q];
+    return c->closure[q];
+}
+
+/*
+ * Subsets of NFA states as sorted arrays, numbered in the order reached,
+ * found again through an open addressing table of their numbers.
+ */
+typedef struct Subsets {
+    int** states;
+    int* sizes;
+    int count;
+    int capacity;
+    int* slots;  // -1 when free
+    int nslots;
+} Subsets;
+
+static unsigned subset_hash(const int* states, int size)
+{
+    unsigned h = 2166136261u;  // FNV-1a over the state numbers
+    for (int i = 0; i < size; i++)
+        h = (h ^ (unsigned)states[i]) * 16777619u;
+    return h;
+}
+
+static int* subset_slot(Subsets* s, const int* states, int size)
+{
+    unsigned i = subset_hash(states, size) & (s->nslots - 1);
+    for (; s->slots[i] != -1; i = (i + 1) & (s->nslots - 1)) {
+        int id = s->slots[i];
+        if (s->sizes[id] == size
+            && (size == 0 || memcmp(s->states[id], states, size * sizeof(int)) == 0))
+            break;
+    }
+    return &s->slots[i];
+}
+
+/* Number of the subset, taking states, which is freed when already known */
+static int subsets_id(Subsets* s, int* states, int size)
+{
+    if (2 * (s->count + 1) > s->nslots) {
+        free(s->slots);
+        s->nslots = s->nslots == 0 ? 64 : 2 * s->nslots;
+        s->slots = malloc(s->nslots * sizeof(int));
+        memset(s->slots, -1, s->nslots * sizeof(int));
+        for (int id = 0; id < s->count; id++)
+            *subset_slot(s, s->states[id], s->sizes[id]) = id;
+    }
+    int* slot = subset_slot(s, states, size);
+    if (*slot != -1) {
+        free(states);
+        return *slot;
+    }
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity == 0 ? 64 : 2 * s->capacity;
+        s->states = realloc(s->states, s->capacity * sizeof(int*));
+        s->sizes = realloc(s->sizes, s->capacity * sizeof(int));
+    }
+    s->states[s->count] = states;
+    s->sizes[s->count] = size;
+    *slot = s->count;
+    return s->count++;
+}
+
+/* Sorted union of the closures of the count states at targets */
+static int* closure_union(Compact* c, const int* targets, int count, int* size)
+{
+    int n = 0, capacity = 16, stamp = ++c->stamp;
+    int* states = malloc(capacity * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        int closure_size;
+        int* closure = compact_closure(c, targets[i], &closure_size);
+        for (int j = 0; j < closure_size; j++) {
+            if (c->mark[closure[j]] == stamp)
+                continue;
+            c->mark[closure[j]] = stamp;
+            if (n == capacity)
+                states = realloc(states, (capacity *= 2) * sizeof(int));
+            states[n++] = closure[j];
+        }
+    }
+    if (count > 1)  // a single closure is sorted already
+        qsort(states, n, sizeof(int), compare_int);
+    *size = n;
+    return states;
+}
+
+/*
+ * Subset construction over SYMBOLS. Each subset of NFA states is numbered
+ * the first time it is reached, so the resulting DFA has integer states
+ * 0..n-1 and 0 is the initial state. The transitions of a subset are read
+ * once, grouped by letter, and the letters on none of them all lead to the
+ * empty subset.
+ */
 DFA* nfa_determinize(NFA* nfa)
 {
-    DFA* dfa = dfa_create(multi_char(EPSILON));
-    Vector* stack = vector_create(HT_INIT_SIZE);
-    vector_push(stack, multi_htbl(nfa->initial));
+    HashTable* ids = hashtable_create(HT_INIT_SIZE);  // (NFA state -> number)
+    Compact* c = compact_create(nfa, ids);
+    Subsets subsets = {0};
 
-    while (stack->size > 0) {
-        MultiType state = vector_pop(stack);
-        if (nfa_is_final(nfa, (Set*)state.value.p))
-            hashtable_set(dfa->final, state, state);
+    Vector* initial = hashtable_to_vector(nfa->initial);
+    int* roots = malloc((initial->size + 1) * sizeof(int));
+    for (int i = 0; i < initial->size; i++)
+        roots[i] = hashtable_get(ids, initial->array[i]).value.i;
+    int size;
+    int* states = closure_union(c, roots, initial->size, &size);
+    subsets_id(&subsets, states, size);
+    vector_free(initial);
+    free(roots);
+
+    DFA* dfa = dfa_create(multi_int(0));
+    int count[256], next[256], dead = -1;
+    unsigned char used[256];
+    int* bucket = NULL;  // targets of the subset, grouped by letter
+    int bucket_capacity = 0;
+    for (int id = 0; id < subsets.count; id++) {
+        int* subset = subsets.states[id];
+        int subset_size = subsets.sizes[id];
+        MultiType state = multi_int(id);
+        PROBE2(dfa_state, id, subset_size);
+
+        // Counts the transitions by letter, then places them
+        int nused = 0, total = 0;
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < subset_size; i++) {
+            int q = subset[i];
+            if (c->final[q])
+                hashtable_set(dfa->final, state, state);
+            for (int j = c->start[q]; j < c->start[q + 1]; j++) {
+                if (count[c->letters[j]]++ == 0)
+                    used[nused++] = c->letters[j];
+                total++;
+            }
+        }
+        if (total > bucket_capacity) {
+            bucket_capacity = 2 * total;
+            bucket = realloc(bucket, bucket_capacity * sizeof(int));
+        }
+        int offset[256];
+        for (int k = 0, at = 0; k < nused; k++) {
+            offset[used[k]] = at;
+            at += count[used[k]];
+        }
+        for (int i = 0; i < subset_size; i++) {
+            int q = subset[i];
+            for (int j = c->start[q]; j < c->start[q + 1]; j++)
+                bucket[offset[c->letters[j]]++] = c->targets[j];
+        }
 
-        for (int i = 0; i < (int)strlen(ALPHABET); i++) {
-            Set* p = nfa_delta_states(nfa, (Set*)state.value.p, ALPHABET[i]);
-            if (!hashtable_contains(nfa->_transitions, multi_htbl(p)))
-                vector_push(stack, multi_htbl(p));
-            dfa_set_transition(dfa, state, ALPHABET[i], multi_htbl(p));
+        for (int k = 0; k < nused; k++) {
+            unsigned char a = used[k];
+            int* targets = bucket + offset[a] - count[a];
+            states = closure_union(c, targets, count[a], &size);
+            next[a] = subsets_id(&subsets, states, size);
+        }
+        for (int i = 0; SYMBOLS[i] != '\0'; i++) {
+            unsigned char a = SYMBOLS[i];
+            if (count[a] == 0 && dead == -1)
+                dead = subsets_id(&subsets, NULL, 0);
+            dfa_set_transition(dfa, state, SYMBOLS[i], multi_int(count[a] > 0 ? next[a] : dead));
         }
     }
-    vector_free(stack);
+
+    free(bucket);
+    for (int id = 0; id < subsets.count; id++)
+        free(subsets.states[id]);
+    free(subsets.states);
+    free(subsets.sizes);
+    free(subsets.slots);
+    compact_free(c);
+    hashtable_free(ids, false);
     return dfa;
 }
 
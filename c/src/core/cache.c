@@ -0,0 +1,139 @@
+/**
+ * LRU cache of compiled patterns: a hashtable from pattern to entry, and a
+ * list of the entries from the most to the least recently used. Patterns
+ * are compiled outside of the lock, so a slow compilation does not stall
+ * the hits of other threads.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>  // strdup
+
+#include "algorithm.h"
+#include "hashtable.h"
+#include "multitype.h"
+#include "probe.h"
+#include "table.h"
+
+struct PatternCache {
+    int capacity;
+    HashTable *entries;  // pattern -> CacheEntry
+    CacheEntry *first;   // most recently used
+    CacheEntry *last;    // least recently used
+    pthread_mutex_t lock;
+};
+
+PatternCache *cache_create(int capacity)
+{
+    PatternCache *cache = calloc(1, sizeof(PatternCache));
+    cache->capacity = capacity;
+    cache->entries = hashtable_create(capacity);
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+static void entry_free(CacheEntry *entry)
+{
+    table_free(entry->table);
+    free(entry->pattern);
+    free(entry);
+}
+
+static void unlink_entry(PatternCache *cache, CacheEntry *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->first = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->last = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_front(PatternCache *cache, CacheEntry *entry)
+{
+    entry->next = cache->first;
+    if (cache->first != NULL)
+        cache->first->prev = entry;
+    cache->first = entry;
+    if (cache->last == NULL)
+        cache->last = entry;
+}
+
+/* Drops the least recently used entries beyond the capacity */
+static void evict(PatternCache *cache)
+{
+    while (cache->entries->size > cache->capacity) {
+        CacheEntry *entry = cache->last;
+        unlink_entry(cache, entry);
+        hashtable_remove(cache->entries, multi_string(entry->pattern));
+        if (--entry->refs == 0)  // the reference of the cache itself
+            entry_free(entry);
+    }
+}
+
+/*
+ * Returns the compiled entry of a valid pattern, compiling it on a miss.
+ * The entry stays valid until the matching cache_release.
+ */
+CacheEntry *cache_acquire(PatternCache *cache, const char *pattern)
+{
+    MultiType key = multi_string((char *)pattern);
+    pthread_mutex_lock(&cache->lock);
+    if (hashtable_contains(cache->entries, key)) {
+        CacheEntry *entry = hashtable_get(cache->entries, key).value.p;
+        unlink_entry(cache, entry);
+        push_front(cache, entry);
+        entry->refs++;
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    PROBE1(cache_miss, pattern);
+    CacheEntry *entry = calloc(1, sizeof(CacheEntry));
+    entry->pattern = strdup(pattern);
+    entry->table = regex_compile(pattern, ConstructionThompson);
+    entry->refs = 2;  // the cache and the caller
+
+    pthread_mutex_lock(&cache->lock);
+    if (hashtable_contains(cache->entries, key)) {
+        // Compiled meanwhile by another thread: keep the cached one
+        entry_free(entry);
+        entry = hashtable_get(cache->entries, key).value.p;
+        entry->refs++;
+    } else {
+        hashtable_set(cache->entries, multi_string(entry->pattern),
+                      multi_pointer(entry));
+        push_front(cache, entry);
+        evict(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+void cache_release(PatternCache *cache, CacheEntry *entry)
+{
+    pthread_mutex_lock(&cache->lock);
+    bool unused = --entry->refs == 0;
+    pthread_mutex_unlock(&cache->lock);
+    if (unused)
+        entry_free(entry);
+}
+
+void cache_free(PatternCache *cache)
+{
+    for (CacheEntry *entry = cache->first, *next; entry != NULL; entry = next) {
+        next = entry->next;
+        entry_free(entry);
+    }
+    hashtable_free(cache->entries, false);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
@@ -0,0 +1,267 @@
+/**
+ * Direct-coded matchers: every state of the table becomes a label, whose
+ * switch on the next byte jumps to the label of the target state. So:
+ *    - there is no table lookup, and the compiler optimizes every state
+ *    - the dead state is a plain return false
+ *    - a state looping on a few byte ranges first skips them 16 bytes at a
+ *      time with SSE2, when the compiler targets it
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "codegen.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // strlen, strrchr
+
+#include "table.h"
+
+const int CODEGEN_MAX_RANGES = 4;  // beyond, a self loop is not vectorized
+
+/* C identifier from the last component of prefix */
+static char *identifier(const char *prefix)
+{
+    const char *slash = strrchr(prefix, '/');
+    const char *name = slash == NULL ? prefix : slash + 1;
+    char *id = malloc(strlen(name) + 2);
+    char *p = id;
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_')
+        *p++ = '_';
+    for (; *name != '\0'; name++)
+        *p++ = isalnum((unsigned char)*name) ? *name : '_';
+    *p = '\0';
+    return id;
+}
+
+static FILE *open_output(const char *prefix, const char *extension)
+{
+    char *path = malloc(strlen(prefix) + strlen(extension) + 1);
+    sprintf(path, "%s%s", prefix, extension);
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        perror(path);
+    free(path);
+    return file;
+}
+
+/* Ranges of the bytes on which s loops, or -1 if there are too many */
+static int self_ranges(Table *t, uint32_t s, int ranges[][2])
+{
+    int n = 0;
+    for (int b = 0; b < 256; b++) {
+        if (table_step(t, s, b) != s)
+            continue;
+        if (n > 0 && ranges[n - 1][1] == b - 1)
+            ranges[n - 1][1] = b;
+        else if (n == CODEGEN_MAX_RANGES)
+            return -1;
+        else {
+            ranges[n][0] = ranges[n][1] = b;
+            n++;
+        }
+    }
+    return n;
+}
+
+static void emit_byte(FILE *f, int b)
+{
+    if (isalnum(b))
+        fprintf(f, "'%c'", b);
+    else
+        fprintf(f, "%d", b);
+}
+
+/* Skips the bytes on which the state loops, 16 at a time */
+static void emit_skip(FILE *f, int ranges[][2], int n)
+{
+    fprintf(f, "#if MG_SSE2\n");
+    fprintf(f, "    while (end - p >= 16) {\n");
+    fprintf(f, "        __m128i v = _mm_loadu_si128((const __m128i *)p);\n");
+    fprintf(f, "        __m128i in = in_range(v, %d, %d);\n", ranges[0][0], ranges[0][1]);
+    for (int i = 1; i < n; i++)
+        fprintf(f, "        in = _mm_or_si128(in, in_range(v, %d, %d));\n",
+                ranges[i][0], ranges[i][1]);
+    fprintf(f, "        int mask = _mm_movemask_epi8(in);\n");
+    fprintf(f, "        if (mask != 0xffff) {\n");
+    fprintf(f, "            p += __builtin_ctz(~mask);\n");
+    fprintf(f, "            break;\n");
+    fprintf(f, "        }\n");
+    fprintf(f, "        p += 16;\n");
+    fprintf(f, "    }\n");
+    fprintf(f, "#endif\n");
+}
+
+static void emit_state(FILE *f, Table *t, uint32_t s)
+{
+    uint32_t targets[256];
+    int counts[256] = {0};  // bytes per target, indexed by first byte
+    for (int b = 0; b < 256; b++)
+        targets[b] = table_step(t, s, b);
+
+    // Bytes not listed in the switch: the dead ones, else the most common
+    uint32_t fallback = t->dead;
+    bool has_dead = false;
+    for (int b = 0; b < 256 && !has_dead; b++)
+        has_dead = targets[b] == t->dead;
+    if (!has_dead) {
+        int best = 0;
+        for (int b = 0; b < 256; b++) {
+            int first = 0;
+            while (targets[first] != targets[b])
+                first++;
+            if (++counts[first] > counts[best])
+                best = first;
+        }
+        fallback = targets[best];
+    }
+
+    fprintf(f, "s%u:\n", s);
+    int ranges[CODEGEN_MAX_RANGES][2];
+    int n = self_ranges(t, s, ranges);
+    if (n > 0)
+        emit_skip(f, ranges, n);
+    fprintf(f, "    if (p == end)\n");
+    fprintf(f, "        return %s;\n", t->final[s] ? "true" : "false");
+    fprintf(f, "    switch (*p++) {\n");
+    bool done[256] = {false};
+    for (int b = 0; b < 256; b++) {
+        if (done[b] || targets[b] == fallback)
+            continue;
+        for (int c = b; c < 256; c++) {
+            if (targets[c] == targets[b]) {
+                fprintf(f, "        case ");
+                emit_byte(f, c);
+                fprintf(f, ":\n");
+                done[c] = true;
+            }
+        }
+        fprintf(f, "            goto s%u;\n", targets[b]);
+    }
+    fprintf(f, "        default:\n");
+    if (fallback == t->dead)
+        fprintf(f, "            return false;\n");
+    else
+        fprintf(f, "            goto s%u;\n", fallback);
+    fprintf(f, "    }\n");
+}
+
+static void emit_source(FILE *f, Table *t, const char *pattern, const char *id,
+                        const char *header)
+{
+    fprintf(f, "// Generated by mygrep --emit-c from the pattern:\n");
+    fprintf(f, "//    %s\n\n", pattern);
+    fprintf(f, "#include \"%s\"\n\n", header);
+    fprintf(f, "#include <stdbool.h>\n");
+    fprintf(f, "#include <stddef.h>\n");
+    fprintf(f, "#include <string.h>  // memchr\n\n");
+    fprintf(f, "#if defined(__SSE2__) && defined(__GNUC__)\n");
+    fprintf(f, "#define MG_SSE2 1\n");
+    fprintf(f, "#include <emmintrin.h>\n\n");
+    fprintf(f, "/* Lanes of v between lo and hi, as unsigned bytes */\n");
+    fprintf(f, "static inline __m128i in_range(__m128i v, unsigned char lo, unsigned char hi)\n");
+    fprintf(f, "{\n");
+    fprintf(f, "    __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8((char)lo)), v);\n");
+    fprintf(f, "    __m128i below = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8((char)hi)), v);\n");
+    fprintf(f, "    return _mm_and_si128(above, below);\n");
+    fprintf(f, "}\n");
+    fprintf(f, "#else\n");
+    fprintf(f, "#define MG_SSE2 0\n");
+    fprintf(f, "#endif\n\n");
+
+    fprintf(f, "bool %s_match(const char *s, size_t n)\n", id);
+    fprintf(f, "{\n");
+    if (t->initial == t->dead) {
+        fprintf(f, "    (void)s;\n    (void)n;\n    return false;\n}\n\n");
+    } else {
+        fprintf(f, "    const unsigned char *p = (const unsigned char *)s, *end = p + n;\n");
+        fprintf(f, "    goto s%u;\n\n", t->initial);
+        for (int s = 0; s < t->size; s++) {
+            if ((uint32_t)s != t->dead)
+                emit_state(f, t, s);
+        }
+        fprintf(f, "}\n\n");
+    }
+
+    fprintf(f, "size_t %s_scan(const char *s, size_t n, %s_line_fn fn, void *context)\n",
+            id, id);
+    fprintf(f, "{\n");
+    fprintf(f, "    size_t count = 0;\n");
+    fprintf(f, "    const char *end = s + n;\n");
+    fprintf(f, "    while (s < end) {\n");
+    fprintf(f, "        const char *eol = memchr(s, '\\n', end - s);\n");
+    fprintf(f, "        size_t len = (eol == NULL ? end : eol) - s;\n");
+    fprintf(f, "        if (%s_match(s, len)) {\n", id);
+    fprintf(f, "            count++;\n");
+    fprintf(f, "            if (fn != NULL)\n");
+    fprintf(f, "                fn(s, len, context);\n");
+    fprintf(f, "        }\n");
+    fprintf(f, "        s += len + 1;\n");
+    fprintf(f, "    }\n");
+    fprintf(f, "    return count;\n");
+    fprintf(f, "}\n");
+}
+
+static void emit_header(FILE *f, const char *id)
+{
+    char *guard = malloc(strlen(id) + 1);
+    for (size_t i = 0; i <= strlen(id); i++)
+        guard[i] = toupper((unsigned char)id[i]);
+    fprintf(f, "// Generated by mygrep --emit-c\n\n");
+    fprintf(f, "#ifndef %s_H\n#define %s_H\n\n", guard, guard);
+    fprintf(f, "#include <stdbool.h>\n#include <stddef.h>\n\n");
+    fprintf(f, "typedef void (*%s_line_fn)(const char *line, size_t len, void *context);\n\n", id);
+    fprintf(f, "/* Whether the whole of s is accepted */\n");
+    fprintf(f, "extern bool %s_match(const char *s, size_t n);\n\n", id);
+    fprintf(f, "/* Calls fn (unless NULL) on the matching lines, returns their number */\n");
+    fprintf(f, "extern size_t %s_scan(const char *s, size_t n, %s_line_fn fn, void *context);\n\n",
+            id, id);
+    fprintf(f, "#endif  // %s_H\n", guard);
+    free(guard);
+}
+
+static void emit_rule(FILE *f, const char *prefix)
+{
+    fprintf(f, "# Generated by mygrep --emit-c\n");
+    fprintf(f, "%s.o: %s.c %s.h\n", prefix, prefix, prefix);
+    fprintf(f, "\t$(CC) $(CFLAGS) -O2 -c %s.c -o $@\n", prefix);
+}
+
+/* Writes the matcher of the table, false if a file cannot be created */
+bool codegen_emit(Table *t, const char *pattern, const char *prefix)
+{
+    if (t->counting != NULL || t->combination != NULL) {
+        fprintf(stderr, "mygrep: %s: counted repetitions cannot be emitted as C\n",
+                pattern);
+        return false;
+    }
+    if (t->approx != NULL) {
+        fprintf(stderr, "mygrep: %s: approximate matching cannot be emitted as C\n",
+                pattern);
+        return false;
+    }
+    FILE *c = open_output(prefix, ".c");
+    FILE *h = open_output(prefix, ".h");
+    FILE *mk = open_output(prefix, ".mk");
+    bool ok = c != NULL && h != NULL && mk != NULL;
+    if (ok) {
+        char *id = identifier(prefix);
+        const char *slash = strrchr(prefix, '/');
+        char *header = malloc(strlen(prefix) + 3);
+        sprintf(header, "%s.h", slash == NULL ? prefix : slash + 1);
+        emit_source(c, t, pattern, id, header);
+        emit_header(h, id);
+        emit_rule(mk, prefix);
+        free(header);
+        free(id);
+    }
+    if (c != NULL)
+        fclose(c);
+    if (h != NULL)
+        fclose(h);
+    if (mk != NULL)
+        fclose(mk);
+    return ok;
+}
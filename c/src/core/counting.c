@@ -0,0 +1,395 @@
+/**
+ * Counting automaton: a Thompson NFA whose states have at most one byte
+ * transition, plus counter blocks standing for the counted repetitions.
+ * It is simulated on sets of states:
+ *    - the epsilon closure of every state is computed once, as a bit set
+ *    - a block of a character group shifts its count vector on every byte
+ *      of its group, is entered while its entry state is active, and
+ *      activates its exit state while a count between min and max is
+ *      reached
+ *    - a block of any other body keeps a count vector per state of the
+ *      body, telling in which copies the state is active; the body is
+ *      started in copy 1 on entry, and in copy i + 1 when copy i ends
+ */
+
+#include "counting.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>  // memcpy, memset
+
+#include "parser.h"
+#include "simplify.h"
+#include "utf8.h"
+
+enum { STACK_WORDS = 256 };  // state sets and counters up to this size are not allocated
+
+typedef struct Block {
+    uint64_t bytes[4];  // the counted group, when body is -1
+    int min, max;
+    int entry, exit;  // states
+    int offset;       // of its count vectors in the counters, in words
+    int body, end;    // start and end states of a counted body, or -1
+    int lo, hi;       // states of the body, from lo to hi excluded
+} Block;
+
+typedef struct Edge {
+    int from, to;
+} Edge;
+
+struct Counting {
+    int size;   // states
+    int words;  // of a state set
+    int initial, final;
+    uint64_t (*bytes)[4];  // state -> bytes of its transition
+    int *target;           // state -> target of its transition, or -1
+    uint64_t *closure;     // state -> epsilon closure, words each
+    Block *blocks;
+    int nblocks;
+    int counter_words;
+    int scratch_words;  // of the largest counted body, for its step
+    Edge *epsilons;  // during construction
+    int nepsilons;
+};
+
+typedef struct Fragment {
+    int start, end;
+} Fragment;
+
+static bool has_bit(const uint64_t *set, int i)
+{
+    return set[i / 64] >> (i % 64) & 1;
+}
+
+static void set_bit(uint64_t *set, int i)
+{
+    set[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+static int add_state(Counting *c)
+{
+    c->bytes = realloc(c->bytes, (c->size + 1) * sizeof(*c->bytes));
+    c->target = realloc(c->target, (c->size + 1) * sizeof(int));
+    memset(c->bytes[c->size], 0, sizeof(*c->bytes));
+    c->target[c->size] = -1;
+    return c->size++;
+}
+
+static void add_epsilon(Counting *c, int from, int to)
+{
+    c->epsilons = realloc(c->epsilons, (c->nepsilons + 1) * sizeof(Edge));
+    c->epsilons[c->nepsilons++] = (Edge){from, to};
+}
+
+static void group_bytes(AST *group, uint64_t *bytes)
+{
+    for (int i = 0; i < group->arity; i++)
+        set_bit(bytes, (unsigned char)group->childs.c[i]);
+}
+
+/* Thompson's construction with a single start and end per fragment */
+static Fragment build(Counting *c, AST *ast)
+{
+    Fragment f;
+    switch (ast->tag) {
+        case Epsilon:
+            f.start = f.end = add_state(c);
+            return f;
+        case CharGroup:
+            f.start = add_state(c);
+            f.end = add_state(c);
+            group_bytes(ast, c->bytes[f.start]);
+            c->target[f.start] = f.end;
+            return f;
+        case Concat:
+            f = build(c, ast->childs.a[0]);
+            for (int i = 1; i < ast->arity; i++) {
+                Fragment next = build(c, ast->childs.a[i]);
+                add_epsilon(c, f.end, next.start);
+                f.end = next.end;
+            }
+            return f;
+        case Union:
+            f.start = add_state(c);
+            f.end = add_state(c);
+            for (int i = 0; i < ast->arity; i++) {
+                Fragment alt = build(c, ast->childs.a[i]);
+                add_epsilon(c, f.start, alt.start);
+                add_epsilon(c, alt.end, f.end);
+            }
+            return f;
+        case Unicode: {  // one chain of states per UTF-8 range
+            f.start = add_state(c);
+            f.end = add_state(c);
+            int n;
+            Utf8Range *seqs = utf8_ranges(ast->min, ast->max, &n);
+            for (int s = 0; s < n; s++) {
+                int q = add_state(c);
+                add_epsilon(c, f.start, q);
+                for (int k = 0; k < seqs[s].len; k++) {
+                    int next = add_state(c);
+                    for (int byte = seqs[s].lo[k]; byte <= seqs[s].hi[k]; byte++)
+                        set_bit(c->bytes[q], byte);
+                    c->target[q] = next;
+                    q = next;
+                }
+                add_epsilon(c, q, f.end);
+            }
+            free(seqs);
+            return f;
+        }
+        case Star: {
+            Fragment body = build(c, ast->childs.a[0]);
+            f.start = f.end = add_state(c);
+            add_epsilon(c, f.start, body.start);
+            add_epsilon(c, body.end, f.start);
+            return f;
+        }
+        default: {  // Repeat
+            AST *body = ast->childs.a[0];
+            Block b = {{0}, ast->min, ast->max, 0, 0, c->counter_words, -1, -1, 0, 0};
+            int words = (ast->max + 63) / 64;
+            if (body->tag == CharGroup) {
+                group_bytes(body, b.bytes);
+                c->counter_words += words;
+            } else {
+                b.lo = c->size;
+                Fragment copy = build(c, body);  // without Repeat once simplified
+                b.body = copy.start;
+                b.end = copy.end;
+                b.hi = c->size;
+                if (ast_nullable(body))
+                    b.min = 0;  // empty copies make up any count up to max
+                c->counter_words += (b.hi - b.lo) * words;
+                if ((b.hi - b.lo + 1) * words > c->scratch_words)
+                    c->scratch_words = (b.hi - b.lo + 1) * words;
+            }
+            f.start = b.entry = add_state(c);
+            f.end = b.exit = add_state(c);
+            if (b.min == 0)
+                add_epsilon(c, f.start, f.end);
+            c->blocks = realloc(c->blocks, (c->nblocks + 1) * sizeof(Block));
+            c->blocks[c->nblocks++] = b;
+            return f;
+        }
+    }
+}
+
+/* Fills closure[q] with the states reachable from q on epsilons */
+static void close_state(Counting *c, int q, uint64_t *closure, int *stack)
+{
+    int top = 0;
+    stack[top++] = q;
+    set_bit(closure, q);
+    while (top > 0) {
+        int p = stack[--top];
+        for (int i = 0; i < c->nepsilons; i++) {
+            int to = c->epsilons[i].to;
+            if (c->epsilons[i].from == p && !has_bit(closure, to)) {
+                set_bit(closure, to);
+                stack[top++] = to;
+            }
+        }
+    }
+}
+
+static bool has_repeat(AST *ast)
+{
+    if (ast->tag == Repeat)
+        return true;
+    for (int i = 0; ast->tag != CharGroup && i < ast->arity; i++) {
+        if (has_repeat(ast->childs.a[i]))
+            return true;
+    }
+    return false;
+}
+
+/* Counting automaton of a simplified AST, NULL when it has no Repeat */
+Counting *counting_create(AST *ast)
+{
+    if (!has_repeat(ast))
+        return NULL;
+    Counting *c = calloc(1, sizeof(Counting));
+    Fragment f = build(c, ast);
+    c->initial = f.start;
+    c->final = f.end;
+    c->words = (c->size + 63) / 64;
+
+    c->closure = calloc((size_t)c->size * c->words, sizeof(uint64_t));
+    int *stack = malloc(c->size * sizeof(int));
+    for (int q = 0; q < c->size; q++)
+        close_state(c, q, c->closure + (size_t)q * c->words, stack);
+    free(stack);
+    free(c->epsilons);
+    c->epsilons = NULL;
+    return c;
+}
+
+/* Replaces every x{m,n} by x+, or x* when m is 0, consuming ast */
+AST *counting_approximate(AST *ast)
+{
+    if (ast->tag == CharGroup)
+        return ast;
+    for (int i = 0; i < ast->arity; i++)
+        ast->childs.a[i] = counting_approximate(ast->childs.a[i]);
+    if (ast->tag != Repeat)
+        return ast;
+    AST *body = ast->childs.a[0];
+    AST *star = ast_create(Star, 1, 1, ast->min == 0 ? body : ast_copy(body));
+    AST *approx = ast->min == 0 ? star : ast_create(Concat, 2, 2, body, star);
+    free(ast->childs.a);
+    free(ast);
+    return approx;
+}
+
+static void add_closure(const Counting *c, uint64_t *set, int q)
+{
+    const uint64_t *closure = c->closure + (size_t)q * c->words;
+    for (int w = 0; w < c->words; w++)
+        set[w] |= closure[w];
+}
+
+/* Whether the count vector of block b holds a count in [min, max] */
+static bool count_reached(const Block *b, const uint64_t *count)
+{
+    int words = (b->max + 63) / 64;
+    int low = b->min > 0 ? b->min - 1 : 0;  // bit of the least count
+    for (int w = low / 64; w < words; w++) {
+        uint64_t bits = count[w];
+        if (w == low / 64)
+            bits &= ~UINT64_C(0) << low % 64;
+        if (bits != 0)
+            return true;
+    }
+    return false;
+}
+
+/* Shifts count left by one count into out, dropping the counts above max */
+static void count_next(const Block *b, const uint64_t *count, uint64_t *out, bool enter)
+{
+    int words = (b->max + 63) / 64;
+    for (int w = words - 1; w > 0; w--)
+        out[w] = count[w] << 1 | count[w - 1] >> 63;
+    out[0] = count[0] << 1 | enter;
+    if (b->max % 64 != 0)
+        out[words - 1] &= (UINT64_C(1) << b->max % 64) - 1;
+}
+
+/* Shifts in the bytes read, and whether a count in [min, max] is reached */
+static bool block_step(const Block *b, uint64_t *count, bool enter, bool in_group)
+{
+    if (!in_group) {
+        memset(count, 0, (b->max + 63) / 64 * sizeof(uint64_t));
+        return false;
+    }
+    count_next(b, count, count, enter);
+    return count_reached(b, count);
+}
+
+/* ORs vector into the vectors of the body states in the closure of q */
+static void add_counts(const Counting *c, const Block *b, uint64_t *counts, int q,
+                       const uint64_t *vector)
+{
+    int words = (b->max + 63) / 64;
+    const uint64_t *closure = c->closure + (size_t)q * c->words;
+    for (int w = b->lo / 64; w <= (b->hi - 1) / 64; w++) {
+        for (uint64_t bits = closure[w]; bits != 0; bits &= bits - 1) {
+            int p = w * 64 + __builtin_ctzll(bits);
+            uint64_t *to = counts + (size_t)(p - b->lo) * words;
+            for (int i = 0; i < words; i++)
+                to[i] |= vector[i];
+        }
+    }
+}
+
+/*
+ * Steps the count vectors of the body of block b on byte a, using scratch,
+ * and whether a copy ended with a count in [min, max]
+ */
+static bool body_step(const Counting *c, const Block *b, uint64_t *counts,
+                      uint64_t *scratch, bool enter, unsigned char a)
+{
+    int words = (b->max + 63) / 64, n = b->hi - b->lo;
+    uint64_t *next = scratch, *restart = scratch + (size_t)n * words;
+    if (enter) {
+        memset(restart, 0, words * sizeof(uint64_t));
+        restart[0] = 1;  // copy 1
+        add_counts(c, b, counts, b->body, restart);
+    }
+    memset(next, 0, (size_t)n * words * sizeof(uint64_t));
+    for (int q = b->lo; q < b->hi; q++) {
+        const uint64_t *count = counts + (size_t)(q - b->lo) * words;
+        if (c->target[q] >= 0 && has_bit(c->bytes[q], a))
+            add_counts(c, b, next, c->target[q], count);
+    }
+    const uint64_t *end = next + (size_t)(b->end - b->lo) * words;
+    bool reached = count_reached(b, end);
+    count_next(b, end, restart, false);
+    add_counts(c, b, next, b->body, restart);
+    memcpy(counts, next, (size_t)n * words * sizeof(uint64_t));
+    return reached;
+}
+
+/* Steps the active states and the counters on byte a, from cur into next */
+static void step(const Counting *c, const uint64_t *cur, uint64_t *next,
+                 uint64_t *counters, uint64_t *scratch, unsigned char a)
+{
+    memset(next, 0, c->words * sizeof(uint64_t));
+    for (int w = 0; w < c->words; w++) {
+        for (uint64_t bits = cur[w]; bits != 0; bits &= bits - 1) {
+            int q = w * 64 + __builtin_ctzll(bits);
+            if (c->target[q] >= 0 && has_bit(c->bytes[q], a))
+                add_closure(c, next, c->target[q]);
+        }
+    }
+    for (int i = 0; i < c->nblocks; i++) {
+        const Block *b = &c->blocks[i];
+        bool enter = has_bit(cur, b->entry), reached;
+        if (b->body < 0)
+            reached = block_step(b, counters + b->offset, enter, has_bit(b->bytes, a));
+        else
+            reached = body_step(c, b, counters + b->offset, scratch, enter, a);
+        if (reached)
+            add_closure(c, next, b->exit);
+    }
+}
+
+/* Whether the line made of head then s is accepted */
+bool counting_accept(const Counting *c, const char *head, size_t head_len,
+                     const char *s, size_t n)
+{
+    uint64_t small[STACK_WORDS];
+    size_t words = 2 * c->words + c->counter_words + c->scratch_words;
+    uint64_t *sets = words <= STACK_WORDS ? small : malloc(words * sizeof(uint64_t));
+    memset(sets, 0, words * sizeof(uint64_t));
+    uint64_t *cur = sets, *next = sets + c->words, *counters = sets + 2 * c->words;
+    uint64_t *scratch = counters + c->counter_words;
+    add_closure(c, cur, c->initial);
+    const char *parts[] = {head, s};
+    size_t lens[] = {head_len, n};
+    for (int k = 0; k < 2; k++) {
+        for (size_t i = 0; i < lens[k]; i++) {
+            step(c, cur, next, counters, scratch, parts[k][i]);
+            uint64_t *tmp = cur;
+            cur = next;
+            next = tmp;
+        }
+    }
+    bool accept = has_bit(cur, c->final);
+    if (sets != small)
+        free(sets);
+    return accept;
+}
+
+void counting_free(Counting *c)
+{
+    if (c == NULL)
+        return;
+    free(c->bytes);
+    free(c->target);
+    free(c->closure);
+    free(c->blocks);
+    free(c);
+}
@@ -0,0 +1,427 @@
+/**
+ * Brzozowski derivatives of regexes, on terms numbered by a hash-consing
+ * table: a term is built once, and two terms are equal exactly when their
+ * numbers are. Derivatives are memoized by term and byte.
+ */
+
+#include "derivative.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memcmp, memset
+
+#include "automaton.h"
+#include "multitype.h"
+#include "parser.h"
+#include "utf8.h"
+
+typedef enum TermKind { TermEmpty, TermEpsilon, TermBytes, TermCat, TermAlt, TermStar } TermKind;
+
+/*
+ * A regex in normal form. Cat is a head that is not a Cat and a tail, Alt
+ * the lowest numbered alternative and the union of the others, which are
+ * neither unions nor byte sets but for a single one, Star a body that is
+ * not a Star.
+ */
+typedef struct Term {
+    TermKind kind;
+    bool nullable;
+    int left;           // Cat: head, Alt: first alternative, Star: body
+    int right;          // Cat: tail, Alt: the other alternatives
+    uint64_t bytes[4];  // Bytes: the bytes it reads
+} Term;
+
+// Terms built before any other, with these numbers
+enum { EMPTY = 0, EPSILON_TERM = 1 };
+
+typedef struct Terms {
+    Term *terms;
+    int count;
+    int capacity;
+    int *slots;  // numbers of the terms by hash, -1 when free
+    int nslots;
+    int *memo;   // derivatives by (term, byte): 3 ints each, term -1 when free
+    int memo_count;
+    int nmemo;
+    int *operands;  // scratch of term_alt
+    int noperands;
+    int *seen;  // stamp of the last term_first_sets visit, by term
+    int stamp;
+} Terms;
+
+static unsigned term_hash(const Term *t)
+{
+    uint64_t h = t->kind * 0x9E3779B97F4A7C15ull;
+    h = (h ^ (unsigned)t->left) * 0x100000001B3ull;
+    h = (h ^ (unsigned)t->right) * 0x100000001B3ull;
+    for (int i = 0; i < 4; i++)
+        h = (h ^ t->bytes[i]) * 0x100000001B3ull;
+    return (unsigned)(h ^ h >> 32);
+}
+
+static bool term_equal(const Term *a, const Term *b)
+{
+    return a->kind == b->kind && a->left == b->left && a->right == b->right
+           && memcmp(a->bytes, b->bytes, sizeof(a->bytes)) == 0;
+}
+
+static int *term_slot(Terms *T, const Term *t)
+{
+    unsigned i = term_hash(t) & (T->nslots - 1);
+    while (T->slots[i] != -1 && !term_equal(&T->terms[T->slots[i]], t))
+        i = (i + 1) & (T->nslots - 1);
+    return &T->slots[i];
+}
+
+/* Number of the term, added when new */
+static int term_make(Terms *T, Term t)
+{
+    if (2 * (T->count + 1) > T->nslots) {
+        free(T->slots);
+        T->nslots = T->nslots == 0 ? 1024 : 2 * T->nslots;
+        T->slots = malloc(T->nslots * sizeof(int));
+        memset(T->slots, -1, T->nslots * sizeof(int));
+        for (int id = 0; id < T->count; id++)
+            *term_slot(T, &T->terms[id]) = id;
+    }
+    int *slot = term_slot(T, &t);
+    if (*slot != -1)
+        return *slot;
+    if (T->count == T->capacity) {
+        T->capacity = T->capacity == 0 ? 1024 : 2 * T->capacity;
+        T->terms = realloc(T->terms, T->capacity * sizeof(Term));
+        T->seen = realloc(T->seen, T->capacity * sizeof(int));
+    }
+    switch (t.kind) {
+        case TermEmpty:
+        case TermBytes:
+            t.nullable = false;
+            break;
+        case TermCat:
+            t.nullable = T->terms[t.left].nullable && T->terms[t.right].nullable;
+            break;
+        case TermAlt:
+            t.nullable = T->terms[t.left].nullable || T->terms[t.right].nullable;
+            break;
+        default:  // TermEpsilon, TermStar
+            t.nullable = true;
+    }
+    T->terms[T->count] = t;
+    T->seen[T->count] = 0;
+    *slot = T->count;
+    return T->count++;
+}
+
+static int term_bytes(Terms *T, const uint64_t bytes[4])
+{
+    if ((bytes[0] | bytes[1] | bytes[2] | bytes[3]) == 0)
+        return EMPTY;
+    Term t = {TermBytes, false, 0, 0, {bytes[0], bytes[1], bytes[2], bytes[3]}};
+    return term_make(T, t);
+}
+
+static int term_cat(Terms *T, int head, int tail)
+{
+    if (head == EMPTY || tail == EMPTY)
+        return EMPTY;
+    if (head == EPSILON_TERM)
+        return tail;
+    if (tail == EPSILON_TERM)
+        return head;
+    Term h = T->terms[head];
+    if (h.kind == TermCat)  // (a b) c is a (b c)
+        return term_cat(T, h.left, term_cat(T, h.right, tail));
+    return term_make(T, (Term){TermCat, false, head, tail, {0}});
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* Appends the alternatives of a union to the operands */
+static void alt_operands(Terms *T, int t, int *n, int *capacity)
+{
+    for (;;) {
+        if (*n + 1 >= *capacity) {
+            *capacity *= 2;
+            T->operands = realloc(T->operands, *capacity * sizeof(int));
+        }
+        if (T->terms[t].kind != TermAlt) {
+            T->operands[(*n)++] = t;
+            return;
+        }
+        T->operands[(*n)++] = T->terms[t].left;
+        t = T->terms[t].right;
+    }
+}
+
+/* Union of a and b, sorted, without duplicates, its byte sets merged */
+static int term_alt(Terms *T, int a, int b)
+{
+    if (a == b || b == EMPTY)
+        return a;
+    if (a == EMPTY)
+        return b;
+    int n = 0;
+    alt_operands(T, a, &n, &T->noperands);
+    alt_operands(T, b, &n, &T->noperands);
+
+    uint64_t bytes[4] = {0};
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        Term *t = &T->terms[T->operands[i]];
+        if (t->kind == TermBytes) {
+            for (int j = 0; j < 4; j++)
+                bytes[j] |= t->bytes[j];
+        } else
+            T->operands[kept++] = T->operands[i];
+    }
+    int merged = term_bytes(T, bytes);  // may move T->terms, not the operands
+    if (merged != EMPTY)
+        T->operands[kept++] = merged;
+    qsort(T->operands, kept, sizeof(int), compare_int);
+    int unique = 0;
+    for (int i = 0; i < kept; i++) {
+        if (unique == 0 || T->operands[unique - 1] != T->operands[i])
+            T->operands[unique++] = T->operands[i];
+    }
+    if (unique == 0)
+        return EMPTY;
+
+    int t = T->operands[unique - 1];  // nested from the last
+    for (int i = unique - 2; i >= 0; i--)
+        t = term_make(T, (Term){TermAlt, false, T->operands[i], t, {0}});
+    return t;
+}
+
+static int term_star(Terms *T, int body)
+{
+    if (body == EMPTY || body == EPSILON_TERM || T->terms[body].kind == TermStar)
+        return body == EMPTY ? EPSILON_TERM : body;
+    return term_make(T, (Term){TermStar, false, body, 0, {0}});
+}
+
+static void bytes_add(uint64_t bytes[4], unsigned char c)
+{
+    bytes[c >> 6] |= 1ull << (c & 63);
+}
+
+static bool bytes_has(const uint64_t bytes[4], unsigned char c)
+{
+    return bytes[c >> 6] >> (c & 63) & 1;
+}
+
+/* Union of the UTF-8 sequences of a range of code points */
+static int term_unicode(Terms *T, AST *ast)
+{
+    int n, t = EMPTY;
+    Utf8Range *seqs = utf8_ranges(ast->min, ast->max, &n);
+    for (int s = 0; s < n; s++) {
+        int seq = EPSILON_TERM;
+        for (int k = seqs[s].len - 1; k >= 0; k--) {
+            uint64_t bytes[4] = {0};
+            for (int c = seqs[s].lo[k]; c <= seqs[s].hi[k]; c++)
+                bytes_add(bytes, c);
+            seq = term_cat(T, term_bytes(T, bytes), seq);
+        }
+        t = term_alt(T, t, seq);
+    }
+    free(seqs);
+    return t;
+}
+
+static int term_of(Terms *T, AST *ast)
+{
+    switch (ast->tag) {
+        case Epsilon:
+            return EPSILON_TERM;
+        case CharGroup: {
+            uint64_t bytes[4] = {0};
+            for (int i = 0; i < ast->arity; i++)
+                bytes_add(bytes, ast->childs.c[i]);
+            return term_bytes(T, bytes);
+        }
+        case Unicode:
+            return term_unicode(T, ast);
+        case Concat: {
+            int t = term_of(T, ast->childs.a[ast->arity - 1]);
+            for (int i = ast->arity - 2; i >= 0; i--)
+                t = term_cat(T, term_of(T, ast->childs.a[i]), t);
+            return t;
+        }
+        case Union: {
+            int t = EMPTY;
+            for (int i = 0; i < ast->arity; i++)
+                t = term_alt(T, t, term_of(T, ast->childs.a[i]));
+            return t;
+        }
+        case Star:
+            return term_star(T, term_of(T, ast->childs.a[0]));
+        default:
+            fprintf(stderr, "Invalid AST tag");
+            exit(EXIT_FAILURE);
+    }
+}
+
+static int *memo_slot(Terms *T, int t, unsigned char c)
+{
+    unsigned i = ((unsigned)t * 256 + c) * 2654435761u & (T->nmemo - 1);
+    while (T->memo[3 * i] != -1 && (T->memo[3 * i] != t || T->memo[3 * i + 1] != c))
+        i = (i + 1) & (T->nmemo - 1);
+    return &T->memo[3 * i];
+}
+
+/* Derivative of t by the byte c */
+static int term_derive(Terms *T, int t, unsigned char c)
+{
+    int *slot = memo_slot(T, t, c);
+    if (slot[0] != -1)
+        return slot[2];
+
+    Term term = T->terms[t];
+    int d;
+    switch (term.kind) {
+        case TermBytes:
+            d = bytes_has(term.bytes, c) ? EPSILON_TERM : EMPTY;
+            break;
+        case TermCat:
+            d = term_cat(T, term_derive(T, term.left, c), term.right);
+            if (T->terms[term.left].nullable)
+                d = term_alt(T, d, term_derive(T, term.right, c));
+            break;
+        case TermAlt:
+            d = term_alt(T, term_derive(T, term.left, c), term_derive(T, term.right, c));
+            break;
+        case TermStar:
+            d = term_cat(T, term_derive(T, term.left, c), t);
+            break;
+        default:  // TermEmpty, TermEpsilon
+            d = EMPTY;
+    }
+
+    if (2 * (T->memo_count + 1) > T->nmemo) {  // the recursion may have filled it
+        int *old = T->memo, nold = T->nmemo;
+        T->nmemo = 2 * nold;
+        T->memo = malloc(3 * T->nmemo * sizeof(int));
+        memset(T->memo, -1, 3 * T->nmemo * sizeof(int));
+        for (int i = 0; i < nold; i++) {
+            if (old[3 * i] != -1)
+                memcpy(memo_slot(T, old[3 * i], old[3 * i + 1]), &old[3 * i], 3 * sizeof(int));
+        }
+        free(old);
+    }
+    slot = memo_slot(T, t, c);
+    slot[0] = t;
+    slot[1] = c;
+    slot[2] = d;
+    T->memo_count++;
+    return d;
+}
+
+/*
+ * Splits the classes of bytes by every byte set that the derivatives of t
+ * read first, so that the bytes of a class have the same derivative.
+ */
+static void term_first_sets(Terms *T, int t, unsigned char *class, int *count)
+{
+    if (T->seen[t] == T->stamp)
+        return;
+    T->seen[t] = T->stamp;
+    Term *term = &T->terms[t];
+    switch (term->kind) {
+        case TermBytes: {
+            int split[2 * 256];
+            memset(split, -1, 2 * *count * sizeof(int));
+            int n = 0;
+            for (int c = 0; c < 256; c++) {
+                int *id = &split[2 * class[c] + bytes_has(term->bytes, c)];
+                if (*id == -1)
+                    *id = n++;
+                class[c] = *id;
+            }
+            *count = n;
+            break;
+        }
+        case TermCat:
+            term_first_sets(T, term->left, class, count);
+            if (T->terms[term->left].nullable)
+                term_first_sets(T, term->right, class, count);
+            break;
+        case TermAlt:
+            term_first_sets(T, term->left, class, count);
+            term_first_sets(T, term->right, class, count);
+            break;
+        case TermStar:
+            term_first_sets(T, term->left, class, count);
+            break;
+        default:
+            break;
+    }
+}
+
+static void terms_free(Terms *T)
+{
+    free(T->terms);
+    free(T->slots);
+    free(T->memo);
+    free(T->operands);
+    free(T->seen);
+}
+
+/*
+ * Every term reached from the AST is a state, numbered in the order
+ * reached, so the DFA has integer states 0..n-1 and 0 is the initial state.
+ */
+DFA *derivative_dfa(AST *ast)
+{
+    Terms T = {0};
+    T.noperands = 64;
+    T.operands = malloc(T.noperands * sizeof(int));
+    T.nmemo = 1024;
+    T.memo = malloc(3 * T.nmemo * sizeof(int));
+    memset(T.memo, -1, 3 * T.nmemo * sizeof(int));
+    term_make(&T, (Term){TermEmpty, false, 0, 0, {0}});
+    term_make(&T, (Term){TermEpsilon, false, 0, 0, {0}});
+
+    int root = term_of(&T, ast);
+    HashTable *ids = hashtable_create(64);  // (term -> state)
+    Vector *queue = vector_create(64);
+    hashtable_set(ids, multi_int(root), multi_int(0));
+    vector_push(queue, multi_int(root));
+    DFA *dfa = dfa_create(multi_int(0));
+
+    for (int i = 0; i < queue->size; i++) {
+        int t = queue->array[i].value.i;
+        MultiType state = multi_int(i);
+        if (T.terms[t].nullable)
+            hashtable_set(dfa->final, state, state);
+
+        unsigned char class[256] = {0};
+        int count = 1, next[256];
+        T.stamp++;
+        term_first_sets(&T, t, class, &count);
+        memset(next, -1, count * sizeof(int));
+        for (int s = 0; SYMBOLS[s] != '\0'; s++) {
+            unsigned char c = SYMBOLS[s];
+            if (next[class[c]] == -1) {  // the first byte of its class
+                int d = term_derive(&T, t, c);
+                MultiType id = hashtable_get(ids, multi_int(d));
+                if (id.type == NullType) {
+                    id = multi_int(queue->size);
+                    hashtable_set(ids, multi_int(d), id);
+                    vector_push(queue, multi_int(d));
+                }
+                next[class[c]] = id.value.i;
+            }
+            dfa_set_transition(dfa, state, SYMBOLS[s], multi_int(next[class[c]]));
+        }
+    }
+    vector_free(queue);
+    hashtable_free(ids, false);
+    terms_free(&T);
+    return dfa;
+}
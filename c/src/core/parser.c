@@ -1,21 +1,30 @@
 #include "parser.h"
 
+#include <ctype.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>  // strlen
 
 #include "automaton.h"
 #include "stack.h"
+#include "utf8.h"
 #include "vector.h"
 
+const int PARSE_MAX_REPEAT = 65535;
+
 AST *ast_create(ASTTag tag, int arity, int argc, ...)
 {
     AST *ast = (AST *)malloc(sizeof(AST));
     ast->tag = tag;
     ast->arity = arity;
+    ast->min = ast->max = 0;
     if (tag == CharGroup)
         ast->childs.c = calloc(arity, sizeof(char));
+    else if (tag == Epsilon || tag == Unicode)
+        ast->childs.a = NULL;
     else
         ast->childs.a = calloc(arity, sizeof(AST *));
 
@@ -27,18 +36,36 @@ AST *ast_create(ASTTag tag, int arity, int argc, ...)
                 ast->childs.c[0] = va_arg(args, int);
             break;
         case Star:
+        case Repeat:
             ast->childs.a[0] = va_arg(args, AST *);
             break;
         case Concat:
         case Union:
-            ast->childs.a[0] = va_arg(args, AST *);
-            ast->childs.a[1] = va_arg(args, AST *);
+            for (int i = 0; i < argc; i++)
+                ast->childs.a[i] = va_arg(args, AST *);
+            break;
+        case Epsilon:
+        case Unicode:
             break;
     }
     va_end(args);
     return ast;
 }
 
+AST *ast_copy(AST *ast)
+{
+    AST *copy = ast_create(ast->tag, ast->arity, 0);
+    copy->min = ast->min;
+    copy->max = ast->max;
+    for (int i = 0; i < ast->arity; i++) {
+        if (ast->tag == CharGroup)
+            copy->childs.c[i] = ast->childs.c[i];
+        else
+            copy->childs.a[i] = ast_copy(ast->childs.a[i]);
+    }
+    return copy;
+}
+
 void ast_free(AST *ast)
 {
     if (ast->tag == CharGroup)
@@ -48,13 +75,19 @@ void ast_free(AST *ast)
             ast_free(ast->childs.a[i]);
         free(ast->childs.a);
     }
+    free(ast);
 }
 
 void ast_print(AST *ast, int indent)
 {
     for (int i = 0; i < indent; i++)
         printf("  ");
-    printf("%s\n", AST_TAG_STR[ast->tag]);
+    if (ast->tag == Repeat)
+        printf("%s {%d,%d}\n", AST_TAG_STR[ast->tag], ast->min, ast->max);
+    else if (ast->tag == Unicode)
+        printf("%s U+%04X-U+%04X\n", AST_TAG_STR[ast->tag], ast->min, ast->max);
+    else
+        printf("%s\n", AST_TAG_STR[ast->tag]);
 
     if (ast->tag == CharGroup) {
         for (int i = 0; i < indent + 1; i++)
@@ -68,8 +101,275 @@ void ast_print(AST *ast, int indent)
     }
 }
 
-/* Constructs an AST from a regex in postfixe form */
-AST *parse(char *regex)
+/*
+ * Reads the bounds of a counted repetition "{m}", "{m,}" or "{m,n}" at
+ * regex[*i], leaving *i on its closing brace. False when malformed.
+ */
+static bool parse_bounds(const char *regex, int *i, int *min, int *max)
+{
+    const char *p = regex + *i + 1;
+    long bounds[2] = {-1, -1};
+    for (int k = 0; k < 2; k++) {
+        if (isdigit((unsigned char)*p)) {
+            bounds[k] = 0;
+            for (; isdigit((unsigned char)*p) && bounds[k] <= PARSE_MAX_REPEAT; p++)
+                bounds[k] = 10 * bounds[k] + *p - '0';
+        }
+        if (k == 0 && *p == ',')
+            p++;
+        else if (k == 0) {
+            bounds[1] = bounds[0];
+            break;
+        }
+    }
+    if (*p != '}' || bounds[0] < 0 || bounds[0] > PARSE_MAX_REPEAT
+        || bounds[1] > PARSE_MAX_REPEAT || (bounds[1] >= 0 && bounds[1] < bounds[0]))
+        return false;
+    *min = bounds[0];
+    *max = bounds[1];
+    *i = p - regex;
+    return true;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const uint32_t *x = a, *y = b;
+    return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+/* Sorts n ranges, merging the overlapping ones, returns how many are left */
+static int merge_ranges(uint32_t (*ranges)[2], int n)
+{
+    qsort(ranges, n, sizeof(*ranges), compare_ranges);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        if (k > 0 && ranges[i][0] <= ranges[k - 1][1] + 1) {
+            if (ranges[i][1] > ranges[k - 1][1])
+                ranges[k - 1][1] = ranges[i][1];
+        } else {
+            ranges[k][0] = ranges[i][0];
+            ranges[k++][1] = ranges[i][1];
+        }
+    }
+    return k;
+}
+
+/* Uppercase letters first..last, whose lowercase ones are delta above */
+static const struct {
+    uint32_t first, last, delta;
+} CASES[] = {
+    {'A', 'Z', 32},      // ASCII
+    {0xC0, 0xD6, 32},    // Latin-1, around the multiplication sign
+    {0xD8, 0xDE, 32},
+    {0x391, 0x3A1, 32},  // Greek, around the missing final capital sigma
+    {0x3A3, 0x3A9, 32},
+    {0x400, 0x40F, 80},  // Cyrillic
+    {0x410, 0x42F, 32},
+};
+
+enum { NCASES = sizeof(CASES) / sizeof(CASES[0]) };
+
+/*
+ * Adds the other case of the letters in n ranges, which must have room for
+ * 2 * NCASES more per range. Returns the number of merged ranges.
+ */
+static int fold_ranges(uint32_t (*ranges)[2], int n)
+{
+    int k = n;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < NCASES; j++) {
+            for (int upper = 0; upper < 2; upper++) {  // of the letters found
+                uint32_t from = upper ? 0 : CASES[j].delta;
+                uint32_t to = upper ? CASES[j].delta : 0;
+                uint32_t first = CASES[j].first + from, last = CASES[j].last + from;
+                uint32_t lo = ranges[i][0] > first ? ranges[i][0] : first;
+                uint32_t hi = ranges[i][1] < last ? ranges[i][1] : last;
+                if (lo > hi)
+                    continue;
+                ranges[k][0] = lo - from + to;
+                ranges[k++][1] = hi - from + to;
+            }
+        }
+    }
+    return merge_ranges(ranges, k);
+}
+
+/* Union of the alternatives, nested two by two as parsed */
+static AST *union_of(AST **alts, int n)
+{
+    AST *ast = alts[0];
+    for (int i = 1; i < n; i++)
+        ast = ast_create(Union, 2, 2, ast, alts[i]);
+    return ast;
+}
+
+/*
+ * Ranges of code points as an AST: a group of their ASCII characters of
+ * ALPHABET, the others in Unicode nodes. An empty class is an empty group.
+ */
+static AST *class_of(uint32_t (*ranges)[2], int n)
+{
+    AST **alts = malloc((n + 1) * sizeof(AST *));
+    AST *group = ast_create(CharGroup, strlen(ALPHABET), 0);
+    group->arity = 0;
+    for (int k = 0; ALPHABET[k] != '\0'; k++) {
+        uint32_t c = (unsigned char)ALPHABET[k];
+        for (int i = 0; i < n; i++) {
+            if (c >= ranges[i][0] && c <= ranges[i][1])
+                group->childs.c[group->arity++] = c;
+        }
+    }
+    int count = 0;
+    if (group->arity > 0)
+        alts[count++] = group;
+    for (int i = 0; i < n; i++) {
+        if (ranges[i][1] < 0x80)
+            continue;
+        AST *unicode = ast_create(Unicode, 0, 0);
+        unicode->min = ranges[i][0] < 0x80 ? 0x80 : ranges[i][0];
+        unicode->max = ranges[i][1];
+        alts[count++] = unicode;
+    }
+    AST *ast = count == 0 ? group : union_of(alts, count);
+    if (count > 0 && group->arity == 0)
+        ast_free(group);
+    free(alts);
+    return ast;
+}
+
+/* Whether a class may name cp: ASCII outside ALPHABET is never matched */
+static bool class_char(uint32_t cp)
+{
+    return cp >= 0x80 || strchr(ALPHABET, (int)cp) != NULL;
+}
+
+/*
+ * Reads a class "[...]" or "[^...]" at regex[*i], made of UTF-8 characters
+ * and ranges "a-z", leaving *i on its closing bracket. Stores its AST in
+ * *ast when not NULL, both cases of its letters when fold, which happens
+ * before the negation. False when malformed, when it names an ASCII
+ * character outside ALPHABET, which would be silently dropped, or when it
+ * matches no character at all, as "[]" does.
+ */
+static bool parse_class(const char *regex, int *i, AST **ast, bool fold)
+{
+    int p = *i + 1;
+    bool negated = regex[p] == '^';
+    p += negated;
+    size_t room = (strlen(regex + p) + 1) * (1 + 2 * NCASES);
+    uint32_t (*ranges)[2] = malloc(room * sizeof(*ranges));
+    int n = 0;
+    while (regex[p] != ']') {
+        uint32_t first, last;
+        int len = regex[p] == '\0' ? 0 : utf8_decode(regex + p, &first);
+        last = first;
+        if (len > 0 && regex[p + len] == '-' && regex[p + len + 1] != ']') {
+            p += len + 1;
+            len = regex[p] == '\0' ? 0 : utf8_decode(regex + p, &last);
+        }
+        if (len == 0 || last < first || !class_char(first) || !class_char(last)) {
+            free(ranges);
+            return false;
+        }
+        ranges[n][0] = first;
+        ranges[n++][1] = last;
+        p += len;
+    }
+    n = fold ? fold_ranges(ranges, merge_ranges(ranges, n)) : merge_ranges(ranges, n);
+    if (negated) {  // the gaps between the ranges
+        uint32_t next = 1;
+        int k = 0;
+        for (int j = 0; j < n; j++) {
+            uint32_t first = ranges[j][0], last = ranges[j][1];
+            if (first > next) {
+                ranges[k][0] = next;
+                ranges[k++][1] = first - 1;
+            }
+            next = last + 1;
+        }
+        if (next <= UTF8_MAX) {
+            ranges[k][0] = next;
+            ranges[k++][1] = UTF8_MAX;
+        }
+        n = k;
+    }
+    bool matchable = false;  // some range holds a character of a line
+    for (int j = 0; j < n && !matchable; j++) {
+        matchable = ranges[j][1] >= 0x80;
+        for (int k = 0; ALPHABET[k] != '\0' && !matchable; k++) {
+            uint32_t c = (unsigned char)ALPHABET[k];
+            matchable = c >= ranges[j][0] && c <= ranges[j][1];
+        }
+    }
+    if (!matchable) {
+        free(ranges);
+        return false;
+    }
+    if (ast != NULL)
+        *ast = class_of(ranges, n);
+    free(ranges);
+    *i = p;
+    return true;
+}
+
+/* Checks that a regex in postfixe form reduces to exactly one AST */
+bool parse_check(const char *regex)
+{
+    int depth = 0;
+    for (int i = 0; regex[i] != '\0'; i++) {
+        int min, max;
+        switch (regex[i]) {
+            case '@':
+            case '|':
+                depth -= 2;
+                break;
+            case '*':
+            case '?':
+                depth -= 1;
+                break;
+            case '{':
+                if (!parse_bounds(regex, &i, &min, &max))
+                    return false;
+                depth -= 1;
+                break;
+            case '[':
+                if (!parse_class(regex, &i, NULL, false))
+                    return false;
+                break;
+            default: {
+                uint32_t cp;
+                int len = utf8_decode(regex + i, &cp);
+                if (len == 0)
+                    return false;
+                i += len - 1;
+            }
+        }
+        if (depth < 0)
+            return false;
+        depth++;
+    }
+    return depth == 1;
+}
+
+/* A character read in a pattern, with both cases of a letter when fold */
+static AST *parse_char(uint32_t cp, bool fold)
+{
+    if (cp < 0x80 && (!fold || !isalpha(cp)))
+        return ast_create(CharGroup, 1, 1, cp);
+    if (cp < 0x80) {
+        AST *ast = ast_create(CharGroup, 2, 1, tolower(cp));
+        ast->childs.c[1] = toupper(cp);
+        return ast;
+    }
+    uint32_t ranges[1 + 2 * NCASES][2] = {{cp, cp}};
+    if (fold)
+        return class_of(ranges, fold_ranges(ranges, 1));
+    AST *ast = ast_create(Unicode, 0, 0);
+    ast->min = ast->max = cp;
+    return ast;
+}
+
+static AST *parse_from(const char *regex, bool fold)
 {
     Stack *stack = stack_create();
 
@@ -87,10 +387,9 @@ AST *parse(char *regex)
                 ast = ast_create(Star, 1, 1, child);
                 break;
             }
-            case '.': {
-                ast = ast_create(CharGroup, strlen(ALPHABET), 0);
-                for (int i = 0; i < ast->arity; i++)
-                    ast->childs.c[i] = ALPHABET[i];
+            case '.': {  // ALPHABET, or any non-ASCII code point
+                uint32_t any[1][2] = {{0, UTF8_MAX}};
+                ast = class_of(any, 1);
                 break;
             }
             case '|': {
@@ -101,11 +400,23 @@ AST *parse(char *regex)
             }
             case '?': {
                 AST *child = (AST *)stack_pop(stack).value.p;
-                ast = ast_create(Union, 2, 2, EPSILON, child);
+                ast = ast_create(Union, 2, 2, ast_create(Epsilon, 0, 0), child);
+                break;
+            }
+            case '{': {
+                AST *child = (AST *)stack_pop(stack).value.p;
+                ast = ast_create(Repeat, 1, 1, child);
+                parse_bounds(regex, &i, &ast->min, &ast->max);
+                break;
+            }
+            case '[':
+                parse_class(regex, &i, &ast, fold);
                 break;
+            default: {
+                uint32_t cp;
+                i += utf8_decode(regex + i, &cp) - 1;
+                ast = parse_char(cp, fold);
             }
-            default:
-                ast = ast_create(CharGroup, 1, 1, regex[i]);
         }
         stack_push(stack, multi_pointer(ast));
     }
@@ -113,3 +424,15 @@ AST *parse(char *regex)
     stack_free(stack);
     return ast;
 }
+
+/* Constructs an AST from a regex in postfixe form */
+AST *parse(const char *regex)
+{
+    return parse_from(regex, false);
+}
+
+/* Same, every letter standing for both of its cases */
+AST *parse_fold(const char *regex)
+{
+    return parse_from(regex, true);
+}
@@ -0,0 +1,206 @@
+/**
+ * Pattern sets as a tree of unions. The leaves are at depth height, and the
+ * path to the leaf of pattern id follows the bits of id from the highest.
+ * A node whose subtree holds a single pattern shares that DFA instead of
+ * building a product, and the tree grows by putting the whole old tree
+ * under a new root, whose DFA is then the old one.
+ *
+ * A pattern with counted repetitions has the DFA of its x+ approximation,
+ * which accepts more lines. Every node then also keeps the exact union of
+ * the patterns below that have no counts, the same DFA while none has, and
+ * the table confirms a line with that union or one of the counted patterns.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "patternset.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>  // strdup
+
+#include "algorithm.h"
+#include "automaton.h"
+#include "table.h"
+
+typedef struct UnionNode {
+    struct UnionNode *child[2];
+    DFA *dfa;    // union of the patterns below, NULL when there are none
+    DFA *exact;  // same, of the patterns without counts, dfa when all are
+    bool owned;  // dfa is not the one of a child
+    bool exact_owned;  // exact is neither dfa nor the one of a child
+    bool dirty;  // a pattern below changed since dfa was built
+    char *pattern;  // at the leaf of a pattern with counts
+} UnionNode;
+
+struct PatternSet {
+    UnionNode *root;
+    int height;
+    int next;        // lowest id never given
+    int *free_ids;   // removed ids, given again first
+    int nfree;
+    int size;        // patterns in the set
+    DFA *empty;      // accepting nothing, for the empty set
+};
+
+PatternSet *patternset_create(void)
+{
+    PatternSet *set = calloc(1, sizeof(PatternSet));
+    set->root = calloc(1, sizeof(UnionNode));
+    set->empty = regex_compile_empty(ConstructionThompson);
+    return set;
+}
+
+/* The leaf of id, NULL when missing, marking the path to it when dirty */
+static UnionNode *leaf_of(PatternSet *set, int id, bool create, bool dirty)
+{
+    UnionNode *node = set->root;
+    for (int depth = set->height - 1; depth >= 0 && node != NULL; depth--) {
+        node->dirty |= dirty;
+        UnionNode **child = &node->child[id >> depth & 1];
+        if (*child == NULL && create)
+            *child = calloc(1, sizeof(UnionNode));
+        node = *child;
+    }
+    if (node != NULL)
+        node->dirty |= dirty;
+    return node;
+}
+
+/* Adds a valid pattern, its DFA built by construction, returns its id */
+int patternset_add(PatternSet *set, const char *pattern, Construction construction)
+{
+    int id = set->nfree > 0 ? set->free_ids[--set->nfree] : set->next++;
+    if (id >> set->height != 0) {  // one more level above the root
+        UnionNode *root = calloc(1, sizeof(UnionNode));
+        root->child[0] = set->root;
+        set->root = root;
+        set->height++;
+    }
+    UnionNode *leaf = leaf_of(set, id, true, true);
+    bool counted;
+    leaf->dfa = regex_compile_dfa(pattern, construction, &counted);
+    leaf->exact = counted ? NULL : leaf->dfa;
+    leaf->pattern = counted ? strdup(pattern) : NULL;
+    leaf->owned = true;
+    set->size++;
+    return id;
+}
+
+/* Removes the pattern id, false when there is none */
+bool patternset_remove(PatternSet *set, int id)
+{
+    UnionNode *leaf = id >= 0 && id < set->next ? leaf_of(set, id, false, false) : NULL;
+    if (leaf == NULL || leaf->dfa == NULL)
+        return false;
+    leaf_of(set, id, false, true);
+    dfa_free(leaf->dfa, true);
+    free(leaf->pattern);
+    leaf->dfa = leaf->exact = NULL;
+    leaf->pattern = NULL;
+    set->free_ids = realloc(set->free_ids, (set->nfree + 1) * sizeof(int));
+    set->free_ids[set->nfree++] = id;
+    set->size--;
+    return true;
+}
+
+int patternset_size(PatternSet *set)
+{
+    return set->size;
+}
+
+/* Minimal DFA accepting the words either a or b accepts */
+static DFA *union_of(DFA *a, DFA *b)
+{
+    DFA *product = dfa_product(a, b, false);
+    DFA *minimal = moore(product);
+    dfa_free(product, true);
+    return minimal;
+}
+
+/* Rebuilds the dirty nodes below node, at the given depth */
+static void rebuild(PatternSet *set, UnionNode *node, int depth)
+{
+    if (node == NULL || !node->dirty)
+        return;
+    node->dirty = false;
+    if (depth == set->height)  // a leaf, compiled by patternset_add
+        return;
+    rebuild(set, node->child[0], depth + 1);
+    rebuild(set, node->child[1], depth + 1);
+    if (node->owned)
+        dfa_free(node->dfa, true);
+    if (node->exact_owned)
+        dfa_free(node->exact, true);
+    DFA *a = node->child[0] != NULL ? node->child[0]->dfa : NULL;
+    DFA *b = node->child[1] != NULL ? node->child[1]->dfa : NULL;
+    node->owned = a != NULL && b != NULL;
+    node->dfa = node->owned ? union_of(a, b) : a != NULL ? a : b;
+
+    DFA *ea = node->child[0] != NULL ? node->child[0]->exact : NULL;
+    DFA *eb = node->child[1] != NULL ? node->child[1]->exact : NULL;
+    node->exact_owned = (ea != a || eb != b) && ea != NULL && eb != NULL;
+    if (ea == a && eb == b)  // no counts below
+        node->exact = node->dfa;
+    else
+        node->exact = node->exact_owned ? union_of(ea, eb) : ea != NULL ? ea : eb;
+}
+
+/* Appends the tables confirming the counted patterns below node */
+static void add_counted(UnionNode *node, TableCombination *c)
+{
+    if (node == NULL || node->exact == node->dfa)
+        return;
+    if (node->pattern != NULL) {
+        c->tables = realloc(c->tables, (c->count + 1) * sizeof(Table *));
+        c->negated = realloc(c->negated, (c->count + 1) * sizeof(bool));
+        c->joined = realloc(c->joined, (c->count + 1) * sizeof(bool));
+        c->tables[c->count] = regex_compile_confirmed(node->pattern, node->dfa);
+        c->negated[c->count] = c->joined[c->count] = false;
+        c->count++;
+    }
+    add_counted(node->child[0], c);
+    add_counted(node->child[1], c);
+}
+
+/*
+ * Table of the lines matching any pattern of the set. With counted
+ * patterns, the lines of the approximated union are confirmed by the exact
+ * union of the others or by one of them.
+ */
+Table *patternset_compile(PatternSet *set)
+{
+    rebuild(set, set->root, 0);
+    UnionNode *root = set->root;
+    Table *table = table_create(root->dfa != NULL ? root->dfa : set->empty);
+    table_reorder(table, NULL);
+    if (root->exact != root->dfa) {
+        TableCombination *c = table_combination_create(1, false);
+        c->tables[0] = table_create(root->exact != NULL ? root->exact : set->empty);
+        table_reorder(c->tables[0], NULL);
+        add_counted(root, c);
+        table->combination = c;
+    }
+    return table;
+}
+
+static void node_free(UnionNode *node)
+{
+    if (node == NULL)
+        return;
+    node_free(node->child[0]);
+    node_free(node->child[1]);
+    if (node->owned && node->dfa != NULL)
+        dfa_free(node->dfa, true);
+    if (node->exact_owned)
+        dfa_free(node->exact, true);
+    free(node->pattern);
+    free(node);
+}
+
+void patternset_free(PatternSet *set)
+{
+    node_free(set->root);
+    dfa_free(set->empty, true);
+    free(set->free_ids);
+    free(set);
+}
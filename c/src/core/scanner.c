@@ -0,0 +1,113 @@
+/**
+ * Line matching over chunked input. Only the head of a line crossing a
+ * chunk boundary is copied, and not even that once the line is dead.
+ */
+
+#include "scanner.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>  // memchr, memcpy
+
+#include "speculate.h"
+#include "table.h"
+
+static const size_t SCANNER_HEAD_SIZE = 4096;
+
+Scanner *scanner_create(Table *table, uint64_t *counts)
+{
+    Scanner *scanner = calloc(1, sizeof(Scanner));
+    scanner->table = table;
+    scanner->counts = counts;
+    scanner->state = table->initial;
+    scanner->head_capacity = SCANNER_HEAD_SIZE;
+    scanner->head = malloc(scanner->head_capacity);
+    scanner->threads = 1;
+    return scanner;
+}
+
+static uint32_t scanner_run(Scanner *scanner, const char *s, size_t n)
+{
+    if (scanner->counts == NULL)
+        return speculate_run(scanner->table, scanner->state, s, n, scanner->threads);
+    if (scanner->line_len == 0)  // a carried state was counted by its chunk
+        scanner->counts[scanner->state]++;
+    return table_profile(scanner->table, scanner->state, s, n, scanner->counts);
+}
+
+static void scanner_keep(Scanner *scanner, const char *s, size_t n)
+{
+    if (scanner->head_len + n > scanner->head_capacity) {
+        scanner->head_capacity = 2 * (scanner->head_len + n);
+        scanner->head = realloc(scanner->head, scanner->head_capacity);
+    }
+    memcpy(scanner->head + scanner->head_len, s, n);
+    scanner->head_len += n;
+}
+
+/* Ends the current line, whose last n bytes are at s */
+static bool scanner_line(Scanner *scanner, const char *s, size_t n, ScanFn fn,
+                         void *context)
+{
+    bool go_on = true;
+    Table *t = scanner->table;
+    if (t->final[scanner->state]
+        && table_confirm(t, scanner->head, scanner->head_len, s, n))
+        go_on = fn(scanner->head, scanner->head_len, s, n, scanner->offset, context);
+    scanner->offset += scanner->line_len + n + 1;
+    scanner->state = scanner->table->initial;
+    scanner->line_len = 0;
+    scanner->head_len = 0;
+    return go_on;
+}
+
+/*
+ * Feeds the next chunk of the stream and calls fn on the matching lines it
+ * ends. Returns false as soon as fn does.
+ */
+bool scanner_feed(Scanner *scanner, const char *s, size_t n, ScanFn fn,
+                  void *context)
+{
+    const char *end = s + n;
+    while (s < end) {
+        const char *eol = memchr(s, '\n', end - s);
+        size_t len = (eol == NULL ? end : eol) - s;
+        scanner->state = scanner_run(scanner, s, len);
+        if (eol == NULL) {
+            if (scanner->state != scanner->table->dead)
+                scanner_keep(scanner, s, len);
+            scanner->line_len += len;
+            break;
+        }
+        if (!scanner_line(scanner, s, len, fn, context))
+            return false;
+        s = eol + 1;
+    }
+    return true;
+}
+
+/* Ends the stream: reports its last line if it has no newline, then resets */
+bool scanner_finish(Scanner *scanner, ScanFn fn, void *context)
+{
+    bool go_on = true;
+    if (scanner->line_len > 0)
+        go_on = scanner_line(scanner, NULL, 0, fn, context);
+    scanner_reset(scanner);
+    return go_on;
+}
+
+/* Forgets the current line and restarts at offset 0 */
+void scanner_reset(Scanner *scanner)
+{
+    scanner->state = scanner->table->initial;
+    scanner->offset = 0;
+    scanner->line_len = 0;
+    scanner->head_len = 0;
+}
+
+void scanner_free(Scanner *scanner)
+{
+    free(scanner->head);
+    free(scanner);
+}
@@ -0,0 +1,392 @@
+/**
+ * Simplification of the AST before Thompson's construction. Every rewrite
+ * preserves the language, and the nodes are simplified bottom-up, so a
+ * node only looks at children that are already simplified.
+ */
+
+#include "simplify.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>  // memchr, memcmp
+
+#include "multitype.h"
+#include "parser.h"
+#include "vector.h"
+
+// Counted repetitions of a character group up to this count are unrolled
+const int SIMPLIFY_MAX_UNROLL = 16;
+
+static AST *child(Vector *v, int i)
+{
+    return (AST *)v->array[i].value.p;
+}
+
+/* Frees a node whose children were moved elsewhere */
+static void shell_free(AST *ast)
+{
+    free(ast->childs.a);
+    free(ast);
+}
+
+/* Node of the children in v: the only child, or Epsilon if there are none */
+static AST *node_from(ASTTag tag, Vector *v)
+{
+    AST *ast;
+    if (v->size == 0)
+        ast = ast_create(Epsilon, 0, 0);
+    else if (v->size == 1)
+        ast = child(v, 0);
+    else {
+        ast = ast_create(tag, v->size, 0);
+        for (int i = 0; i < v->size; i++)
+            ast->childs.a[i] = child(v, i);
+    }
+    vector_free(v);
+    return ast;
+}
+
+bool ast_equal(AST *a, AST *b)
+{
+    if (a->tag != b->tag || a->arity != b->arity || a->min != b->min
+        || a->max != b->max)
+        return false;
+    if (a->tag == CharGroup)
+        return memcmp(a->childs.c, b->childs.c, a->arity) == 0;
+    for (int i = 0; i < a->arity; i++) {
+        if (!ast_equal(a->childs.a[i], b->childs.a[i]))
+            return false;
+    }
+    return true;
+}
+
+/* Whether ast matches the empty string */
+bool ast_nullable(AST *ast)
+{
+    switch (ast->tag) {
+        case CharGroup:
+        case Unicode:
+            return false;
+        case Concat:
+            for (int i = 0; i < ast->arity; i++) {
+                if (!ast_nullable(ast->childs.a[i]))
+                    return false;
+            }
+            return true;
+        case Union:
+            for (int i = 0; i < ast->arity; i++) {
+                if (ast_nullable(ast->childs.a[i]))
+                    return true;
+            }
+            return false;
+        case Repeat:
+            return ast->min == 0 || ast_nullable(ast->childs.a[0]);
+        default:  // Star, Epsilon
+            return true;
+    }
+}
+
+/* Sorts the bytes of the groups into a new group, without duplicates */
+static AST *group_merge(AST **groups, int count)
+{
+    bool in[256] = {false};
+    int arity = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < groups[i]->arity; j++) {
+            unsigned char c = groups[i]->childs.c[j];
+            arity += !in[c];
+            in[c] = true;
+        }
+    }
+    AST *group = ast_create(CharGroup, arity, 0);
+    for (int c = 0, i = 0; c < 256; c++) {
+        if (in[c])
+            group->childs.c[i++] = c;
+    }
+    return group;
+}
+
+/* Appends a simplified factor to a concatenation, splicing nested ones */
+static void concat_push(Vector *v, AST *ast)
+{
+    if (ast->tag == Epsilon)
+        ast_free(ast);
+    else if (ast->tag == Concat) {
+        for (int i = 0; i < ast->arity; i++)
+            concat_push(v, ast->childs.a[i]);
+        shell_free(ast);
+    } else if (ast->tag == Star && v->size > 0 && ast_equal(child(v, v->size - 1), ast))
+        ast_free(ast);  // x*x* = x*
+    else
+        vector_push(v, multi_pointer(ast));
+}
+
+static AST *head_of(AST *ast)
+{
+    return ast->tag == Concat ? ast->childs.a[0] : ast;
+}
+
+/* What follows the head of ast, consuming ast but its head when kept */
+static AST *rest_of(AST *ast, bool keep_head)
+{
+    if (ast->tag != Concat) {
+        if (!keep_head)
+            ast_free(ast);
+        return ast_create(Epsilon, 0, 0);
+    }
+    if (!keep_head)
+        ast_free(ast->childs.a[0]);
+    Vector *rest = vector_create(ast->arity - 1);
+    for (int i = 1; i < ast->arity; i++)
+        vector_push(rest, multi_pointer(ast->childs.a[i]));
+    shell_free(ast);
+    return node_from(Concat, rest);
+}
+
+static AST *union_of(Vector *v);
+
+/* Replaces the alternatives with a same head h by h(rest|rest...) */
+static Vector *union_factor(Vector *v)
+{
+    Vector *out = vector_create(v->size);
+    for (int i = 0; i < v->size; i++) {
+        if (child(v, i) == NULL)
+            continue;
+        AST *head = head_of(child(v, i));
+        Vector *rests = vector_create(2);
+        for (int j = i + 1; j < v->size; j++) {
+            if (child(v, j) != NULL && ast_equal(head_of(child(v, j)), head)) {
+                vector_push(rests, multi_pointer(rest_of(child(v, j), false)));
+                v->array[j] = multi_pointer(NULL);
+            }
+        }
+        if (rests->size == 0) {
+            vector_free(rests);
+            vector_push(out, v->array[i]);
+            continue;
+        }
+        vector_push(rests, multi_pointer(rest_of(child(v, i), true)));
+        Vector *factored = vector_create(2);
+        concat_push(factored, head);
+        concat_push(factored, union_of(rests));
+        vector_push(out, multi_pointer(node_from(Concat, factored)));
+    }
+    vector_free(v);
+    return out;
+}
+
+/* Union of simplified alternatives, consuming v */
+static AST *union_of(Vector *v)
+{
+    // Flatten and drop duplicates
+    Vector *flat = vector_create(v->size);
+    for (int i = 0; i < v->size; i++) {
+        AST *ast = child(v, i);
+        int count = ast->tag == Union ? ast->arity : 1;
+        for (int k = 0; k < count; k++) {
+            AST *alt = ast->tag == Union ? ast->childs.a[k] : ast;
+            bool seen = false;
+            for (int j = 0; j < flat->size && !seen; j++)
+                seen = ast_equal(child(flat, j), alt);
+            if (seen)
+                ast_free(alt);
+            else
+                vector_push(flat, multi_pointer(alt));
+        }
+        if (ast->tag == Union)
+            shell_free(ast);
+    }
+    vector_free(v);
+    flat = union_factor(flat);
+
+    // One group for all the character groups, and epsilon only if needed
+    AST **groups = malloc(flat->size * sizeof(AST *));
+    int ngroups = 0;
+    bool nullable = false;
+    for (int i = 0; i < flat->size; i++) {
+        if (child(flat, i)->tag == CharGroup)
+            groups[ngroups++] = child(flat, i);
+        else if (child(flat, i)->tag != Epsilon)
+            nullable |= ast_nullable(child(flat, i));
+    }
+    Vector *alts = vector_create(flat->size);
+    if (ngroups > 0)
+        vector_push(alts, multi_pointer(ngroups == 1 ? groups[0] : group_merge(groups, ngroups)));
+    bool epsilon = false;
+    for (int i = 0; i < flat->size; i++) {
+        AST *alt = child(flat, i);
+        if (alt->tag == CharGroup) {
+            if (ngroups > 1)
+                ast_free(alt);
+        } else if (alt->tag == Epsilon && (nullable || epsilon))
+            ast_free(alt);
+        else {
+            epsilon |= alt->tag == Epsilon;
+            vector_push(alts, multi_pointer(alt));
+        }
+    }
+    free(groups);
+    vector_free(flat);
+    return node_from(Union, alts);
+}
+
+static AST *simplify_star(AST *ast)
+{
+    AST *body = ast_simplify(ast->childs.a[0]);
+    shell_free(ast);
+    if (body->tag == Epsilon || body->tag == Star)
+        return body;  // ()* = (), x** = x*
+    if (body->tag == Union) {
+        // (x*|y|())* = (x|y)*
+        Vector *alts = vector_create(body->arity);
+        for (int i = 0; i < body->arity; i++) {
+            AST *alt = body->childs.a[i];
+            if (alt->tag == Epsilon)
+                ast_free(alt);
+            else if (alt->tag == Star) {
+                vector_push(alts, multi_pointer(alt->childs.a[0]));
+                shell_free(alt);
+            } else
+                vector_push(alts, multi_pointer(alt));
+        }
+        shell_free(body);
+        body = alts->size == 0 ? node_from(Union, alts) : union_of(alts);
+        if (body->tag == Epsilon)
+            return body;
+    }
+    return ast_create(Star, 1, 1, body);
+}
+
+/* body repeated count times, consuming body */
+static AST *repeat_exactly(AST *body, int count)
+{
+    Vector *factors = vector_create(count);
+    for (int i = 0; i < count; i++)
+        concat_push(factors, i == count - 1 ? body : ast_copy(body));
+    if (count == 0)
+        ast_free(body);
+    return node_from(Concat, factors);
+}
+
+/* Up to count times body, as nested options (body(body(body)?)?)? */
+static AST *repeat_at_most(AST *body, int count)
+{
+    AST *ast = ast_create(Epsilon, 0, 0);
+    for (int i = 0; i < count; i++) {
+        Vector *factors = vector_create(2);
+        concat_push(factors, i == count - 1 ? body : ast_copy(body));
+        concat_push(factors, ast);
+        ast = ast_create(Union, 2, 2, ast_create(Epsilon, 0, 0), node_from(Concat, factors));
+    }
+    if (count == 0)
+        ast_free(body);
+    return ast_simplify(ast);
+}
+
+/*
+ * Repetition of body between min and max times, unrolled but for more than
+ * SIMPLIFY_MAX_UNROLL copies, which are left to the counters of the
+ * counting automaton. The counted repetitions of such a body are unrolled,
+ * as a counted body only holds plain states.
+ */
+static AST *repeat_bounded(AST *body, int min, int max)
+{
+    if (body->tag == Epsilon)
+        return body;
+    if (max > SIMPLIFY_MAX_UNROLL) {
+        AST *repeat = ast_create(Repeat, 1, 1, ast_unroll(body));
+        repeat->min = min;
+        repeat->max = max;
+        return repeat;
+    }
+    Vector *factors = vector_create(2);
+    concat_push(factors, repeat_exactly(ast_copy(body), min));
+    concat_push(factors, repeat_at_most(body, max - min));
+    return node_from(Concat, factors);
+}
+
+/* x{m,n} as above, and x{m,} as x{m}x* */
+static AST *simplify_repeat(AST *ast)
+{
+    AST *body = ast_simplify(ast->childs.a[0]);
+    int min = ast->min, max = ast->max;
+    shell_free(ast);
+    if (max >= 0)
+        return repeat_bounded(body, min, max);
+    Vector *factors = vector_create(2);
+    concat_push(factors, repeat_bounded(ast_copy(body), min, min));
+    concat_push(factors, simplify_star(ast_create(Star, 1, 1, body)));
+    return node_from(Concat, factors);
+}
+
+/*
+ * Unrolls the Repeat nodes left by ast_simplify, for the callers that need
+ * the exact DFA of a counted pattern. The AST given is consumed.
+ */
+AST *ast_unroll(AST *ast)
+{
+    if (ast->tag == CharGroup)
+        return ast;
+    for (int i = 0; i < ast->arity; i++)
+        ast->childs.a[i] = ast_unroll(ast->childs.a[i]);
+    if (ast->tag != Repeat)
+        return ast;
+    AST *body = ast->childs.a[0];
+    Vector *factors = vector_create(2);
+    concat_push(factors, repeat_exactly(ast_copy(body), ast->min));
+    concat_push(factors, repeat_at_most(body, ast->max - ast->min));
+    shell_free(ast);
+    return node_from(Concat, factors);
+}
+
+/*
+ * Drops the uppercase ASCII letters of the character groups also holding
+ * their lowercase one, for a table mapping both to a same byte class.
+ */
+void ast_lower(AST *ast)
+{
+    if (ast->tag != CharGroup) {
+        for (int i = 0; i < ast->arity; i++)
+            ast_lower(ast->childs.a[i]);
+        return;
+    }
+    int k = 0;
+    for (int i = 0; i < ast->arity; i++) {
+        char c = ast->childs.c[i];
+        if (!isupper((unsigned char)c) || memchr(ast->childs.c, tolower(c), ast->arity) == NULL)
+            ast->childs.c[k++] = c;
+    }
+    ast->arity = k;
+}
+
+AST *ast_simplify(AST *ast)
+{
+    switch (ast->tag) {
+        case CharGroup: {
+            AST *group = group_merge(&ast, 1);
+            ast_free(ast);
+            return group;
+        }
+        case Concat: {
+            Vector *factors = vector_create(ast->arity);
+            for (int i = 0; i < ast->arity; i++)
+                concat_push(factors, ast_simplify(ast->childs.a[i]));
+            shell_free(ast);
+            return node_from(Concat, factors);
+        }
+        case Union: {
+            Vector *alts = vector_create(ast->arity);
+            for (int i = 0; i < ast->arity; i++)
+                vector_push(alts, multi_pointer(ast_simplify(ast->childs.a[i])));
+            shell_free(ast);
+            return union_of(alts);
+        }
+        case Star:
+            return simplify_star(ast);
+        case Repeat:
+            return simplify_repeat(ast);
+        default:
+            return ast;
+    }
+}
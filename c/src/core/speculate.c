@@ -0,0 +1,149 @@
+/**
+ * Speculative parallel walk of a single long text. A segment does not know
+ * the state the previous segment ends in, so it is walked from every
+ * candidate:
+ *    - the candidates are the targets of the byte before the segment, from
+ *      any state, which is usually a small part of the minimal DFA
+ *    - walks reaching the same state are merged, and most of them converge
+ *      within a few bytes, so the segment is soon walked once
+ *    - walks in the dead state cost nothing, table_run stops on it
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "speculate.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "table.h"
+
+const size_t SPECULATE_MIN_SEGMENT = 1 << 20;
+
+static const size_t MERGE_INTERVAL = 64;  // bytes walked between merges
+
+typedef struct Segment {
+    Table *t;
+    const char *s;
+    size_t n;
+    uint32_t *end;  // start state -> end state, for the candidates
+    bool threaded;  // else walked by the calling thread once its state is known
+} Segment;
+
+/* Marks the candidate start states of seg, returns their number */
+static int candidates(Segment *seg, uint32_t *starts, bool *seen)
+{
+    Table *t = seg->t;
+    unsigned char before = seg->s[-1];
+    int k = 0;
+    for (int q = 0; q < t->size; q++) {
+        uint32_t target = table_step(t, q, before);
+        if (!seen[target]) {
+            seen[target] = true;
+            starts[k++] = target;
+        }
+    }
+    return k;
+}
+
+/* Renumbers the walks so that no two are in the same state */
+static int merge_walks(uint32_t *current, int walks, int *walk_of, int k,
+                       int *owner)
+{
+    int *renumber = malloc(walks * sizeof(int));
+    int merged = 0;
+    for (int w = 0; w < walks; w++) {
+        if (owner[current[w]] < 0) {
+            owner[current[w]] = merged;
+            current[merged++] = current[w];
+        }
+        renumber[w] = owner[current[w]];
+    }
+    for (int w = 0; w < merged; w++)
+        owner[current[w]] = -1;
+    for (int j = 0; j < k; j++)
+        walk_of[j] = renumber[walk_of[j]];
+    free(renumber);
+    return merged;
+}
+
+/* Fills seg->end by walking the segment from all its candidates */
+static void *walk_segment(void *arg)
+{
+    Segment *seg = arg;
+    Table *t = seg->t;
+    uint32_t *starts = malloc(t->size * sizeof(uint32_t));
+    uint32_t *current = malloc(t->size * sizeof(uint32_t));  // walk -> state
+    int *walk_of = malloc(t->size * sizeof(int));            // candidate -> walk
+    int *owner = malloc(t->size * sizeof(int));              // state -> walk
+    bool *seen = calloc(t->size, sizeof(bool));
+    int k = candidates(seg, starts, seen);
+    for (int j = 0; j < k; j++) {
+        current[j] = starts[j];
+        walk_of[j] = j;
+    }
+    for (int q = 0; q < t->size; q++)
+        owner[q] = -1;
+
+    int walks = k;
+    size_t done = 0;
+    while (done < seg->n) {
+        size_t len = walks == 1 || seg->n - done < MERGE_INTERVAL
+                         ? seg->n - done
+                         : MERGE_INTERVAL;
+        for (int w = 0; w < walks; w++)
+            current[w] = table_run(t, current[w], seg->s + done, len);
+        done += len;
+        walks = merge_walks(current, walks, walk_of, k, owner);
+    }
+    for (int j = 0; j < k; j++)
+        seg->end[starts[j]] = current[walk_of[j]];
+
+    free(seen);
+    free(owner);
+    free(walk_of);
+    free(current);
+    free(starts);
+    return NULL;
+}
+
+/*
+ * Walks s from state on up to threads threads, one segment per thread. A
+ * segment whose thread cannot be created is walked by the calling thread.
+ */
+uint32_t speculate_run(Table *t, uint32_t state, const char *s, size_t n,
+                       int threads)
+{
+    size_t count = n / SPECULATE_MIN_SEGMENT;
+    if (count > (size_t)threads)
+        count = threads;
+    if (count < 2)
+        return table_run(t, state, s, n);
+
+    size_t len = n / count;
+    Segment *segments = calloc(count, sizeof(Segment));
+    pthread_t *ids = malloc(count * sizeof(pthread_t));
+    for (size_t i = 1; i < count; i++) {
+        size_t start = i * len;
+        segments[i].t = t;
+        segments[i].s = s + start;
+        segments[i].n = i == count - 1 ? n - start : len;
+        segments[i].end = malloc(t->size * sizeof(uint32_t));
+        segments[i].threaded = segments[i].end != NULL
+                               && pthread_create(&ids[i], NULL, walk_segment,
+                                                 &segments[i]) == 0;
+    }
+    state = table_run(t, state, s, len);
+    for (size_t i = 1; i < count; i++) {
+        if (segments[i].threaded) {
+            pthread_join(ids[i], NULL);
+            state = segments[i].end[state];
+        } else
+            state = table_run(t, state, segments[i].s, segments[i].n);
+        free(segments[i].end);
+    }
+    free(ids);
+    free(segments);
+    return state;
+}
@@ -0,0 +1,684 @@
+/**
+ * Compiles a DFA into a flat transition table for the scan loop:
+ *    - Bytes are grouped into equivalence classes (same target from every
+ *      state), so a row has one entry per class instead of per byte
+ *    - State ids are 16-bit when there are less than 65536 states
+ *    - Tables larger than TABLE_DENSE_LIMIT are packed by row displacement,
+ *      keeping only the transitions that do not lead to the dead state
+ */
+
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memcpy, memset
+
+#include "approx.h"
+#include "automaton.h"
+#include "counting.h"
+#include "hashtable.h"
+#include "multitype.h"
+#include "vector.h"
+
+// Roughly the size of a L2 cache: beyond it the dense layout thrashes.
+const size_t TABLE_DENSE_LIMIT = 256 * 1024;
+
+static const uint32_t NO_STATE = UINT32_MAX;
+
+enum { TABLE_LANES = 8 };  // strings walked together by table_accept_batch
+
+static void index_state(HashTable *ids, Vector *states, MultiType q)
+{
+    if (q.type == NullType || hashtable_contains(ids, q))
+        return;
+    hashtable_set(ids, q, multi_int(states->size));
+    vector_push(states, q);
+}
+
+/* Numbers every state of the DFA, the initial state first */
+static Vector *index_states(DFA *dfa, HashTable *ids)
+{
+    Vector *states = vector_create(dfa->_transitions->size + 1);
+    index_state(ids, states, dfa->initial);
+
+    Vector *keys = hashtable_to_vector(dfa->_transitions);
+    for (int i = 0; i < keys->size; i++)
+        index_state(ids, states, keys->array[i]);
+    vector_free(keys);
+
+    for (int i = 0; i < states->size; i++) {
+        MultiType h = hashtable_get(dfa->_transitions, states->array[i]);
+        if (h.type != HtblType)
+            continue;
+        HashTable *row = (HashTable *)h.value.p;
+        for (int b = 0; b < row->capacity; b++) {
+            for (Entry *e = row->array[b]; e != NULL; e = e->next)
+                index_state(ids, states, e->value);
+        }
+    }
+    keys = hashtable_to_vector(dfa->final);
+    for (int i = 0; i < keys->size; i++)
+        index_state(ids, states, keys->array[i]);
+    vector_free(keys);
+    return states;
+}
+
+/* Fills row[256] with the targets of q, NO_STATE for missing transitions */
+static void read_row(DFA *dfa, HashTable *ids, MultiType q, uint32_t *row)
+{
+    for (int c = 0; c < 256; c++)
+        row[c] = NO_STATE;
+
+    MultiType h = hashtable_get(dfa->_transitions, q);
+    if (h.type != HtblType)
+        return;
+    HashTable *letters = (HashTable *)h.value.p;
+    for (int b = 0; b < letters->capacity; b++) {
+        for (Entry *e = letters->array[b]; e != NULL; e = e->next) {
+            if (e->value.type == NullType)
+                continue;
+            unsigned char c = (unsigned char)e->key.value.c;
+            row[c] = hashtable_get(ids, e->value).value.i;
+        }
+    }
+}
+
+/*
+ * Splits the classes of map so that bytes of a same class have the same
+ * target in row. New classes are numbered by first occurrence.
+ */
+static int refine_classes(uint8_t *map, const uint32_t *row)
+{
+    int head[256], chain[256], count = 0;
+    uint32_t target[256];
+    uint8_t refined[256];
+
+    for (int i = 0; i < 256; i++)
+        head[i] = -1;
+
+    for (int c = 0; c < 256; c++) {
+        int k = head[map[c]];
+        while (k != -1 && target[k] != row[c])
+            k = chain[k];
+        if (k == -1) {
+            k = count++;
+            target[k] = row[c];
+            chain[k] = head[map[c]];
+            head[map[c]] = k;
+        }
+        refined[c] = (uint8_t)k;
+    }
+    memcpy(map, refined, sizeof(refined));
+    return count;
+}
+
+/* Returns a non accepting state looping on itself, or NO_STATE */
+static uint32_t find_dead(Table *t, uint32_t *rows)
+{
+    for (int q = 0; q < t->size; q++) {
+        if (t->final[q])
+            continue;
+        bool dead = true;
+        for (int a = 0; a < t->classes && dead; a++) {
+            uint32_t p = rows[(size_t)q * t->classes + a];
+            dead = p == (uint32_t)q || p == NO_STATE;
+        }
+        if (dead)
+            return q;
+    }
+    return NO_STATE;
+}
+
+static void pack_dense(Table *t, uint32_t *rows, TableKind kind)
+{
+    size_t n = (size_t)t->size * t->classes;
+    t->kind = kind;
+    if (kind == TableDense16) {
+        t->delta.d16 = malloc(n * sizeof(uint16_t));
+        for (size_t i = 0; i < n; i++)
+            t->delta.d16[i] = (uint16_t)rows[i];
+    } else {
+        t->delta.d32 = malloc(n * sizeof(uint32_t));
+        memcpy(t->delta.d32, rows, n * sizeof(uint32_t));
+    }
+}
+
+static void grow_slots(Table *t, int *capacity, int needed)
+{
+    if (needed <= *capacity)
+        return;
+    int old = *capacity;
+    while (*capacity < needed)
+        *capacity *= 2;
+    t->next = realloc(t->next, *capacity * sizeof(uint32_t));
+    t->check = realloc(t->check, *capacity * sizeof(uint32_t));
+    for (int i = old; i < *capacity; i++)
+        t->check[i] = NO_STATE;
+}
+
+/*
+ * Row displacement: every row is shifted to the first offset where its non
+ * dead transitions do not collide with already placed rows.
+ */
+static void pack_displaced(Table *t, uint32_t *rows)
+{
+    int capacity = 2 * t->classes, first_free = 0;
+    t->kind = TableDisplaced;
+    t->base = malloc(t->size * sizeof(int32_t));
+    t->slots = t->classes;
+    t->next = malloc(capacity * sizeof(uint32_t));
+    t->check = malloc(capacity * sizeof(uint32_t));
+    for (int i = 0; i < capacity; i++)
+        t->check[i] = NO_STATE;
+
+    for (int q = 0; q < t->size; q++) {
+        uint32_t *row = &rows[(size_t)q * t->classes];
+        while (first_free < capacity && t->check[first_free] != NO_STATE)
+            first_free++;
+
+        int base = first_free;
+        for (;; base++) {
+            grow_slots(t, &capacity, base + t->classes);
+            bool fits = true;
+            for (int a = 0; a < t->classes && fits; a++)
+                fits = row[a] == t->dead || t->check[base + a] == NO_STATE;
+            if (fits)
+                break;
+        }
+        t->base[q] = base;
+        for (int a = 0; a < t->classes; a++) {
+            if (row[a] == t->dead)
+                continue;
+            t->next[base + a] = row[a];
+            t->check[base + a] = q;
+        }
+        if (base + t->classes > t->slots)
+            t->slots = base + t->classes;
+    }
+}
+
+static size_t displaced_bytes(Table *t)
+{
+    return (size_t)t->slots * 2 * sizeof(uint32_t) + t->size * sizeof(int32_t);
+}
+
+static void free_packed(Table *t)
+{
+    if (t->kind == TableDisplaced) {
+        free(t->base);
+        free(t->next);
+        free(t->check);
+        t->base = NULL;
+        t->next = t->check = NULL;
+    } else if (t->kind == TableDense16)
+        free(t->delta.d16);
+    else
+        free(t->delta.d32);
+}
+
+/* Stores rows (states x classes) in the layout kind, or the smallest one */
+static void table_pack(Table *t, uint32_t *rows, bool automatic, TableKind kind)
+{
+    size_t cells = (size_t)t->size * t->classes;
+    TableKind dense = t->size < 65536 ? TableDense16 : TableDense32;
+    size_t dense_bytes = cells * (dense == TableDense16 ? 2 : 4);
+    if (automatic) {
+        kind = dense;
+        if (dense_bytes > TABLE_DENSE_LIMIT) {
+            pack_displaced(t, rows);
+            if (displaced_bytes(t) < dense_bytes)
+                return;
+            free_packed(t);
+        }
+    }
+    if (kind == TableDense16 && t->size >= 65536)
+        kind = TableDense32;
+    if (kind == TableDisplaced)
+        pack_displaced(t, rows);
+    else
+        pack_dense(t, rows, kind);
+}
+
+static Table *table_build(DFA *dfa, bool automatic, TableKind kind)
+{
+    HashTable *ids = hashtable_create(dfa->_transitions->size + 1);
+    Vector *states = index_states(dfa, ids);
+    uint32_t row[256];
+
+    Table *t = calloc(1, sizeof(Table));
+    t->initial = 0;
+    t->size = states->size;
+    t->classes = 1;
+    for (int q = 0; q < states->size; q++) {
+        read_row(dfa, ids, states->array[q], row);
+        t->classes = refine_classes(t->map, row);
+    }
+
+    // One more state in case the DFA has no sink to stand for missing ones
+    uint32_t *rows = malloc(((size_t)t->size + 1) * t->classes * sizeof(uint32_t));
+    t->final = calloc(t->size + 1, sizeof(uint8_t));
+    for (int q = 0; q < states->size; q++) {
+        read_row(dfa, ids, states->array[q], row);
+        for (int c = 0; c < 256; c++)
+            rows[(size_t)q * t->classes + t->map[c]] = row[c];
+        t->final[q] = hashtable_contains(dfa->final, states->array[q]);
+    }
+    vector_free(states);
+    hashtable_free(ids, false);
+
+    t->dead = find_dead(t, rows);
+    if (t->dead == NO_STATE)
+        t->dead = t->size++;
+    for (size_t i = 0; i < (size_t)t->size * t->classes; i++) {
+        if (rows[i] == NO_STATE || i / t->classes == t->dead)
+            rows[i] = t->dead;
+    }
+    table_pack(t, rows, automatic, kind);
+    free(rows);
+    return t;
+}
+
+/* Compiles dfa, picking the layout from the size of the table */
+Table *table_create(DFA *dfa)
+{
+    return table_build(dfa, true, TableDense16);
+}
+
+Table *table_create_kind(DFA *dfa, TableKind kind)
+{
+    return table_build(dfa, false, kind);
+}
+
+/* Maps the uppercase ASCII letters to the classes of their lowercase ones */
+void table_fold_case(Table *t)
+{
+    for (int c = 'A'; c <= 'Z'; c++)
+        t->map[c] = t->map[c - 'A' + 'a'];
+}
+
+/* Breadth-first numbering from the initial state, the dead state last */
+static void bfs_order(Table *t, uint32_t *order)
+{
+    uint8_t *seen = calloc(t->size, sizeof(uint8_t));
+    int n = 0;
+
+    seen[t->dead] = 1;
+    if (!seen[t->initial]) {
+        seen[t->initial] = 1;
+        order[n++] = t->initial;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int a = 0; a < t->classes; a++) {
+            uint32_t p = table_step_class(t, order[i], a);
+            if (!seen[p]) {
+                seen[p] = 1;
+                order[n++] = p;
+            }
+        }
+    }
+    for (int q = 0; q < t->size; q++) {  // unreachable states
+        if (!seen[q])
+            order[n++] = q;
+    }
+    order[n] = t->dead;
+    free(seen);
+}
+
+typedef struct Visits {
+    uint64_t count;
+    uint32_t state;
+    uint32_t rank;  // breadth-first position, to break ties
+} Visits;
+
+static int compare_visits(const void *a, const void *b)
+{
+    const Visits *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return (x->rank > y->rank) - (x->rank < y->rank);
+}
+
+/*
+ * Renumbers the states so that the hot ones are contiguous: by decreasing
+ * visit count when counts are given (ties keep the breadth-first order),
+ * else in breadth-first order from the initial state.
+ */
+void table_reorder(Table *t, const uint64_t *counts)
+{
+    uint32_t *order = malloc(t->size * sizeof(uint32_t));
+    bfs_order(t, order);
+    if (counts != NULL) {
+        Visits *visits = malloc(t->size * sizeof(Visits));
+        for (int i = 0; i < t->size; i++)
+            visits[i] = (Visits){counts[order[i]], order[i], i};
+        qsort(visits, t->size - 1, sizeof(Visits), compare_visits);  // dead last
+        for (int i = 0; i < t->size; i++)
+            order[i] = visits[i].state;
+        free(visits);
+    }
+
+    uint32_t *rename = malloc(t->size * sizeof(uint32_t));
+    for (int i = 0; i < t->size; i++)
+        rename[order[i]] = i;
+
+    uint32_t *rows = malloc((size_t)t->size * t->classes * sizeof(uint32_t));
+    uint8_t *final = malloc(t->size * sizeof(uint8_t));
+    for (int i = 0; i < t->size; i++) {
+        for (int a = 0; a < t->classes; a++) {
+            uint32_t p = table_step_class(t, order[i], a);
+            rows[(size_t)i * t->classes + a] = rename[p];
+        }
+        final[i] = t->final[order[i]];
+    }
+    TableKind kind = t->kind;
+    free_packed(t);
+    free(t->final);
+    t->final = final;
+    t->initial = rename[t->initial];
+    t->dead = rename[t->dead];
+    table_pack(t, rows, false, kind);
+
+    free(rows);
+    free(rename);
+    free(order);
+}
+
+size_t table_bytes(Table *t)
+{
+    switch (t->kind) {
+        case TableDense16:
+            return (size_t)t->size * t->classes * sizeof(uint16_t);
+        case TableDense32:
+            return (size_t)t->size * t->classes * sizeof(uint32_t);
+        default:
+            return displaced_bytes(t);
+    }
+}
+
+/*
+ * Runs the table on s from state, stopping early in the dead state. Each
+ * layout has its own loop so the switch is not evaluated for every byte.
+ */
+uint32_t table_run(Table *t, uint32_t state, const char *s, size_t n)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    const uint32_t dead = t->dead;
+    const int classes = t->classes;
+    size_t i = 0;
+
+    switch (t->kind) {
+        case TableDense16:
+            for (; i < n && state != dead; i++)
+                state = t->delta.d16[state * classes + t->map[u[i]]];
+            break;
+        case TableDense32:
+            for (; i < n && state != dead; i++)
+                state = t->delta.d32[state * classes + t->map[u[i]]];
+            break;
+        case TableDisplaced:
+            for (; i < n && state != dead; i++) {
+                int32_t j = t->base[state] + t->map[u[i]];
+                state = t->check[j] == state ? t->next[j] : dead;
+            }
+            break;
+    }
+    return state;
+}
+
+static bool combination_accept(const TableCombination *c, const char *head,
+                               size_t head_len, const char *s, size_t n);
+
+/* Whether the automata beside the DFA accept a line ending in a final state */
+bool table_confirm(Table *t, const char *head, size_t head_len, const char *s,
+                   size_t n)
+{
+    return (t->counting == NULL || counting_accept(t->counting, head, head_len, s, n))
+           && (t->approx == NULL || approx_accept(t->approx, head, head_len, s, n))
+           && (t->combination == NULL
+               || combination_accept(t->combination, head, head_len, s, n));
+}
+
+/* Whether the line made of head then s is a match */
+static bool table_match(Table *t, const char *head, size_t head_len, const char *s,
+                        size_t n)
+{
+    uint32_t state = table_run(t, t->initial, head, head_len);
+    state = table_run(t, state, s, n);
+    return t->final[state] && table_confirm(t, head, head_len, s, n);
+}
+
+/* Value of the combination on the line made of head then s */
+static bool combination_accept(const TableCombination *c, const char *head,
+                               size_t head_len, const char *s, size_t n)
+{
+    bool sum = false, product = true;
+    for (int i = 0; i < c->count; i++) {
+        if (i > 0 && !c->joined[i]) {
+            sum |= product;
+            product = true;
+        }
+        if (product)  // else the product is already false
+            product = table_match(c->tables[i], head, head_len, s, n) != c->negated[i];
+    }
+    sum |= product;
+    return sum != c->invert;
+}
+
+bool table_accept(Table *t, const char *s, size_t n)
+{
+    return t->final[table_run(t, t->initial, s, n)] && table_confirm(t, NULL, 0, s, n);
+}
+
+/* Lanes of table_accept_batch, each walking one string */
+typedef struct Lanes {
+    uint32_t state[TABLE_LANES];
+    const unsigned char *p[TABLE_LANES];
+    const unsigned char *end[TABLE_LANES];
+    size_t owner[TABLE_LANES];  // index of the string
+    size_t next;                // next string to walk
+} Lanes;
+
+static void set_result(uint64_t *results, size_t i)
+{
+    results[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+/* Gives lane l the next non empty string, false when there is none left */
+static bool refill_lane(Table *t, Lanes *lanes, int l, const char *const *strings,
+                        const size_t *lengths, size_t count, uint64_t *results)
+{
+    for (; lanes->next < count && lengths[lanes->next] == 0; lanes->next++) {
+        if (t->final[t->initial])
+            set_result(results, lanes->next);
+    }
+    if (lanes->next == count)
+        return false;
+    lanes->state[l] = t->initial;
+    lanes->p[l] = (const unsigned char *)strings[lanes->next];
+    lanes->end[l] = lanes->p[l] + lengths[lanes->next];
+    lanes->owner[l] = lanes->next++;
+    return true;
+}
+
+/* Transition of a lane, kind being constant once inlined in walk_lanes */
+static inline uint32_t lane_step(Table *t, TableKind kind, uint32_t dead,
+                                 uint32_t q, uint8_t a)
+{
+    switch (kind) {
+        case TableDense16:
+            return t->delta.d16[q * t->classes + a];
+        case TableDense32:
+            return t->delta.d32[q * t->classes + a];
+        default: {
+            int32_t j = t->base[q] + a;
+            return t->check[j] == q ? t->next[j] : dead;
+        }
+    }
+}
+
+/*
+ * Steps the lanes in turn, one byte each, until a lane is over and no
+ * string is left to refill it. That lane is then marked empty (end NULL),
+ * and the others are left partly walked.
+ */
+static void walk_lanes(Table *t, TableKind kind, Lanes *lanes,
+                       const char *const *strings, const size_t *lengths,
+                       size_t count, uint64_t *results)
+{
+    const uint32_t dead = t->dead;
+    for (;;) {
+        for (int l = 0; l < TABLE_LANES; l++) {
+            if (lanes->p[l] == lanes->end[l] || lanes->state[l] == dead) {
+                if (t->final[lanes->state[l]])
+                    set_result(results, lanes->owner[l]);
+                if (!refill_lane(t, lanes, l, strings, lengths, count, results)) {
+                    lanes->end[l] = NULL;
+                    return;
+                }
+            }
+            uint8_t a = t->map[*lanes->p[l]++];
+            lanes->state[l] = lane_step(t, kind, dead, lanes->state[l], a);
+        }
+    }
+}
+
+/*
+ * Sets bit i of results (count bits, rounded up to whole words) when the
+ * whole of strings[i] is accepted. TABLE_LANES strings are walked at once:
+ * each step only depends on the previous state of the same lane, so the
+ * table loads of the lanes are in flight together, where a single walk
+ * waits for every load. A lane whose string is over takes the next one,
+ * and the strings left when the lanes cannot be refilled run one by one.
+ */
+void table_accept_batch(Table *t, const char *const *strings,
+                        const size_t *lengths, size_t count, uint64_t *results)
+{
+    memset(results, 0, (count + 63) / 64 * sizeof(uint64_t));
+    Lanes lanes;
+    lanes.next = 0;
+    int full = 0;
+    while (full < TABLE_LANES
+           && refill_lane(t, &lanes, full, strings, lengths, count, results))
+        full++;
+
+    if (full == TABLE_LANES) {
+        switch (t->kind) {
+            case TableDense16:
+                walk_lanes(t, TableDense16, &lanes, strings, lengths, count, results);
+                break;
+            case TableDense32:
+                walk_lanes(t, TableDense32, &lanes, strings, lengths, count, results);
+                break;
+            case TableDisplaced:
+                walk_lanes(t, TableDisplaced, &lanes, strings, lengths, count, results);
+                break;
+        }
+    } else {
+        for (int l = full; l < TABLE_LANES; l++)
+            lanes.end[l] = NULL;
+    }
+    for (int l = 0; l < TABLE_LANES; l++) {
+        if (lanes.end[l] == NULL)
+            continue;
+        uint32_t q = table_run(t, lanes.state[l], (const char *)lanes.p[l],
+                               lanes.end[l] - lanes.p[l]);
+        if (t->final[q])
+            set_result(results, lanes.owner[l]);
+    }
+    bool confirm = t->counting != NULL || t->approx != NULL || t->combination != NULL;
+    for (size_t i = 0; confirm && i < count; i++) {
+        if ((results[i / 64] >> (i % 64) & 1)
+            && !table_confirm(t, NULL, 0, strings[i], lengths[i]))
+            results[i / 64] &= ~(UINT64_C(1) << (i % 64));
+    }
+}
+
+/*
+ * Same as table_run, counting in counts[q] every visit of a state q it steps
+ * into. The state it starts from was counted by the caller, when it began
+ * the line or by the run over the previous chunk.
+ */
+uint32_t table_profile(Table *t, uint32_t state, const char *s, size_t n,
+                       uint64_t *counts)
+{
+    for (size_t i = 0; i < n && state != t->dead; i++) {
+        state = table_step(t, state, (unsigned char)s[i]);
+        counts[state]++;
+    }
+    return state;
+}
+
+/*
+ * Writes counts as "rank count" lines, preceded by the number of states.
+ * States are identified by their breadth-first rank, which does not depend
+ * on the current numbering, so a profile can be read back into a table that
+ * was already reordered.
+ */
+void table_write_counts(FILE *file, Table *t, const uint64_t *counts)
+{
+    uint32_t *order = malloc(t->size * sizeof(uint32_t));
+    bfs_order(t, order);
+    fprintf(file, "states %d\n", t->size);
+    for (int i = 0; i < t->size; i++)
+        fprintf(file, "%d %llu\n", i, (unsigned long long)counts[order[i]]);
+    free(order);
+}
+
+/* Reads counts written by table_write_counts, NULL if they do not fit t */
+uint64_t *table_read_counts(FILE *file, Table *t)
+{
+    int size, rank;
+    unsigned long long count;
+    if (fscanf(file, "states %d", &size) != 1 || size != t->size)
+        return NULL;
+
+    uint32_t *order = malloc(t->size * sizeof(uint32_t));
+    uint64_t *counts = calloc(t->size, sizeof(uint64_t));
+    bfs_order(t, order);
+    while (fscanf(file, "%d %llu", &rank, &count) == 2) {
+        if (rank < 0 || rank >= t->size) {
+            free(counts);
+            counts = NULL;
+            break;
+        }
+        counts[order[rank]] = count;
+    }
+    free(order);
+    return counts;
+}
+
+/* Combination of count tables, all or-ed and not negated until set */
+TableCombination *table_combination_create(int count, bool invert)
+{
+    TableCombination *c = malloc(sizeof(TableCombination));
+    c->count = count;
+    c->tables = calloc(count, sizeof(Table *));
+    c->negated = calloc(count, sizeof(bool));
+    c->joined = calloc(count, sizeof(bool));
+    c->invert = invert;
+    return c;
+}
+
+static void combination_free(TableCombination *c)
+{
+    if (c == NULL)
+        return;
+    for (int i = 0; i < c->count; i++)
+        table_free(c->tables[i]);
+    free(c->tables);
+    free(c->negated);
+    free(c->joined);
+    free(c);
+}
+
+void table_free(Table *t)
+{
+    free_packed(t);
+    free(t->final);
+    counting_free(t->counting);
+    approx_free(t->approx);
+    combination_free(t->combination);
+    free(t);
+}
@@ -0,0 +1,381 @@
+/**
+ * Derives from an AST the trigrams that a matching line must contain, as
+ * in Russ Cox's "Regular Expression Matching with a Trigram Index". Every
+ * node is summarized by:
+ *    - exact: the set of strings it matches, while that set is small
+ *    - prefix, suffix: strings that every match starts (ends) with
+ *    - match: a query that every match satisfies
+ * Sets are strings stored as keys of a Set.
+ */
+
+#include "trigram.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memcpy, strlen
+
+#include "hashtable.h"
+#include "multitype.h"
+#include "parser.h"
+#include "utf8.h"
+#include "vector.h"
+
+static const int MAX_EXACT = 16;  // beyond, exact sets become prefix/suffix
+static const int MAX_SET = 32;    // beyond, prefix/suffix sets are trimmed
+static const int MAX_CROSS = 64;  // beyond, boundary trigrams are dropped
+
+typedef struct Info {
+    bool emptyable;
+    Set *exact;  // NULL when unknown
+    Set *prefix;
+    Set *suffix;
+    Query *match;
+} Info;
+
+static Set *strset_create(void)
+{
+    return hashtable_create(8);
+}
+
+static void strset_add(Set *set, const char *s, size_t n)
+{
+    char *copy = malloc(n + 1);
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+    if (hashtable_contains(set, multi_string(copy)))
+        free(copy);
+    else
+        hashtable_set(set, multi_string(copy), multi_string(copy));
+}
+
+static void strset_free(Set *set)
+{
+    if (set == NULL)
+        return;
+    for (int b = 0; b < set->capacity; b++) {
+        for (Entry *e = set->array[b]; e != NULL; e = e->next)
+            free(e->key.value.s);
+    }
+    hashtable_free(set, false);
+}
+
+static Set *strset_union(Set *a, Set *b)
+{
+    Set *set = strset_create();
+    Set *sets[] = {a, b};
+    for (int i = 0; i < 2; i++) {
+        for (int k = 0; k < sets[i]->capacity; k++) {
+            for (Entry *e = sets[i]->array[k]; e != NULL; e = e->next)
+                strset_add(set, e->key.value.s, strlen(e->key.value.s));
+        }
+    }
+    return set;
+}
+
+static Set *strset_cross(Set *a, Set *b)
+{
+    Set *set = strset_create();
+    Vector *left = hashtable_to_vector(a), *right = hashtable_to_vector(b);
+    for (int i = 0; i < left->size; i++) {
+        char *x = left->array[i].value.s;
+        size_t nx = strlen(x);
+        for (int j = 0; j < right->size; j++) {
+            char *y = right->array[j].value.s;
+            size_t ny = strlen(y);
+            char *xy = malloc(nx + ny + 1);
+            memcpy(xy, x, nx);
+            memcpy(xy + nx, y, ny + 1);
+            strset_add(set, xy, nx + ny);
+            free(xy);
+        }
+    }
+    vector_free(left);
+    vector_free(right);
+    return set;
+}
+
+static Set *strset_singleton(const char *s)
+{
+    Set *set = strset_create();
+    strset_add(set, s, strlen(s));
+    return set;
+}
+
+/* Keeps at most MAX_SET strings by cutting them to 2 bytes, then to none */
+static Set *strset_trim(Set *set, bool prefix)
+{
+    if (set->size <= MAX_SET)
+        return set;
+    Set *trimmed = strset_create();
+    for (int b = 0; b < set->capacity; b++) {
+        for (Entry *e = set->array[b]; e != NULL; e = e->next) {
+            char *s = e->key.value.s;
+            size_t n = strlen(s);
+            if (n <= 2)
+                strset_add(trimmed, s, n);
+            else
+                strset_add(trimmed, prefix ? s : s + n - 2, 2);
+        }
+    }
+    strset_free(set);
+    if (trimmed->size <= MAX_SET)
+        return trimmed;
+    strset_free(trimmed);
+    return strset_singleton("");
+}
+
+uint32_t trigram_pack(const char *s)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    return (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2];
+}
+
+static Query *query_create(QueryOp op)
+{
+    Query *q = calloc(1, sizeof(Query));
+    q->op = op;
+    return q;
+}
+
+static void query_append(Query *q, Query *arg)
+{
+    q->args = realloc(q->args, (q->size + 1) * sizeof(Query *));
+    q->args[q->size++] = arg;
+}
+
+/* Builds a op b, simplifying QueryAll and flattening nested ops */
+static Query *query_combine(QueryOp op, Query *a, Query *b)
+{
+    if (a->op == QueryAll || b->op == QueryAll) {
+        Query *all = a->op == QueryAll ? a : b, *other = all == a ? b : a;
+        if (op == QueryAnd) {
+            query_free(all);
+            return other;
+        }
+        query_free(other);
+        return all;
+    }
+    Query *q = query_create(op);
+    Query *args[] = {a, b};
+    for (int i = 0; i < 2; i++) {
+        if (args[i]->op == op) {
+            for (int j = 0; j < args[i]->size; j++)
+                query_append(q, args[i]->args[j]);
+            free(args[i]->args);
+            free(args[i]);
+        } else
+            query_append(q, args[i]);
+    }
+    return q;
+}
+
+/* Trigrams of s, all of them must be present */
+static Query *query_string(const char *s)
+{
+    Query *q = query_create(QueryAll);
+    size_t n = strlen(s);
+    for (size_t i = 0; i + 3 <= n; i++) {
+        Query *t = query_create(QueryTrigram);
+        t->trigram = trigram_pack(s + i);
+        q = query_combine(QueryAnd, q, t);
+    }
+    return q;
+}
+
+/* Query satisfied by any string containing one of the strings of set */
+static Query *query_strings(Set *set)
+{
+    Query *q = NULL;
+    for (int b = 0; b < set->capacity; b++) {
+        for (Entry *e = set->array[b]; e != NULL; e = e->next) {
+            Query *s = query_string(e->key.value.s);
+            q = q == NULL ? s : query_combine(QueryOr, q, s);
+        }
+    }
+    return q == NULL ? query_create(QueryAll) : q;
+}
+
+static Set *info_prefix(Info *info)
+{
+    return info->exact != NULL ? info->exact : info->prefix;
+}
+
+static Set *info_suffix(Info *info)
+{
+    return info->exact != NULL ? info->exact : info->suffix;
+}
+
+static void info_free(Info *info)
+{
+    strset_free(info->exact);
+    strset_free(info->prefix);
+    strset_free(info->suffix);
+    if (info->match != NULL)
+        query_free(info->match);
+}
+
+/* Info of a node matching any string but only its own: prefix/suffix "" */
+static Info info_unknown(bool emptyable)
+{
+    Info info = {emptyable, NULL, strset_singleton(""), strset_singleton(""),
+                 query_create(QueryAll)};
+    return info;
+}
+
+/* Moves the exact set of info into its prefix, suffix and match */
+static void info_forget_exact(Info *info)
+{
+    if (info->exact == NULL)
+        return;
+    strset_free(info->prefix);
+    strset_free(info->suffix);
+    info->prefix = strset_trim(strset_union(info->exact, info->exact), true);
+    info->suffix = strset_trim(strset_union(info->exact, info->exact), false);
+    info->match = query_combine(QueryAnd, info->match, query_strings(info->exact));
+    strset_free(info->exact);
+    info->exact = NULL;
+}
+
+static Info analyze(AST *ast);
+
+static Info analyze_concat(AST *ast)
+{
+    Info a = analyze(ast->childs.a[0]), b = analyze(ast->childs.a[1]);
+    Info info = {a.emptyable && b.emptyable, NULL, NULL, NULL, NULL};
+
+    if (a.exact != NULL && b.exact != NULL
+        && a.exact->size * b.exact->size <= MAX_EXACT) {
+        info.exact = strset_cross(a.exact, b.exact);
+        info.match = query_combine(QueryAnd, a.match, b.match);
+        a.match = b.match = NULL;
+        info_free(&a);
+        info_free(&b);
+        return info;
+    }
+    // Strings spanning the boundary between a and b
+    Set *suffix = info_suffix(&a), *prefix = info_prefix(&b);
+    Query *boundary = query_create(QueryAll);
+    if (suffix->size * prefix->size <= MAX_CROSS) {
+        Set *cross = strset_cross(suffix, prefix);
+        boundary = query_combine(QueryAnd, boundary, query_strings(cross));
+        strset_free(cross);
+    }
+    info.prefix = a.exact != NULL ? strset_cross(a.exact, prefix)
+                                  : strset_union(a.prefix, a.prefix);
+    info.suffix = b.exact != NULL ? strset_cross(suffix, b.exact)
+                                  : strset_union(b.suffix, b.suffix);
+    info.prefix = strset_trim(info.prefix, true);
+    info.suffix = strset_trim(info.suffix, false);
+
+    info_forget_exact(&a);
+    info_forget_exact(&b);
+    info.match = query_combine(QueryAnd, a.match, b.match);
+    info.match = query_combine(QueryAnd, info.match, boundary);
+    a.match = b.match = NULL;
+    info_free(&a);
+    info_free(&b);
+    return info;
+}
+
+static Info analyze_union(AST *ast)
+{
+    Info a = analyze(ast->childs.a[0]), b = analyze(ast->childs.a[1]);
+    Info info = {a.emptyable || b.emptyable, NULL, NULL, NULL, NULL};
+
+    if (a.exact != NULL && b.exact != NULL
+        && a.exact->size + b.exact->size <= MAX_EXACT) {
+        info.exact = strset_union(a.exact, b.exact);
+        info.match = query_combine(QueryOr, a.match, b.match);
+        a.match = b.match = NULL;
+    } else {
+        info_forget_exact(&a);
+        info_forget_exact(&b);
+        info.prefix = strset_trim(strset_union(a.prefix, b.prefix), true);
+        info.suffix = strset_trim(strset_union(a.suffix, b.suffix), false);
+        info.match = query_combine(QueryOr, a.match, b.match);
+        a.match = b.match = NULL;
+    }
+    info_free(&a);
+    info_free(&b);
+    return info;
+}
+
+static Info analyze(AST *ast)
+{
+    switch (ast->tag) {
+        case Epsilon: {
+            Info info = {true, strset_singleton(""), NULL, NULL, query_create(QueryAll)};
+            return info;
+        }
+        case CharGroup: {
+            if (ast->arity > MAX_EXACT)
+                return info_unknown(false);
+            Info info = {false, strset_create(), NULL, NULL, query_create(QueryAll)};
+            for (int i = 0; i < ast->arity; i++)
+                strset_add(info.exact, &ast->childs.c[i], 1);
+            return info;
+        }
+        case Unicode: {
+            if (ast->min != ast->max)
+                return info_unknown(false);
+            // A single character, exactly its UTF-8 bytes
+            unsigned char bytes[4];
+            int len = utf8_encode(ast->min, bytes);
+            Info info = {false, strset_create(), NULL, NULL, query_create(QueryAll)};
+            strset_add(info.exact, (const char *)bytes, len);
+            return info;
+        }
+        case Concat:
+            return analyze_concat(ast);
+        case Union:
+            return analyze_union(ast);
+        case Star:
+            return info_unknown(true);
+        case Repeat: {
+            if (ast->min == 0)
+                return info_unknown(true);
+            // Starts and ends like its first and last copy, holds their query
+            Info info = analyze(ast->childs.a[0]);
+            info_forget_exact(&info);
+            return info;
+        }
+        default:
+            fprintf(stderr, "Invalid AST tag");
+            exit(EXIT_FAILURE);
+    }
+}
+
+/* Query that every line matching ast satisfies */
+Query *trigram_query(AST *ast)
+{
+    Info info = analyze(ast);
+    info_forget_exact(&info);
+    Query *q = info.match;
+    info.match = NULL;
+    info_free(&info);
+    return q;
+}
+
+void query_print(Query *q, int indent)
+{
+    for (int i = 0; i < indent; i++)
+        printf("  ");
+    if (q->op == QueryTrigram) {
+        printf("%s %c%c%c\n", QUERY_OP_STR[q->op], (char)(q->trigram >> 16),
+               (char)(q->trigram >> 8), (char)q->trigram);
+        return;
+    }
+    printf("%s\n", QUERY_OP_STR[q->op]);
+    for (int i = 0; i < q->size; i++)
+        query_print(q->args[i], indent + 1);
+}
+
+void query_free(Query *q)
+{
+    for (int i = 0; i < q->size; i++)
+        query_free(q->args[i]);
+    free(q->args);
+    free(q);
+}
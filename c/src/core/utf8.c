@@ -0,0 +1,116 @@
+/**
+ * UTF-8 encoding of code points and of code point ranges. Surrogates and
+ * overlong forms are not valid UTF-8, so they are neither decoded nor
+ * produced by utf8_ranges.
+ */
+
+#include "utf8.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+const uint32_t UTF8_MAX = 0x10FFFF;
+
+static const uint32_t SURROGATE_FIRST = 0xD800, SURROGATE_LAST = 0xDFFF;
+
+// Last code point encoded in 1, 2 and 3 bytes
+static const uint32_t LAST_OF_LENGTH[] = {0x7F, 0x7FF, 0xFFFF};
+
+/* Length of the valid UTF-8 character at s, stored in *cp, or 0 */
+int utf8_decode(const char *s, uint32_t *cp)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    int len = 0;  // continuation bytes, and leads of overlong or too large ones
+    if (u[0] < 0x80)
+        len = 1;
+    else if (u[0] >= 0xC2 && u[0] < 0xF5)
+        len = u[0] < 0xE0 ? 2 : u[0] < 0xF0 ? 3 : 4;
+    if (len <= 1) {
+        *cp = u[0];
+        return len;
+    }
+    *cp = u[0] & (0x7F >> len);
+    for (int i = 1; i < len; i++) {
+        if ((u[i] & 0xC0) != 0x80)
+            return 0;
+        *cp = *cp << 6 | (u[i] & 0x3F);
+    }
+    if (*cp <= LAST_OF_LENGTH[len - 2] || *cp > UTF8_MAX
+        || (*cp >= SURROGATE_FIRST && *cp <= SURROGATE_LAST))
+        return 0;  // overlong, too large or a surrogate
+    return len;
+}
+
+/* Writes the 1 to 4 bytes of cp to s, returns their number */
+int utf8_encode(uint32_t cp, unsigned char *s)
+{
+    int len = 1;
+    while (len < 4 && cp > LAST_OF_LENGTH[len - 1])
+        len++;
+    if (len == 1) {
+        s[0] = cp;
+        return 1;
+    }
+    for (int i = len - 1; i > 0; i--) {
+        s[i] = 0x80 | (cp & 0x3F);
+        cp >>= 6;
+    }
+    s[0] = (0xF00 >> len & 0xFF) | cp;
+    return len;
+}
+
+typedef struct Ranges {
+    Utf8Range *array;
+    int count;
+} Ranges;
+
+/*
+ * Splits [lo, hi] until the first and last code points of every part are
+ * encoded with the same length and only differ in bytes where lo has its
+ * least and hi its greatest value: such a part is a single Utf8Range.
+ */
+static void split(Ranges *out, uint32_t lo, uint32_t hi)
+{
+    if (lo > hi)
+        return;
+    if (lo <= SURROGATE_LAST && hi >= SURROGATE_FIRST) {
+        split(out, lo, SURROGATE_FIRST - 1);
+        split(out, SURROGATE_LAST + 1, hi);
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (lo <= LAST_OF_LENGTH[i] && hi > LAST_OF_LENGTH[i]) {
+            split(out, lo, LAST_OF_LENGTH[i]);
+            split(out, LAST_OF_LENGTH[i] + 1, hi);
+            return;
+        }
+    }
+    for (int i = 1; i < 4; i++) {
+        uint32_t tail = (UINT32_C(1) << 6 * i) - 1;  // bits of the last i bytes
+        if ((lo & ~tail) == (hi & ~tail))
+            continue;
+        if ((lo & tail) != 0) {
+            split(out, lo, lo | tail);
+            split(out, (lo | tail) + 1, hi);
+            return;
+        }
+        if ((hi & tail) != tail) {
+            split(out, lo, (hi & ~tail) - 1);
+            split(out, hi & ~tail, hi);
+            return;
+        }
+    }
+    out->array = realloc(out->array, (out->count + 1) * sizeof(Utf8Range));
+    Utf8Range *range = &out->array[out->count++];
+    range->len = utf8_encode(lo, range->lo);
+    utf8_encode(hi, range->hi);
+}
+
+/* The byte ranges encoding the code points lo to hi, *count of them */
+Utf8Range *utf8_ranges(uint32_t lo, uint32_t hi, int *count)
+{
+    Ranges out = {NULL, 0};
+    split(&out, lo, hi > UTF8_MAX ? UTF8_MAX : hi);
+    *count = out.count;
+    return out.array;
+}
@@ -0,0 +1,323 @@
+/**
+ * Search daemon over a Unix socket. Compiled patterns are kept in an LRU
+ * cache, so a warm query only scans. Requests are:
+ *    - a header: number of strings and payload length, sent along with the
+ *      client's cwd, stdin, stdout and stderr descriptors (SCM_RIGHTS)
+ *    - a payload: the pattern then the files, each ending with a NUL
+ * and the answer is a single byte, the exit status of the search. Every
+ * worker thread accepts and serves its own connections.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memcpy, memset, strerror, strlen
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "parser.h"
+#include "search.h"
+#include "writer.h"
+
+const int DAEMON_CACHE_SIZE = 64;
+
+enum { DAEMON_FDS = 4 };  // cwd, stdin, stdout, stderr
+static const uint32_t DAEMON_MAX_PAYLOAD = 64 * 1024 * 1024;
+
+typedef struct Daemon {
+    int listener;
+    PatternCache *cache;
+} Daemon;
+
+// Ancillary data carrying the descriptors, aligned for cmsghdr
+typedef union Control {
+    char buf[CMSG_SPACE(DAEMON_FDS * sizeof(int))];
+    struct cmsghdr align;
+} Control;
+
+typedef struct Header {
+    uint32_t count;  // number of strings
+    uint32_t len;    // payload bytes
+} Header;
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_exactly(int fd, void *data, size_t len)
+{
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool socket_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "mygrep: %s: socket path too long\n", path);
+        return false;
+    }
+    memcpy(addr->sun_path, path, strlen(path) + 1);
+    return true;
+}
+
+static bool send_request(int sock, Header *header, const int *fds)
+{
+    Control control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {header, sizeof(Header)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(DAEMON_FDS * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, DAEMON_FDS * sizeof(int));
+    return sendmsg(sock, &msg, 0) == sizeof(Header);
+}
+
+static bool recv_request(int sock, Header *header, int *fds)
+{
+    Control control;
+    struct iovec iov = {header, sizeof(Header)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sock, &msg, 0) != sizeof(Header))
+        return false;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(DAEMON_FDS * sizeof(int)))
+        return false;
+    memcpy(fds, CMSG_DATA(cmsg), DAEMON_FDS * sizeof(int));
+    return true;
+}
+
+/* Searches a file relative to the client's working directory */
+static bool serve_file(Search *search, int cwd, const char *path)
+{
+    int fd = openat(cwd, path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(search->err, "mygrep: %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    bool ok = true;
+    if (st.st_size > 0) {
+        char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(search->err, "mygrep: %s: %s\n", path, strerror(errno));
+            ok = false;
+        } else {
+            ok = search_input(search, data, st.st_size, path);
+            munmap(data, st.st_size);
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/* Runs the search of a request, whose strings are the pattern then files */
+static bool serve_search(Daemon *d, char **strings, int count, const int *fds)
+{
+    FILE *err = fdopen(dup(fds[3]), "w");
+    if (err == NULL)
+        return false;
+    Writer *out = writer_create(fds[2]);
+    bool ok = true;
+    if (!parse_check(strings[0])) {
+        fprintf(err, "mygrep: %s: invalid postfix pattern\n", strings[0]);
+        ok = false;
+    } else {
+        CacheEntry *entry = cache_acquire(d->cache, strings[0]);
+        Search search = {entry->table, NULL, out, err, NULL, 1, NULL, NULL};
+        if (count == 1) {
+            FILE *in = fdopen(dup(fds[1]), "r");
+            size_t len;
+            char *text = read_all(in, &len);
+            fclose(in);
+            ok = search_input(&search, text, len, "(standard input)");
+            free(text);
+        }
+        for (int i = 1; i < count; i++) {
+            search.prefix = count > 2 ? strings[i] : NULL;
+            ok &= serve_file(&search, fds[0], strings[i]);
+        }
+        cache_release(d->cache, entry);
+    }
+    ok &= writer_sync(out);
+    writer_free(out);
+    fclose(err);
+    return ok;
+}
+
+/* Splits a payload into its NUL terminated strings, NULL if malformed */
+static char **split_payload(char *payload, Header *header)
+{
+    if (payload[header->len - 1] != '\0')
+        return NULL;
+    char **strings = malloc(header->count * sizeof(char *));
+    char *s = payload;
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (s >= payload + header->len) {
+            free(strings);
+            return NULL;
+        }
+        strings[i] = s;
+        s += strlen(s) + 1;
+    }
+    return strings;
+}
+
+static void serve(Daemon *d, int conn)
+{
+    Header header;
+    int fds[DAEMON_FDS];
+    if (!recv_request(conn, &header, fds))
+        return;
+
+    char *payload = NULL;
+    char **strings = NULL;
+    if (header.count > 0 && header.len > 0 && header.len <= DAEMON_MAX_PAYLOAD) {
+        payload = malloc(header.len);
+        if (read_exactly(conn, payload, header.len))
+            strings = split_payload(payload, &header);
+    }
+    uint8_t status = EXIT_FAILURE;
+    if (strings != NULL && serve_search(d, strings, header.count, fds))
+        status = EXIT_SUCCESS;
+    write_all(conn, &status, 1);
+
+    for (int i = 0; i < DAEMON_FDS; i++)
+        close(fds[i]);
+    free(strings);
+    free(payload);
+}
+
+static void *worker(void *arg)
+{
+    Daemon *d = arg;
+    for (;;) {
+        int conn = accept(d->listener, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("mygrep: accept");
+            return NULL;
+        }
+        serve(d, conn);
+        close(conn);
+    }
+}
+
+/* Serves requests with a pool of workers (one per CPU if 0), until an error */
+bool daemon_serve(const char *socket_path, int workers)
+{
+    if (workers <= 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr))
+        return false;
+    Daemon d = {socket(AF_UNIX, SOCK_STREAM, 0), cache_create(DAEMON_CACHE_SIZE)};
+    unlink(socket_path);  // left by a previous daemon
+    if (d.listener < 0 || bind(d.listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(d.listener, SOMAXCONN) != 0) {
+        perror(socket_path);
+        cache_free(d.cache);
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);  // clients may leave before their answer
+
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    for (int i = 1; i < workers; i++)
+        pthread_create(&threads[i], NULL, worker, &d);
+    worker(&d);
+    for (int i = 1; i < workers; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    close(d.listener);
+    cache_free(d.cache);
+    return false;
+}
+
+/*
+ * Runs a search on the daemon, which writes straight to our stdout and
+ * stderr. Returns its exit status, or -1 when no daemon is listening.
+ */
+int daemon_forward(const char *socket_path, const char *pattern, char **files,
+                   int nfiles)
+{
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr))
+        return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (sock >= 0)
+            close(sock);
+        return -1;
+    }
+
+    Header header = {nfiles + 1, strlen(pattern) + 1};
+    for (int i = 0; i < nfiles; i++)
+        header.len += strlen(files[i]) + 1;
+    char *payload = malloc(header.len), *p = payload;
+    memcpy(p, pattern, strlen(pattern) + 1);
+    p += strlen(pattern) + 1;
+    for (int i = 0; i < nfiles; i++) {
+        memcpy(p, files[i], strlen(files[i]) + 1);
+        p += strlen(files[i]) + 1;
+    }
+
+    int cwd = open(".", O_RDONLY);
+    int fds[] = {cwd, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    fflush(stdout);
+    uint8_t status = EXIT_FAILURE;
+    if (cwd < 0 || !send_request(sock, &header, fds)
+        || !write_all(sock, payload, header.len) || !read_exactly(sock, &status, 1))
+        fprintf(stderr, "mygrep: %s: daemon request failed\n", socket_path);
+    if (cwd >= 0)
+        close(cwd);
+    free(payload);
+    close(sock);
+    return status;
+}
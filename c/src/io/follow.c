@@ -0,0 +1,180 @@
+/**
+ * Follow mode over inotify. Each file is watched for writes, and its
+ * directory for the creation of a file with the same name, so that:
+ *    - appended bytes are read from the last offset, in chunks
+ *    - a file shrinking below that offset was truncated: it starts over
+ *    - a new inode at the path was rotated in: the old file is drained,
+ *      then the new one is read from its start
+ * The process blocks in read on the inotify descriptor while idle.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "follow.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // strcmp, strerror, strndup, strrchr
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const size_t FOLLOW_CHUNK_SIZE = 64 * 1024;
+
+static const uint32_t FILE_EVENTS = IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF
+                                    | IN_MOVE_SELF;
+static const uint32_t DIR_EVENTS = IN_CREATE | IN_MOVED_TO;
+
+typedef struct Followed {
+    const char *path;
+    const char *name;  // last component of path
+    int fd;            // -1 while the path does not exist
+    dev_t dev;
+    ino_t ino;
+    off_t offset;  // bytes already read
+    int wd;        // watch of the file
+    int dir_wd;    // watch of its directory
+} Followed;
+
+struct Follower {
+    int inotify;
+    Followed *files;
+    int count;
+    char *buffer;
+};
+
+/* Opens the file at path, positioned at its end or at its start */
+static void follow_open(Follower *f, Followed *file, bool at_end)
+{
+    file->fd = open(file->path, O_RDONLY);
+    if (file->fd < 0)
+        return;
+    struct stat st;
+    fstat(file->fd, &st);
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->offset = at_end ? st.st_size : 0;
+    file->wd = inotify_add_watch(f->inotify, file->path, FILE_EVENTS);
+}
+
+static void follow_close(Follower *f, Followed *file)
+{
+    if (file->wd >= 0)
+        inotify_rm_watch(f->inotify, file->wd);  // fails if already removed
+    close(file->fd);
+    file->fd = -1;
+    file->wd = -1;
+}
+
+/* Reads what was appended since the last offset */
+static void follow_read(Follower *f, int i, FollowFn fn, void *context)
+{
+    Followed *file = &f->files[i];
+    struct stat st;
+    if (fstat(file->fd, &st) != 0)
+        return;
+    if (st.st_size < file->offset) {
+        fn(FollowRestart, i, NULL, 0, context);
+        file->offset = 0;
+    }
+    ssize_t n;
+    while ((n = pread(file->fd, f->buffer, FOLLOW_CHUNK_SIZE, file->offset)) > 0) {
+        file->offset += n;
+        fn(FollowData, i, f->buffer, n, context);
+    }
+}
+
+/* Catches up with the file, switching to a new file rotated in at its path */
+static void follow_check(Follower *f, int i, FollowFn fn, void *context)
+{
+    Followed *file = &f->files[i];
+    if (file->fd >= 0)
+        follow_read(f, i, fn, context);
+
+    struct stat st;
+    if (stat(file->path, &st) != 0)
+        return;  // rotated out, the old file may still be written
+    if (file->fd >= 0 && st.st_dev == file->dev && st.st_ino == file->ino)
+        return;
+    if (file->fd >= 0) {
+        follow_close(f, file);
+        fn(FollowRestart, i, NULL, 0, context);
+    }
+    follow_open(f, file, false);
+    if (file->fd >= 0)
+        follow_read(f, i, fn, context);
+}
+
+/* Watches the files from their current end, NULL if inotify is unavailable */
+Follower *follower_create(char **paths, int count)
+{
+    int inotify = inotify_init();
+    if (inotify < 0)
+        return NULL;
+    Follower *f = calloc(1, sizeof(Follower));
+    f->inotify = inotify;
+    f->count = count;
+    f->files = calloc(count, sizeof(Followed));
+    f->buffer = malloc(FOLLOW_CHUNK_SIZE);
+
+    for (int i = 0; i < count; i++) {
+        Followed *file = &f->files[i];
+        file->path = paths[i];
+        file->wd = -1;
+        const char *slash = strrchr(paths[i], '/');
+        file->name = slash == NULL ? paths[i] : slash + 1;
+        char *dir = slash == NULL ? strndup(".", 1)
+                                  : strndup(paths[i], slash == paths[i] ? 1 : slash - paths[i]);
+        file->dir_wd = inotify_add_watch(inotify, dir, DIR_EVENTS);
+        if (file->dir_wd < 0)
+            fprintf(stderr, "mygrep: %s: %s\n", dir, strerror(errno));
+        free(dir);
+
+        follow_open(f, file, true);
+        if (file->fd < 0)
+            fprintf(stderr, "mygrep: %s: %s, waiting for it\n", file->path,
+                    strerror(errno));
+    }
+    return f;
+}
+
+/* Reports the appended data of the files until an error occurs */
+bool follower_run(Follower *f, FollowFn fn, void *context)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(f->inotify, events, sizeof(events));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("mygrep: inotify");
+            return false;
+        }
+        for (char *p = events; p < events + n;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            for (int i = 0; i < f->count; i++) {
+                Followed *file = &f->files[i];
+                if ((event->wd == file->wd && file->fd >= 0)
+                    || (event->wd == file->dir_wd && event->len > 0
+                        && strcmp(event->name, file->name) == 0))
+                    follow_check(f, i, fn, context);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+void follower_free(Follower *f)
+{
+    for (int i = 0; i < f->count; i++) {
+        if (f->files[i].fd >= 0)
+            follow_close(f, &f->files[i]);
+    }
+    close(f->inotify);
+    free(f->files);
+    free(f->buffer);
+    free(f);
+}
@@ -0,0 +1,712 @@
+/**
+ * Trigram index of a directory, stored in a single file:
+ *    header | files | blocks | trigrams | postings | strings
+ * Posting lists are sorted block ids, delta and varint encoded. The file
+ * is mapped in memory and only the posting lists of a query are decoded.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "index.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memcmp, memcpy, memchr, strcmp
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "inflater.h"
+#include "trigram.h"
+
+const char INDEX_FILENAME[] = ".mygrep.idx";
+const size_t INDEX_BLOCK_SIZE = 64 * 1024;
+static const size_t INDEX_RUN_PAIRS = 4 << 20;  // 32 MiB of pairs sorted in memory
+
+static const char INDEX_MAGIC[8] = "MGIDX01";
+static const uint32_t FILE_OPAQUE = 1;  // compressed: not indexed, always scanned
+
+typedef struct IndexHeader {
+    char magic[8];
+    uint32_t nfiles, nblocks, ntrigrams, pad;
+    uint64_t files, blocks, trigrams, postings, strings;  // offsets
+} IndexHeader;
+
+typedef struct FileEntry {
+    uint64_t path;  // offset in strings
+    uint64_t size;
+    int64_t mtime;
+    uint32_t flags;
+    uint32_t first_block;
+} FileEntry;
+
+typedef struct BlockEntry {
+    uint32_t file;
+    uint32_t len;
+    uint64_t offset;
+} BlockEntry;
+
+typedef struct TrigramEntry {
+    uint32_t trigram;
+    uint32_t count;   // number of blocks
+    uint64_t offset;  // in postings
+} TrigramEntry;
+
+struct Index {
+    char *dir;
+    void *map;
+    size_t len;
+    IndexHeader *header;
+    FileEntry *files;
+    BlockEntry *blocks;
+    TrigramEntry *trigrams;
+    const uint8_t *postings;
+    const char *strings;
+    int8_t *stale;  // by file: -1 unknown, 0 up to date, 1 changed
+};
+
+/**
+ * Growable byte buffer used to build the sections of the index.
+ */
+typedef struct Bytes {
+    char *data;
+    size_t len, capacity;
+} Bytes;
+
+static void bytes_append(Bytes *b, const void *data, size_t n)
+{
+    if (b->len + n > b->capacity) {
+        b->capacity = 2 * (b->len + n);
+        b->data = realloc(b->data, b->capacity);
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+static void bytes_varint(Bytes *b, uint32_t n)
+{
+    uint8_t buf[5];
+    int k = 0;
+    while (n >= 0x80) {
+        buf[k++] = (uint8_t)(n | 0x80);
+        n >>= 7;
+    }
+    buf[k++] = (uint8_t)n;
+    bytes_append(b, buf, k);
+}
+
+static char *path_join(const char *dir, const char *name)
+{
+    size_t n = strlen(dir), m = strlen(name);
+    char *path = malloc(n + m + 2);
+    memcpy(path, dir, n);
+    path[n] = '/';
+    memcpy(path + n + 1, name, m + 1);
+    return path;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Collects the regular files below dir/rel, hidden ones excluded */
+static void walk(const char *dir, const char *rel, char ***paths, int *count,
+                 int *capacity)
+{
+    char *path = rel[0] == '\0' ? strdup(dir) : path_join(dir, rel);
+    DIR *d = opendir(path);
+    if (d == NULL) {
+        fprintf(stderr, "mygrep: %s: %s\n", path, strerror(errno));
+        free(path);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char *child = rel[0] == '\0' ? strdup(entry->d_name)
+                                     : path_join(rel, entry->d_name);
+        char *full = path_join(dir, child);
+        struct stat st;
+        if (stat(full, &st) != 0)
+            fprintf(stderr, "mygrep: %s: %s\n", full, strerror(errno));
+        else if (S_ISDIR(st.st_mode))
+            walk(dir, child, paths, count, capacity);
+        else if (S_ISREG(st.st_mode)) {
+            if (*count == *capacity) {
+                *capacity = 2 * *capacity + 1;
+                *paths = realloc(*paths, *capacity * sizeof(char *));
+            }
+            (*paths)[(*count)++] = child;
+            child = NULL;
+        }
+        free(full);
+        free(child);
+    }
+    closedir(d);
+    free(path);
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    char *data = malloc(st.st_size + 1);
+    size_t n = 0;
+    ssize_t r;
+    while (n < (size_t)st.st_size
+           && (r = read(fd, data + n, st.st_size - n)) > 0)
+        n += r;
+    close(fd);
+    *len = n;
+    return data;
+}
+
+/* End of the block starting at start: whole lines, about INDEX_BLOCK_SIZE */
+static size_t block_end(const char *data, size_t start, size_t len)
+{
+    if (len - start <= INDEX_BLOCK_SIZE)
+        return len;
+    const char *limit = data + start + INDEX_BLOCK_SIZE;
+    for (const char *p = limit - 1; p >= data + start; p--) {
+        if (*p == '\n')
+            return p - data + 1;
+    }
+    const char *eol = memchr(limit, '\n', data + len - limit);
+    return eol == NULL ? len : (size_t)(eol - data + 1);
+}
+
+/* Appends (trigram, block) pairs for the distinct trigrams of a block */
+static void collect(const char *s, size_t n, uint32_t block, uint8_t *seen,
+                    uint64_t **pairs, size_t *count, size_t *capacity)
+{
+    size_t first = *count;
+    for (size_t i = 0; i + 3 <= n; i++) {
+        if (s[i] == '\n' || s[i + 1] == '\n' || s[i + 2] == '\n')
+            continue;
+        uint32_t t = trigram_pack(s + i);
+        if (seen[t >> 3] & (1 << (t & 7)))
+            continue;
+        seen[t >> 3] |= 1 << (t & 7);
+        if (*count == *capacity) {
+            *capacity = 2 * *capacity + 1024;
+            *pairs = realloc(*pairs, *capacity * sizeof(uint64_t));
+        }
+        (*pairs)[(*count)++] = (uint64_t)t << 32 | block;
+    }
+    for (size_t i = first; i < *count; i++) {  // clears only what was set
+        uint32_t t = (*pairs)[i] >> 32;
+        seen[t >> 3] = 0;
+    }
+}
+
+/**
+ * Sorted run of (trigram, block) pairs spilled to a temporary file, read
+ * back one buffer at a time while the runs are merged.
+ */
+typedef struct Run {
+    FILE *file;
+    uint64_t buffer[4096];
+    size_t pos, len;
+    uint64_t head;  // next pair, valid while the run is not exhausted
+} Run;
+
+/* Sorts the pairs and writes them to a new run, false on error */
+static bool run_flush(uint64_t *pairs, size_t count, Run ***runs, int *nruns)
+{
+    qsort(pairs, count, sizeof(uint64_t), compare_u64);
+    Run *run = malloc(sizeof(Run));
+    FILE *file = tmpfile();
+    if (run == NULL || file == NULL
+        || fwrite(pairs, sizeof(uint64_t), count, file) != count
+        || fseek(file, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "mygrep: cannot spill the index pairs: %s\n", strerror(errno));
+        if (file != NULL)
+            fclose(file);
+        free(run);
+        return false;
+    }
+    run->file = file;
+    run->pos = run->len = 0;
+    *runs = realloc(*runs, (*nruns + 1) * sizeof(Run *));
+    (*runs)[(*nruns)++] = run;
+    return true;
+}
+
+/* Moves to the next pair of the run, false when it is exhausted */
+static bool run_next(Run *run)
+{
+    if (run->pos == run->len) {
+        run->len = fread(run->buffer, sizeof(uint64_t), 4096, run->file);
+        run->pos = 0;
+        if (run->len == 0)
+            return false;
+    }
+    run->head = run->buffer[run->pos++];
+    return true;
+}
+
+/* Restores the min-heap of runs by head below slot i */
+static void runs_sift(Run **heap, int size, int i)
+{
+    for (;;) {
+        int least = i, left = 2 * i + 1, right = left + 1;
+        if (left < size && heap[left]->head < heap[least]->head)
+            least = left;
+        if (right < size && heap[right]->head < heap[least]->head)
+            least = right;
+        if (least == i)
+            return;
+        Run *run = heap[i];
+        heap[i] = heap[least];
+        heap[least] = run;
+        i = least;
+    }
+}
+
+/**
+ * Trigram entries and posting lists, built from the pairs in sorted order.
+ */
+typedef struct Postings {
+    Bytes trigrams, postings;
+    TrigramEntry entry;  // of the list being built, when count > 0
+    uint32_t previous;   // last block of the list
+} Postings;
+
+static void postings_end(Postings *p)
+{
+    if (p->entry.count > 0)
+        bytes_append(&p->trigrams, &p->entry, sizeof(p->entry));
+    p->entry.count = 0;
+}
+
+static void postings_add(Postings *p, uint64_t pair)
+{
+    uint32_t trigram = pair >> 32, block = (uint32_t)pair;
+    if (p->entry.count == 0 || p->entry.trigram != trigram) {
+        postings_end(p);
+        TrigramEntry entry = {trigram, 0, p->postings.len};
+        p->entry = entry;
+        p->previous = 0;
+    }
+    bytes_varint(&p->postings, block - p->previous);
+    p->previous = block;
+    p->entry.count++;
+}
+
+/* Merges the sorted runs into the postings, false on error */
+static bool runs_merge(Run **runs, int nruns, Postings *p)
+{
+    bool ok = true;
+    Run **heap = malloc((nruns + 1) * sizeof(Run *));
+    int size = 0;
+    for (int i = 0; i < nruns; i++) {
+        if (run_next(runs[i]))
+            heap[size++] = runs[i];
+    }
+    for (int i = size / 2 - 1; i >= 0; i--)
+        runs_sift(heap, size, i);
+    while (size > 0) {
+        postings_add(p, heap[0]->head);
+        if (!run_next(heap[0]))
+            heap[0] = heap[--size];
+        runs_sift(heap, size, 0);
+    }
+    for (int i = 0; i < nruns; i++) {
+        if (ferror(runs[i]->file)) {
+            fprintf(stderr, "mygrep: cannot read the index pairs back\n");
+            ok = false;
+        }
+    }
+    free(heap);
+    return ok;
+}
+
+/*
+ * Indexes the files below dir into dir/INDEX_FILENAME. The (trigram, block)
+ * pairs are sorted in runs of INDEX_RUN_PAIRS, spilled to temporary files
+ * once there is more than one, then merged into the posting lists.
+ */
+bool index_build(const char *dir)
+{
+    char **paths = NULL;
+    int nfiles = 0, capacity = 0;
+    walk(dir, "", &paths, &nfiles, &capacity);
+    qsort(paths, nfiles, sizeof(char *), compare_strings);
+
+    Bytes files = {0}, blocks = {0}, strings = {0};
+    Postings postings;
+    memset(&postings, 0, sizeof(postings));
+    uint8_t *seen = calloc(1 << 21, sizeof(uint8_t));  // one bit by trigram
+    uint64_t *pairs = NULL;
+    size_t npairs = 0, pairs_capacity = 0;
+    Run **runs = NULL;
+    int nruns = 0;
+    uint32_t nblocks = 0;
+    bool ok = true;
+
+    for (int i = 0; i < nfiles && ok; i++) {
+        char *full = path_join(dir, paths[i]);
+        struct stat st;
+        size_t len;
+        char *data = stat(full, &st) == 0 ? read_file(full, &len) : NULL;
+        free(full);
+        if (data == NULL) {
+            fprintf(stderr, "mygrep: %s: %s\n", paths[i], strerror(errno));
+            continue;
+        }
+        FileEntry file = {strings.len, st.st_size, st.st_mtime, 0, nblocks};
+        bytes_append(&strings, paths[i], strlen(paths[i]) + 1);
+        if (codec_detect(data, len) != CodecNone)
+            file.flags |= FILE_OPAQUE;
+
+        uint32_t id = files.len / sizeof(FileEntry);
+        for (size_t start = 0; start < len && !(file.flags & FILE_OPAQUE) && ok;) {
+            size_t end = block_end(data, start, len);
+            BlockEntry block = {id, (uint32_t)(end - start), start};
+            bytes_append(&blocks, &block, sizeof(block));
+            collect(data + start, end - start, nblocks++, seen, &pairs, &npairs,
+                    &pairs_capacity);
+            if (npairs >= INDEX_RUN_PAIRS) {
+                ok = run_flush(pairs, npairs, &runs, &nruns);
+                npairs = 0;
+            }
+            start = end;
+        }
+        if ((file.flags & FILE_OPAQUE) || len == 0) {  // one block for the file
+            BlockEntry block = {id, 0, 0};
+            bytes_append(&blocks, &block, sizeof(block));
+            nblocks++;
+        }
+        bytes_append(&files, &file, sizeof(file));
+        free(data);
+    }
+    free(seen);
+
+    if (nruns == 0) {  // all pairs fit in one run, merged from memory
+        qsort(pairs, npairs, sizeof(uint64_t), compare_u64);
+        for (size_t i = 0; i < npairs; i++)
+            postings_add(&postings, pairs[i]);
+    } else {
+        if (ok && npairs > 0)
+            ok = run_flush(pairs, npairs, &runs, &nruns);
+        if (ok)
+            ok = runs_merge(runs, nruns, &postings);
+        for (int i = 0; i < nruns; i++) {
+            fclose(runs[i]->file);
+            free(runs[i]);
+        }
+    }
+    postings_end(&postings);
+    free(pairs);
+    free(runs);
+    Bytes trigrams = postings.trigrams;
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.nfiles = files.len / sizeof(FileEntry);
+    header.nblocks = nblocks;
+    header.ntrigrams = trigrams.len / sizeof(TrigramEntry);
+    header.files = sizeof(header);
+    header.blocks = header.files + files.len;
+    header.trigrams = header.blocks + blocks.len;
+    header.postings = header.trigrams + trigrams.len;
+    header.strings = header.postings + postings.postings.len;
+
+    char *path = path_join(dir, INDEX_FILENAME);
+    if (ok) {  // a failed spill was reported
+        FILE *out = fopen(path, "wb");
+        ok = out != NULL;
+        if (ok) {
+            fwrite(&header, sizeof(header), 1, out);
+            Bytes *sections[] = {&files, &blocks, &trigrams, &postings.postings,
+                                 &strings};
+            for (int i = 0; i < 5; i++)
+                fwrite(sections[i]->data, 1, sections[i]->len, out);
+            ok = fclose(out) == 0;
+        }
+        if (!ok)
+            fprintf(stderr, "mygrep: %s: %s\n", path, strerror(errno));
+    }
+
+    free(path);
+    free(files.data);
+    free(blocks.data);
+    free(trigrams.data);
+    free(postings.postings.data);
+    free(strings.data);
+    for (int i = 0; i < nfiles; i++)
+        free(paths[i]);
+    free(paths);
+    return ok;
+}
+
+/* Maps the index of dir, NULL if there is none or it is invalid */
+Index *index_open(const char *dir)
+{
+    char *path = path_join(dir, INDEX_FILENAME);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    IndexHeader *header = map;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+        || header->strings > (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    Index *index = malloc(sizeof(Index));
+    char *base = map;
+    index->dir = strdup(dir);
+    index->map = map;
+    index->len = st.st_size;
+    index->header = header;
+    index->files = (FileEntry *)(base + header->files);
+    index->blocks = (BlockEntry *)(base + header->blocks);
+    index->trigrams = (TrigramEntry *)(base + header->trigrams);
+    index->postings = (const uint8_t *)(base + header->postings);
+    index->strings = base + header->strings;
+    index->stale = malloc(header->nfiles);
+    memset(index->stale, -1, header->nfiles);
+    return index;
+}
+
+int index_size(Index *index)
+{
+    return index->header->nblocks;
+}
+
+/* True when the file must be scanned whole: changed or compressed */
+static bool file_stale(Index *index, uint32_t id)
+{
+    if (index->stale[id] < 0) {
+        FileEntry *file = &index->files[id];
+        char *path = path_join(index->dir, index->strings + file->path);
+        struct stat st;
+        index->stale[id] = (file->flags & FILE_OPAQUE) || stat(path, &st) != 0
+                           || (uint64_t)st.st_size != file->size
+                           || (int64_t)st.st_mtime != file->mtime;
+        free(path);
+    }
+    return index->stale[id];
+}
+
+/**
+ * Sorted list of block ids, or every block when all is true.
+ */
+typedef struct List {
+    bool all;
+    uint32_t *ids;
+    int size;
+} List;
+
+static List list_trigram(Index *index, uint32_t trigram)
+{
+    List list = {false, NULL, 0};
+    int lo = 0, hi = (int)index->header->ntrigrams - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        TrigramEntry *entry = &index->trigrams[mid];
+        if (entry->trigram < trigram)
+            lo = mid + 1;
+        else if (entry->trigram > trigram)
+            hi = mid - 1;
+        else {
+            const uint8_t *p = index->postings + entry->offset;
+            uint32_t id = 0;
+            list.ids = malloc(entry->count * sizeof(uint32_t));
+            for (uint32_t i = 0; i < entry->count; i++) {
+                uint32_t delta = 0;
+                for (int shift = 0;; shift += 7) {
+                    delta |= (uint32_t)(*p & 0x7f) << shift;
+                    if (!(*p++ & 0x80))
+                        break;
+                }
+                id += delta;
+                list.ids[list.size++] = id;
+            }
+            break;
+        }
+    }
+    return list;
+}
+
+static List list_merge(List a, List b, bool intersect)
+{
+    if (a.all || b.all) {
+        List *all = a.all ? &a : &b, *other = all == &a ? &b : &a;
+        free(intersect ? all->ids : other->ids);
+        return intersect ? *other : *all;
+    }
+    List list = {false, malloc((a.size + b.size + 1) * sizeof(uint32_t)), 0};
+    int i = 0, j = 0;
+    while (i < a.size && j < b.size) {
+        if (a.ids[i] == b.ids[j]) {
+            list.ids[list.size++] = a.ids[i++];
+            j++;
+        } else if (a.ids[i] < b.ids[j]) {
+            if (!intersect)
+                list.ids[list.size++] = a.ids[i];
+            i++;
+        } else {
+            if (!intersect)
+                list.ids[list.size++] = b.ids[j];
+            j++;
+        }
+    }
+    for (; !intersect && i < a.size; i++)
+        list.ids[list.size++] = a.ids[i];
+    for (; !intersect && j < b.size; j++)
+        list.ids[list.size++] = b.ids[j];
+    free(a.ids);
+    free(b.ids);
+    return list;
+}
+
+static List evaluate(Index *index, Query *q)
+{
+    switch (q->op) {
+        case QueryTrigram:
+            return list_trigram(index, q->trigram);
+        case QueryAnd:
+        case QueryOr: {
+            List list = evaluate(index, q->args[0]);
+            for (int i = 1; i < q->size; i++) {
+                if (q->op == QueryAnd && !list.all && list.size == 0)
+                    break;
+                list = list_merge(list, evaluate(index, q->args[i]),
+                                  q->op == QueryAnd);
+            }
+            return list;
+        }
+        default: {
+            List all = {true, NULL, 0};
+            return all;
+        }
+    }
+}
+
+/*
+ * Ids of the blocks that may contain a line matching q, in order. Blocks of
+ * files that changed since indexing are always candidates; files created
+ * since are given by index_unindexed.
+ */
+uint32_t *index_candidates(Index *index, Query *q, int *count)
+{
+    List list = evaluate(index, q);
+    if (list.all) {
+        list.ids = malloc((index->header->nblocks + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < index->header->nblocks; i++)
+            list.ids[i] = i;
+        list.size = index->header->nblocks;
+    } else {
+        List stale = {false, malloc((index->header->nfiles + 1) * sizeof(uint32_t)), 0};
+        for (uint32_t i = 0; i < index->header->nfiles; i++) {
+            if (file_stale(index, i))
+                stale.ids[stale.size++] = index->files[i].first_block;
+        }
+        list = list_merge(list, stale, false);
+    }
+    *count = list.size;
+    return list.ids;
+}
+
+/* Whether the index holds the file at path, relative to the directory */
+static bool indexed(Index *index, const char *path)
+{
+    int lo = 0, hi = (int)index->header->nfiles - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int c = strcmp(index->strings + index->files[mid].path, path);
+        if (c == 0)
+            return true;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return false;
+}
+
+/*
+ * Sorted paths of the files below the directory that the index does not
+ * hold, created since indexing: no block of theirs is a candidate, so they
+ * must be scanned whole. Freed by the caller, as is every path.
+ */
+char **index_unindexed(Index *index, int *count)
+{
+    char **paths = NULL;
+    int n = 0, capacity = 0;
+    walk(index->dir, "", &paths, &n, &capacity);
+    qsort(paths, n, sizeof(char *), compare_strings);
+    *count = 0;
+    for (int i = 0; i < n; i++) {
+        if (indexed(index, paths[i]))
+            free(paths[i]);
+        else
+            paths[(*count)++] = paths[i];
+    }
+    return paths;
+}
+
+IndexBlock index_block(Index *index, uint32_t id)
+{
+    BlockEntry *block = &index->blocks[id];
+    IndexBlock b = {index->strings + index->files[block->file].path,
+                    file_stale(index, block->file), block->offset, block->len};
+    return b;
+}
+
+/* Reads a block, or its whole file when stale, NULL on error */
+char *index_load(Index *index, IndexBlock block, size_t *len)
+{
+    char *path = path_join(index->dir, block.path);
+    char *data = NULL;
+    if (block.stale)
+        data = read_file(path, len);
+    else {
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            data = malloc(block.len + 1);
+            ssize_t n = pread(fd, data, block.len, block.offset);
+            *len = n < 0 ? 0 : n;
+            close(fd);
+        }
+    }
+    free(path);
+    return data;
+}
+
+void index_close(Index *index)
+{
+    munmap(index->map, index->len);
+    free(index->stale);
+    free(index->dir);
+    free(index);
+}
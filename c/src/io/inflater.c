@@ -0,0 +1,281 @@
+/**
+ * Streaming decompression of gzip (zlib) and zstd inputs. A producer
+ * thread inflates into a ring of INFLATER_BUFFERS buffers while the
+ * consumer scans the previous ones, so both stages overlap.
+ */
+
+#include "inflater.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memcmp
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+const int INFLATER_BUFFERS = 4;
+const size_t INFLATER_BUFFER_SIZE = 256 * 1024;
+
+static const unsigned char GZIP_MAGIC[] = {0x1f, 0x8b};
+static const unsigned char ZSTD_MAGIC[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+struct Inflater {
+    const char *data;  // compressed input
+    size_t len;
+    size_t offset;  // consumed input
+    Codec codec;
+
+    char **buffers;
+    size_t *lens;
+    int head;   // next buffer to consume
+    int count;  // buffers ready to be consumed
+    bool finished;
+    bool stop;
+    const char *error;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+#ifdef HAVE_ZLIB
+    z_stream gz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+};
+
+Codec codec_detect(const char *data, size_t len)
+{
+    if (len >= sizeof(GZIP_MAGIC) && memcmp(data, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0)
+        return CodecGzip;
+    if (len >= sizeof(ZSTD_MAGIC) && memcmp(data, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0)
+        return CodecZstd;
+    return CodecNone;
+}
+
+bool codec_supported(Codec codec)
+{
+    switch (codec) {
+        case CodecNone:
+            return true;
+#ifdef HAVE_ZLIB
+        case CodecGzip:
+            return true;
+#endif
+#ifdef HAVE_ZSTD
+        case CodecZstd:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+#ifdef HAVE_ZLIB
+/* Inflates into out, following concatenated gzip members */
+static size_t fill_gzip(Inflater *z, char *out, size_t capacity, bool *end)
+{
+    z_stream *gz = &z->gz;
+    gz->next_out = (Bytef *)out;
+    gz->avail_out = capacity;
+
+    while (gz->avail_out > 0) {
+        if (gz->avail_in == 0) {
+            size_t n = z->len - z->offset;
+            gz->next_in = (Bytef *)z->data + z->offset;
+            gz->avail_in = n > UINT_MAX ? UINT_MAX : n;
+            z->offset += gz->avail_in;
+        }
+        int ret = inflate(gz, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            size_t rest = gz->avail_in + (z->len - z->offset);
+            if (codec_detect((const char *)gz->next_in, gz->avail_in) != CodecGzip
+                || rest == 0) {
+                *end = true;
+                break;
+            }
+            inflateReset(gz);
+        } else if (ret == Z_BUF_ERROR && gz->avail_in == 0) {
+            if (z->offset < z->len)
+                continue;
+            z->error = "unexpected end of compressed data";
+            *end = true;
+            break;
+        } else if (ret != Z_OK) {
+            z->error = gz->msg != NULL ? gz->msg : "invalid compressed data";
+            *end = true;
+            break;
+        }
+    }
+    return capacity - gz->avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static size_t fill_zstd(Inflater *z, char *out, size_t capacity, bool *end)
+{
+    ZSTD_outBuffer output = {out, capacity, 0};
+    while (output.pos < output.size) {
+        ZSTD_inBuffer input = {z->data, z->len, z->offset};
+        size_t ret = ZSTD_decompressStream(z->zstd, &output, &input);
+        z->offset = input.pos;
+        if (ZSTD_isError(ret)) {
+            z->error = ZSTD_getErrorName(ret);
+            *end = true;
+            break;
+        }
+        if (z->offset == z->len && output.pos < output.size) {
+            if (ret != 0)
+                z->error = "unexpected end of compressed data";
+            *end = true;
+            break;
+        }
+    }
+    return output.pos;
+}
+#endif
+
+static size_t fill(Inflater *z, char *out, size_t capacity, bool *end)
+{
+    switch (z->codec) {
+#ifdef HAVE_ZLIB
+        case CodecGzip:
+            return fill_gzip(z, out, capacity, end);
+#endif
+#ifdef HAVE_ZSTD
+        case CodecZstd:
+            return fill_zstd(z, out, capacity, end);
+#endif
+        default:
+            z->error = "compression format not supported";
+            *end = true;
+            return 0;
+    }
+}
+
+static void *producer(void *arg)
+{
+    Inflater *z = arg;
+    bool end = false;
+
+    while (!end) {
+        pthread_mutex_lock(&z->lock);
+        while (z->count == INFLATER_BUFFERS && !z->stop)
+            pthread_cond_wait(&z->cond, &z->lock);
+        int i = (z->head + z->count) % INFLATER_BUFFERS;
+        bool stop = z->stop;
+        pthread_mutex_unlock(&z->lock);
+        if (stop)
+            break;
+
+        // The buffer is not visible to the consumer until count is updated
+        size_t n = fill(z, z->buffers[i], INFLATER_BUFFER_SIZE, &end);
+
+        pthread_mutex_lock(&z->lock);
+        if (n > 0) {
+            z->lens[i] = n;
+            z->count++;
+        }
+        pthread_cond_broadcast(&z->cond);
+        pthread_mutex_unlock(&z->lock);
+    }
+    pthread_mutex_lock(&z->lock);
+    z->finished = true;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+    return NULL;
+}
+
+/* Starts decompressing data, which must outlive the inflater */
+Inflater *inflater_create(const char *data, size_t len, Codec codec)
+{
+    Inflater *z = calloc(1, sizeof(Inflater));
+    z->data = data;
+    z->len = len;
+    z->codec = codec;
+    z->buffers = malloc(INFLATER_BUFFERS * sizeof(char *));
+    z->lens = calloc(INFLATER_BUFFERS, sizeof(size_t));
+    for (int i = 0; i < INFLATER_BUFFERS; i++)
+        z->buffers[i] = malloc(INFLATER_BUFFER_SIZE);
+
+#ifdef HAVE_ZLIB
+    if (codec == CodecGzip && inflateInit2(&z->gz, 15 + 16) != Z_OK) {
+        fprintf(stderr, "Cannot initialize zlib.\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (codec == CodecZstd)
+        z->zstd = ZSTD_createDStream();
+#endif
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->cond, NULL);
+    pthread_create(&z->thread, NULL, producer, z);
+    return z;
+}
+
+/* Waits for the next decompressed buffer, NULL at the end of the input */
+const char *inflater_next(Inflater *z, size_t *len)
+{
+    pthread_mutex_lock(&z->lock);
+    while (z->count == 0 && !z->finished)
+        pthread_cond_wait(&z->cond, &z->lock);
+    const char *buffer = NULL;
+    if (z->count > 0) {
+        buffer = z->buffers[z->head];
+        *len = z->lens[z->head];
+    }
+    pthread_mutex_unlock(&z->lock);
+    return buffer;
+}
+
+/* Hands the buffer returned by inflater_next back to the producer */
+void inflater_release(Inflater *z)
+{
+    pthread_mutex_lock(&z->lock);
+    z->head = (z->head + 1) % INFLATER_BUFFERS;
+    z->count--;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+}
+
+/* Error message of a corrupted or truncated input, NULL if none */
+const char *inflater_error(Inflater *z)
+{
+    pthread_mutex_lock(&z->lock);
+    const char *error = z->finished ? z->error : NULL;
+    pthread_mutex_unlock(&z->lock);
+    return error;
+}
+
+void inflater_free(Inflater *z)
+{
+    pthread_mutex_lock(&z->lock);
+    z->stop = true;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+    pthread_join(z->thread, NULL);
+
+#ifdef HAVE_ZLIB
+    if (z->codec == CodecGzip)
+        inflateEnd(&z->gz);
+#endif
+#ifdef HAVE_ZSTD
+    if (z->codec == CodecZstd)
+        ZSTD_freeDStream(z->zstd);
+#endif
+    pthread_mutex_destroy(&z->lock);
+    pthread_cond_destroy(&z->cond);
+    for (int i = 0; i < INFLATER_BUFFERS; i++)
+        free(z->buffers[i]);
+    free(z->buffers);
+    free(z->lens);
+    free(z);
+}
@@ -0,0 +1,494 @@
+/**
+ * Reads a list of files ahead of the scanner, in chunks of a fixed size, with
+ * a bounded number of reads in flight into a pool of reusable aligned
+ * buffers:
+ *    - io_uring backend: one thread submits the reads and reaps completions
+ *    - Threads backend: a pool of threads doing blocking reads, used when
+ *      io_uring is not available
+ * File i is read through slot i % depth, which owns SLOT_BLOCKS buffers:
+ * its chunks are read one at a time, up to SLOT_BLOCKS ahead of the
+ * consumer, so depth files are read at once and memory stays bounded
+ * whatever their size. A slot is given to the next file once the chunks
+ * of its file were all released, so blocks are delivered in order.
+ */
+#define _GNU_SOURCE
+
+#include "reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memset
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+const int READER_DEFAULT_DEPTH = 8;
+const size_t READER_ALIGNMENT = 4096;
+const size_t READER_CHUNK_SIZE = 1 << 18;
+
+#define SLOT_BLOCKS 2  // buffers of a slot: one scanned while the next is read
+
+/**
+ * Submission and completion queues shared with the kernel.
+ */
+typedef struct Ring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned pending;  // queued but not yet submitted
+} Ring;
+
+/**
+ * A file being read. The counts only grow: blocks[filled % SLOT_BLOCKS] is
+ * the next one read, blocks[delivered % SLOT_BLOCKS] the next one given to
+ * reader_next, and blocks are released in the order they were delivered.
+ */
+typedef struct Slot {
+    int index;      // of its file, -1 when free
+    int fd;         // -1 until opened
+    off_t size;     // expected length, 0 when unknown (pipes)
+    uint64_t offset;  // of the next read
+    Block blocks[SLOT_BLOCKS];
+    int filled, delivered, released;
+    bool reading;   // blocks[filled % SLOT_BLOCKS] is being read
+    bool eof;       // the last block was read
+    struct iovec iov;
+} Slot;
+
+struct Reader {
+    char **paths;
+    int count;
+    int depth;
+    size_t chunk;  // capacity of every block
+    ReaderBackend backend;
+
+    Slot *slots;   // slots[i % depth]: file i
+    int started;   // files given a slot so far
+    int next;      // file of the next block returned by reader_next
+    bool stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t *threads;
+    int nthreads;
+    Ring ring;
+};
+
+/* Block being read in slot */
+static Block *reading_block(Slot *slot)
+{
+    return &slot->blocks[slot->filled % SLOT_BLOCKS];
+}
+
+/*
+ * Marks the next read of a file, the earliest first, and returns its slot,
+ * the lock being held. NULL when there is none to do.
+ */
+static Slot *pick(Reader *r)
+{
+    if (r->stop)
+        return NULL;
+    for (int i = r->next; i < r->count && i < r->next + r->depth; i++) {
+        Slot *slot = &r->slots[i % r->depth];
+        if (slot->index != i) {
+            if (i != r->started || slot->index >= 0)
+                return NULL;  // files start in order, once their slot is free
+            slot->index = r->started++;
+            slot->fd = -1;
+            slot->size = 0;
+            slot->offset = 0;
+            slot->filled = slot->delivered = slot->released = 0;
+            slot->eof = false;
+        }
+        if (slot->reading || slot->eof || slot->filled - slot->released == SLOT_BLOCKS)
+            continue;
+        Block *b = reading_block(slot);
+        b->index = i;
+        b->path = r->paths[i];
+        b->error = 0;
+        b->len = 0;
+        b->offset = slot->offset;
+        b->last = false;
+        slot->reading = true;
+        return slot;
+    }
+    return NULL;
+}
+
+/* Whether every file was read, the lock being held */
+static bool finished(Reader *r)
+{
+    if (r->stop)
+        return true;
+    if (r->started < r->count)
+        return false;
+    for (int k = 0; k < r->depth; k++) {
+        if (r->slots[k].index >= 0 && !r->slots[k].eof)
+            return false;
+    }
+    return true;
+}
+
+/* Publishes the block read in slot, closing the file after its last one */
+static void complete(Reader *r, Slot *slot)
+{
+    if (reading_block(slot)->last && slot->fd >= 0) {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    pthread_mutex_lock(&r->lock);
+    slot->eof = reading_block(slot)->last;
+    slot->filled++;
+    slot->reading = false;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Opens the file of slot on its first read, false on error */
+static bool open_slot(Slot *slot)
+{
+    Block *b = reading_block(slot);
+    struct stat st;
+    if (slot->fd >= 0)
+        return true;
+    slot->fd = open(b->path, O_RDONLY);
+    if (slot->fd < 0 || fstat(slot->fd, &st) < 0)
+        b->error = errno;
+    else if (S_ISDIR(st.st_mode))
+        b->error = EISDIR;
+    else {
+        slot->size = S_ISREG(st.st_mode) ? st.st_size : 0;
+        return true;
+    }
+    b->last = true;
+    return false;
+}
+
+/* Accounts for n bytes read into the block of slot, true when it is complete */
+static bool advance(Reader *r, Slot *slot, ssize_t n)
+{
+    Block *b = reading_block(slot);
+    if (n < 0) {
+        b->error = (int)-n;
+        b->last = true;
+        return true;
+    }
+    b->len += n;
+    slot->offset += n;
+    if (n == 0 || (slot->size > 0 && slot->offset >= (uint64_t)slot->size))
+        b->last = true;
+    return b->last || b->len == r->chunk;
+}
+
+/* Threads backend: each worker reads the next chunk with blocking reads */
+static void *worker(void *arg)
+{
+    Reader *r = arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        Slot *slot;
+        while ((slot = pick(r)) == NULL) {
+            if (finished(r)) {
+                pthread_mutex_unlock(&r->lock);
+                return NULL;
+            }
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        if (open_slot(slot)) {
+            Block *b = reading_block(slot);
+            for (;;) {
+                ssize_t n = read(slot->fd, b->data + b->len, r->chunk - b->len);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (advance(r, slot, n < 0 ? -errno : n))
+                    break;
+            }
+        }
+        complete(r, slot);
+        pthread_mutex_lock(&r->lock);
+    }
+}
+
+static int ring_setup(Ring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(Ring));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto Failure;
+    ring->cq_ptr = ring->sq_ptr;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto UnmapSq;
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto UnmapCq;
+
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+UnmapCq:
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+UnmapSq:
+    munmap(ring->sq_ptr, ring->sq_len);
+Failure:
+    close(ring->fd);
+    return -1;
+}
+
+static void ring_free(Ring *ring)
+{
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+}
+
+/* Queues a read filling the rest of the block of slot */
+static void ring_read(Reader *r, Slot *slot)
+{
+    Ring *ring = &r->ring;
+    Block *b = reading_block(slot);
+    unsigned tail = *ring->sq_tail, index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    slot->iov.iov_base = b->data + b->len;
+    slot->iov.iov_len = r->chunk - b->len;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = slot->fd;
+    sqe->off = slot->size > 0 ? slot->offset : (__u64)-1;  // pipes: current position
+    sqe->addr = (unsigned long)&slot->iov;
+    sqe->len = 1;
+    sqe->user_data = slot - r->slots;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+/* io_uring backend: keeps a read in flight for every slot that can take one */
+static void *uring_loop(void *arg)
+{
+    Reader *r = arg;
+    Ring *ring = &r->ring;
+    int inflight = 0;
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        Slot *slot;
+        while ((slot = pick(r)) != NULL) {
+            pthread_mutex_unlock(&r->lock);
+            if (open_slot(slot)) {
+                ring_read(r, slot);
+                inflight++;
+            } else
+                complete(r, slot);
+            pthread_mutex_lock(&r->lock);
+        }
+        if (inflight == 0) {
+            if (finished(r))
+                break;
+            pthread_cond_wait(&r->cond, &r->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        int n = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0)
+            ring->pending -= n;
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter");
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            slot = &r->slots[cqe->user_data];
+            int res = cqe->res;
+            head++;
+            __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+            if (res == -EINTR || res == -EAGAIN)
+                ring_read(r, slot);
+            else if (advance(r, slot, res)) {
+                inflight--;
+                complete(r, slot);
+            } else
+                ring_read(r, slot);
+        }
+        pthread_mutex_lock(&r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+static void free_slots(Reader *r)
+{
+    for (int k = 0; k < r->depth; k++) {
+        if (r->slots[k].fd >= 0)
+            close(r->slots[k].fd);
+        for (int j = 0; j < SLOT_BLOCKS; j++)
+            free(r->slots[k].blocks[j].data);
+    }
+    free(r->slots);
+}
+
+/*
+ * Starts reading paths in chunks of chunk bytes, READER_CHUNK_SIZE when 0,
+ * with depth files read at once. ReaderAuto uses io_uring when the kernel
+ * allows it. NULL when the buffers cannot be allocated.
+ */
+Reader *reader_create(char **paths, int count, int depth, ReaderBackend backend,
+                      size_t chunk)
+{
+    if (depth < 1)
+        depth = READER_DEFAULT_DEPTH;
+    if (chunk == 0)
+        chunk = READER_CHUNK_SIZE;
+    Reader *r = calloc(1, sizeof(Reader));
+    if (r == NULL)
+        return NULL;
+    r->paths = paths;
+    r->count = count;
+    r->depth = depth;
+    r->chunk = (chunk + READER_ALIGNMENT - 1) & ~(READER_ALIGNMENT - 1);
+    r->slots = calloc(depth, sizeof(Slot));
+    if (r->slots == NULL) {
+        free(r);
+        return NULL;
+    }
+    bool allocated = true;
+    for (int k = 0; k < depth; k++) {
+        r->slots[k].index = -1;
+        r->slots[k].fd = -1;
+        for (int j = 0; j < SLOT_BLOCKS; j++) {
+            void *data = NULL;
+            allocated &= posix_memalign(&data, READER_ALIGNMENT, r->chunk) == 0;
+            r->slots[k].blocks[j].data = data;
+        }
+    }
+    if (!allocated) {
+        free_slots(r);
+        free(r);
+        return NULL;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    if (backend != ReaderThreads && ring_setup(&r->ring, depth) == 0) {
+        r->backend = ReaderUring;
+        r->nthreads = 1;
+        r->threads = malloc(sizeof(pthread_t));
+        pthread_create(&r->threads[0], NULL, uring_loop, r);
+    } else {
+        r->backend = ReaderThreads;
+        r->nthreads = depth < count ? depth : (count > 0 ? count : 1);
+        r->threads = malloc(r->nthreads * sizeof(pthread_t));
+        for (int i = 0; i < r->nthreads; i++)
+            pthread_create(&r->threads[i], NULL, worker, r);
+    }
+    return r;
+}
+
+ReaderBackend reader_backend(Reader *r)
+{
+    return r->backend;
+}
+
+/* Waits for the next chunk in order, NULL after the last one */
+Block *reader_next(Reader *r)
+{
+    pthread_mutex_lock(&r->lock);
+    Slot *slot = NULL;
+    while (r->next < r->count) {
+        slot = &r->slots[r->next % r->depth];
+        if (slot->index == r->next && slot->delivered < slot->filled)
+            break;
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+
+    Block *b = NULL;
+    if (r->next < r->count) {
+        b = &slot->blocks[slot->delivered++ % SLOT_BLOCKS];
+        if (b->last)
+            r->next++;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return b;
+}
+
+/*
+ * Gives the buffer of a block returned by reader_next back to the pool.
+ * The blocks of a file are released in the order they were returned.
+ */
+void reader_release(Reader *r, Block *block)
+{
+    pthread_mutex_lock(&r->lock);
+    Slot *slot = &r->slots[block->index % r->depth];
+    slot->released++;
+    if (slot->eof && slot->released == slot->filled)
+        slot->index = -1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void reader_free(Reader *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->stop = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    for (int i = 0; i < r->nthreads; i++)
+        pthread_join(r->threads[i], NULL);
+    if (r->backend == ReaderUring)
+        ring_free(&r->ring);
+
+    free_slots(r);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r->threads);
+    free(r);
+}
@@ -0,0 +1,200 @@
+/**
+ * Scan of inputs, plain or compressed, whole or chunk by chunk, printing
+ * the matching lines.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "search.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>  // memcpy, memset, strlen
+
+#include "histogram.h"
+#include "inflater.h"
+#include "probe.h"
+#include "scanner.h"
+#include "table.h"
+#include "writer.h"
+
+/* Reads a whole stream into a buffer of *len bytes */
+char *read_all(FILE *file, size_t *len)
+{
+    size_t capacity = 1 << 16;
+    char *buffer = malloc(capacity);
+    *len = 0;
+
+    size_t n;
+    while ((n = fread(buffer + *len, 1, capacity - *len, file)) > 0) {
+        *len += n;
+        if (*len == capacity)
+            buffer = realloc(buffer, capacity *= 2);
+    }
+    return buffer;
+}
+
+/*
+ * Prints a matching line, as the ScanFn of a Search. The line is added
+ * with the newline following it, so that consecutive matching lines form
+ * a single slice when there is no prefix.
+ */
+bool search_print(const char *head, size_t head_len, const char *line,
+                  size_t len, uint64_t offset, void *context)
+{
+    (void)offset;
+    Search *s = context;
+    if (s->prefix != NULL) {
+        writer_add(s->out, s->prefix, strlen(s->prefix));
+        writer_add(s->out, ":", 1);
+    }
+    writer_copy(s->out, head, head_len);
+    if (line != NULL)
+        writer_add(s->out, line, len + 1);
+    else
+        writer_add(s->out, "\n", 1);
+    return true;
+}
+
+/* Feeds a buffer to a scanner printing to s, timed when s keeps latencies */
+void search_feed(Search *s, Scanner *scanner, const char *data, size_t len)
+{
+    PROBE1(chunk_start, len);
+    uint64_t start = s->chunk_latency != NULL ? clock_ns() : 0;
+    scanner_feed(scanner, data, len, search_print, s);
+    if (s->chunk_latency != NULL)
+        histogram_record(s->chunk_latency, clock_ns() - start);
+    PROBE1(chunk_end, len);
+}
+
+/* Prints the matching lines of text */
+void search_text(Search *s, const char *text, size_t len)
+{
+    Scanner *scanner = scanner_create(s->table, s->counts);
+    scanner->threads = s->threads;
+    search_feed(s, scanner, text, len);
+    scanner_finish(scanner, search_print, s);
+    scanner_free(scanner);
+    writer_sync(s->out);
+}
+
+/* Same as search_text on the output of the inflater, one buffer at a time */
+static bool search_inflate(Search *s, Inflater *z, const char *name)
+{
+    Scanner *scanner = scanner_create(s->table, s->counts);
+    scanner->threads = s->threads;
+    const char *buffer;
+    size_t len;
+    while ((buffer = inflater_next(z, &len)) != NULL) {
+        search_feed(s, scanner, buffer, len);
+        writer_sync(s->out);  // the buffer is reused
+        inflater_release(z);
+    }
+    scanner_finish(scanner, search_print, s);
+    scanner_free(scanner);
+    writer_sync(s->out);
+
+    const char *error = inflater_error(z);
+    if (error != NULL)
+        fprintf(s->err, "mygrep: %s: %s\n", name, error);
+    return error == NULL;
+}
+
+static bool search_codec(Search *s, const char *data, size_t len, const char *name)
+{
+    Codec codec = codec_detect(data, len);
+    if (codec == CodecNone) {
+        search_text(s, data, len);
+        return true;
+    }
+    if (!codec_supported(codec)) {
+        fprintf(s->err, "mygrep: %s: %s input is not supported by this build\n",
+                name, CODEC_STR[codec]);
+        return false;
+    }
+    Inflater *z = inflater_create(data, len, codec);
+    bool ok = search_inflate(s, z, name);
+    inflater_free(z);
+    return ok;
+}
+
+/* Scans data, decompressing it first when it starts with a known magic */
+bool search_input(Search *s, const char *data, size_t len, const char *name)
+{
+    PROBE2(scan_start, name, len);
+    uint64_t start = s->file_latency != NULL ? clock_ns() : 0;
+    bool ok = search_codec(s, data, len, name);
+    if (s->file_latency != NULL)
+        histogram_record(s->file_latency, clock_ns() - start);
+    PROBE3(scan_end, name, len, ok);
+    return ok;
+}
+
+/* Starts the scan of an input whose chunks are then fed in order */
+void search_stream_begin(SearchStream *st, Search *s, const char *name)
+{
+    memset(st, 0, sizeof(SearchStream));
+    st->search = s;
+    st->name = name;
+    st->ok = true;
+    PROBE2(scan_start, name, 0);
+    st->start = s->file_latency != NULL ? clock_ns() : 0;
+}
+
+/* Appends a chunk to the gathered compressed input, false when out of memory */
+static bool gather(SearchStream *st, const char *data, size_t len)
+{
+    if (st->len + len > st->capacity) {
+        size_t capacity = 2 * (st->len + len);
+        char *gathered = realloc(st->gathered, capacity);
+        if (gathered == NULL)
+            return false;
+        st->gathered = gathered;
+        st->capacity = capacity;
+    }
+    memcpy(st->gathered + st->len, data, len);
+    st->len += len;
+    return true;
+}
+
+/* Scans the next chunk, whose buffer may be reused once this returns */
+void search_stream_feed(SearchStream *st, const char *data, size_t len)
+{
+    Search *s = st->search;
+    if (st->scanner == NULL && !st->compressed) {
+        st->compressed = codec_detect(data, len) != CodecNone;
+        if (!st->compressed) {
+            st->scanner = scanner_create(s->table, s->counts);
+            st->scanner->threads = s->threads;
+        }
+    }
+    if (st->compressed) {
+        if (st->ok && !gather(st, data, len)) {
+            fprintf(s->err, "mygrep: %s: out of memory\n", st->name);
+            st->ok = false;
+        }
+        return;
+    }
+    search_feed(s, st->scanner, data, len);
+    writer_sync(s->out);
+    st->len += len;
+}
+
+/* Ends the scan, false when it failed */
+bool search_stream_end(SearchStream *st)
+{
+    Search *s = st->search;
+    if (st->compressed && st->ok)
+        st->ok = search_codec(s, st->gathered, st->len, st->name);
+    if (st->scanner != NULL) {
+        scanner_finish(st->scanner, search_print, s);
+        scanner_free(st->scanner);
+        writer_sync(s->out);
+    }
+    free(st->gathered);
+    if (s->file_latency != NULL)
+        histogram_record(s->file_latency, clock_ns() - st->start);
+    PROBE3(scan_end, st->name, st->len, st->ok);
+    return st->ok;
+}
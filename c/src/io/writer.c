@@ -0,0 +1,162 @@
+/**
+ * Gathered output. Slices are kept as pointers into the caller's buffers
+ * until writer_sync, and only the bytes the caller is about to reuse, such
+ * as the head of a line crossing chunks, are copied. Batches are written
+ * in order, small slices with writev and, on a pipe, large ones with
+ * vmsplice, so the bytes of the input are never formatted nor copied in
+ * user space.
+ */
+#define _GNU_SOURCE
+
+#include "writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>  // memcpy
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+const size_t WRITER_SPLICE_MIN = 64 * 1024;
+
+// Capacity asked for a pipe, so that a vmsplice call moves more than 64 KiB
+static const int PIPE_SIZE = 1 << 20;
+
+enum { BATCH = 1024 };  // slices per system call, the usual IOV_MAX
+
+// Pause between two checks that a pipe was drained
+static const struct timespec DRAIN_PAUSE = {0, 50 * 1000};
+
+struct Writer {
+    int fd;
+    bool pipe;     // large slices are vmspliced
+    bool spliced;  // since the last sync
+    int error;     // errno of the first failed write, nothing is written after
+    struct iovec iov[BATCH];
+    int count;
+    char **copies;  // made since the last sync
+    int ncopies;
+};
+
+Writer *writer_create(int fd)
+{
+    Writer *w = calloc(1, sizeof(Writer));
+    w->fd = fd;
+    struct stat st;
+    w->pipe = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    if (w->pipe)
+        fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);  // kept as is past pipe-max-size
+    return w;
+}
+
+/* Writes count slices whole, resuming after short writes */
+static void write_all(Writer *w, struct iovec *iov, int count, bool splice)
+{
+    while (count > 0 && w->error == 0) {
+        ssize_t n = splice ? vmsplice(w->fd, iov, count, 0) : writev(w->fd, iov, count);
+        if (n < 0 && errno == EINVAL && splice) {
+            w->pipe = splice = false;  // a pipe vmsplice does not take
+            continue;
+        }
+        if (n < 0) {
+            if (errno != EINTR)
+                w->error = errno;
+            continue;
+        }
+        for (; count > 0 && (size_t)n >= iov->iov_len; iov++, count--)
+            n -= iov->iov_len;
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static bool is_spliced(Writer *w, int i)
+{
+    return w->pipe && w->iov[i].iov_len >= WRITER_SPLICE_MIN;
+}
+
+/* Writes the batch, each run of slices with a single system call */
+static void flush(Writer *w)
+{
+    for (int i = 0, j; i < w->count; i = j) {
+        bool splice = is_spliced(w, i);
+        for (j = i + 1; j < w->count && is_spliced(w, j) == splice; j++)
+            ;
+        write_all(w, w->iov + i, j - i, splice);
+        w->spliced |= splice;
+    }
+    w->count = 0;
+}
+
+/* Waits until the reader has taken every byte from the pipe */
+static void drain(Writer *w)
+{
+    int pending;
+    while (w->error == 0 && ioctl(w->fd, FIONREAD, &pending) == 0 && pending > 0) {
+        struct pollfd p = {w->fd, POLLOUT, 0};
+        if (poll(&p, 1, 0) > 0 && (p.revents & POLLERR))
+            w->error = EPIPE;  // no reader left
+        else
+            nanosleep(&DRAIN_PAUSE, NULL);
+    }
+}
+
+/* Adds len bytes at data, which must stay unchanged until writer_sync */
+void writer_add(Writer *w, const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    if (w->count > 0) {
+        struct iovec *last = &w->iov[w->count - 1];
+        if ((const char *)last->iov_base + last->iov_len == data) {
+            last->iov_len += len;
+            return;
+        }
+    }
+    if (w->count == BATCH)
+        flush(w);
+    w->iov[w->count++] = (struct iovec){(void *)data, len};
+}
+
+/* Same, for bytes that the caller may change right away */
+void writer_copy(Writer *w, const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    char *copy = malloc(len);
+    memcpy(copy, data, len);
+    w->copies = realloc(w->copies, (w->ncopies + 1) * sizeof(char *));
+    w->copies[w->ncopies++] = copy;
+    writer_add(w, copy, len);
+}
+
+/*
+ * Writes every slice added, after which their buffers may be reused.
+ * False once a write failed.
+ */
+bool writer_sync(Writer *w)
+{
+    flush(w);
+    if (w->spliced)
+        drain(w);
+    w->spliced = false;
+    for (int i = 0; i < w->ncopies; i++)
+        free(w->copies[i]);
+    w->ncopies = 0;
+    return w->error == 0;
+}
+
+/* Syncs and frees the writer, leaving its descriptor open */
+void writer_free(Writer *w)
+{
+    writer_sync(w);
+    free(w->copies);
+    free(w);
+}
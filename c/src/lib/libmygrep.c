@@ -0,0 +1,347 @@
+/**
+ * Library entry points over the compiled transition table. The table is
+ * never written after mg_compile, so concurrent scans only share reads;
+ * everything that changes during a scan lives in the caller's MgScratch.
+ * An MgSet publishes a new pattern on every commit: the pointer is swapped
+ * atomically, and the old pattern is retired. A reader counts itself in
+ * acquiring while it loads the pointer and takes a reference, so once
+ * acquiring is seen at zero after a swap, every reader of the retired
+ * patterns holds its reference: that grace period ends when a commit or
+ * the last acquiring reader sees it, and the set then drops its own
+ * references. Neither writers nor readers ever wait for each other.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "libmygrep.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>  // memchr, memcpy
+
+#include "algorithm.h"
+#include "parser.h"
+#include "patternset.h"
+#include "scanner.h"
+#include "table.h"
+
+struct MgPattern {
+    Table *table;
+    int refs;  // holders of a pattern published by an MgSet
+};
+
+struct MgScratch {
+    const MgPattern *pattern;  // the one it was created from
+    Scanner *scanner;
+    char *line;  // matching line crossing chunks, made contiguous
+    size_t capacity;
+    bool failed;  // a scan stopped on an error, see mg_scratch_failed
+    MgLineFn fn;
+    void *context;
+};
+
+static const size_t SCRATCH_LINE_SIZE = 4096;  // first capacity of line
+
+struct MgSet {
+    PatternSet *patterns;
+    MgPattern *current;  // last committed, read without the lock
+    int acquiring;       // readers between loading current and counting
+    MgPattern **retired;  // replaced, waiting for the end of a grace period
+    int nretired;         // read without the lock
+    pthread_mutex_t lock;  // writers, and retired
+};
+
+static Construction construction_of(MgConstruction construction)
+{
+    return construction == MG_DERIVATIVES ? ConstructionDerivatives
+                                          : ConstructionThompson;
+}
+
+/* Compiles pattern, or returns NULL and sets *error when it is invalid */
+MgPattern *mg_compile(const char *pattern, const char **error)
+{
+    return mg_compile_with(pattern, MG_THOMPSON, error);
+}
+
+MgPattern *mg_compile_with(const char *pattern, MgConstruction construction,
+                           const char **error)
+{
+    if (pattern == NULL || !parse_check(pattern)) {
+        if (error != NULL)
+            *error = "invalid postfix pattern";
+        return NULL;
+    }
+    MgPattern *p = malloc(sizeof(MgPattern));
+    if (p == NULL) {
+        if (error != NULL)
+            *error = "out of memory";
+        return NULL;
+    }
+    p->table = regex_compile(pattern, construction_of(construction));
+    p->refs = 1;
+    return p;
+}
+
+void mg_free(MgPattern *p)
+{
+    if (p == NULL)
+        return;
+    table_free(p->table);
+    free(p);
+}
+
+/* Whether the whole buffer is accepted, newlines included */
+bool mg_match(const MgPattern *p, const char *s, size_t n)
+{
+    return table_accept(p->table, s, n);
+}
+
+/*
+ * Matches count strings at once, setting bit i of results (an array of
+ * (count + 63) / 64 words) when strings[i] is accepted. Faster than a loop
+ * over mg_match on short strings, whose walks are interleaved.
+ */
+void mg_match_batch(const MgPattern *p, const char *const *strings,
+                    const size_t *lengths, size_t count, uint64_t *results)
+{
+    table_accept_batch(p->table, strings, lengths, count, results);
+}
+
+/* Bounds of the first matching line of s, the newline excluded */
+bool mg_find(const MgPattern *p, const char *s, size_t n, size_t *start,
+             size_t *end)
+{
+    const char *text = s, *stop = s + n;
+    while (text < stop) {
+        const char *eol = memchr(text, '\n', stop - text);
+        size_t len = (eol == NULL ? stop : eol) - text;
+        if (mg_match(p, text, len)) {
+            *start = text - s;
+            *end = *start + len;
+            return true;
+        }
+        text += len + 1;
+    }
+    return false;
+}
+
+/* Scratch of a scanning thread over p, NULL when out of memory */
+MgScratch *mg_scratch_create(const MgPattern *p)
+{
+    MgScratch *scratch = calloc(1, sizeof(MgScratch));
+    if (scratch == NULL)
+        return NULL;
+    scratch->pattern = p;
+    scratch->line = malloc(SCRATCH_LINE_SIZE);
+    scratch->capacity = SCRATCH_LINE_SIZE;
+    if (scratch->line == NULL) {
+        free(scratch);
+        return NULL;
+    }
+    scratch->scanner = scanner_create(p->table, NULL);
+    return scratch;
+}
+
+void mg_scratch_free(MgScratch *scratch)
+{
+    if (scratch == NULL)
+        return;
+    scanner_free(scratch->scanner);
+    free(scratch->line);
+    free(scratch);
+}
+
+/* Joins the head of a line crossing chunks to its rest before calling back */
+static bool scratch_line(const char *head, size_t head_len, const char *line,
+                         size_t len, uint64_t offset, void *context)
+{
+    MgScratch *scratch = context;
+    if (head_len > 0) {
+        if (head_len + len > scratch->capacity) {
+            char *grown = realloc(scratch->line, 2 * (head_len + len));
+            if (grown == NULL) {
+                scratch->failed = true;
+                return false;
+            }
+            scratch->line = grown;
+            scratch->capacity = 2 * (head_len + len);
+        }
+        memcpy(scratch->line, head, head_len);
+        if (len > 0)
+            memcpy(scratch->line + head_len, line, len);
+        line = scratch->line;
+        len += head_len;
+    }
+    return scratch->fn(line, len, offset, scratch->context);
+}
+
+/*
+ * Feeds the next chunk of a stream and calls fn on the lines it completes.
+ * p must be the pattern of the scratch. Returns false when fn asked to stop,
+ * or when mg_scratch_failed then tells the scan failed.
+ */
+bool mg_scan(const MgPattern *p, MgScratch *scratch, const char *s, size_t n,
+             MgLineFn fn, void *context)
+{
+    if (p != scratch->pattern || scratch->failed) {
+        scratch->failed = true;
+        return false;
+    }
+    scratch->fn = fn;
+    scratch->context = context;
+    return scanner_feed(scratch->scanner, s, n, scratch_line, scratch);
+}
+
+/* Reports the last line when the stream does not end with a newline */
+bool mg_scan_end(const MgPattern *p, MgScratch *scratch, MgLineFn fn,
+                 void *context)
+{
+    if (p != scratch->pattern || scratch->failed) {
+        scratch->failed = true;
+        return false;
+    }
+    scratch->fn = fn;
+    scratch->context = context;
+    return scanner_finish(scratch->scanner, scratch_line, scratch);
+}
+
+/*
+ * Whether a scan stopped on an error rather than by fn: a line crossing
+ * chunks that could not be joined for lack of memory, or a pattern other
+ * than the one of the scratch. The scratch then refuses further scans.
+ */
+bool mg_scratch_failed(const MgScratch *scratch)
+{
+    return scratch->failed;
+}
+
+/* Empty set, NULL when out of memory */
+MgSet *mg_set_create(void)
+{
+    MgSet *set = calloc(1, sizeof(MgSet));
+    if (set == NULL)
+        return NULL;
+    set->patterns = patternset_create();
+    pthread_mutex_init(&set->lock, NULL);
+    if (!mg_set_commit(set)) {
+        mg_set_free(set);
+        return NULL;
+    }
+    return set;
+}
+
+/*
+ * Adds a pattern, seen by readers after the next commit. Returns its id, or
+ * -1 and sets *error when it is invalid.
+ */
+int mg_set_add(MgSet *set, const char *pattern, const char **error)
+{
+    return mg_set_add_with(set, pattern, MG_THOMPSON, error);
+}
+
+int mg_set_add_with(MgSet *set, const char *pattern, MgConstruction construction,
+                    const char **error)
+{
+    if (pattern == NULL || !parse_check(pattern)) {
+        if (error != NULL)
+            *error = "invalid postfix pattern";
+        return -1;
+    }
+    pthread_mutex_lock(&set->lock);
+    int id = patternset_add(set->patterns, pattern, construction_of(construction));
+    pthread_mutex_unlock(&set->lock);
+    return id;
+}
+
+/* Removes the pattern id after the next commit, false when there is none */
+bool mg_set_remove(MgSet *set, int id)
+{
+    pthread_mutex_lock(&set->lock);
+    bool removed = patternset_remove(set->patterns, id);
+    pthread_mutex_unlock(&set->lock);
+    return removed;
+}
+
+/*
+ * Drops the references of the set to the retired patterns when no reader
+ * is acquiring, with the lock held. The patterns were retired before
+ * acquiring was read, so their readers all counted themselves.
+ */
+static void end_grace_period(MgSet *set)
+{
+    if (set->nretired == 0 || __atomic_load_n(&set->acquiring, __ATOMIC_SEQ_CST) > 0)
+        return;
+    for (int i = 0; i < set->nretired; i++)
+        mg_set_release(set->retired[i]);
+    __atomic_store_n(&set->nretired, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Compiles the union of the patterns and publishes it. Only the unions on
+ * the paths of the patterns changed since the last commit are rebuilt.
+ * Returns false when out of memory, the last commit staying published.
+ */
+bool mg_set_commit(MgSet *set)
+{
+    pthread_mutex_lock(&set->lock);
+    MgPattern *p = malloc(sizeof(MgPattern));
+    MgPattern **retired =
+        realloc(set->retired, (set->nretired + 1) * sizeof(MgPattern *));
+    if (retired != NULL)
+        set->retired = retired;
+    if (p == NULL || retired == NULL) {
+        free(p);
+        pthread_mutex_unlock(&set->lock);
+        return false;
+    }
+    p->table = patternset_compile(set->patterns);
+    p->refs = 1;
+    MgPattern *old = __atomic_exchange_n(&set->current, p, __ATOMIC_SEQ_CST);
+    if (old != NULL) {
+        set->retired[set->nretired] = old;
+        __atomic_store_n(&set->nretired, set->nretired + 1, __ATOMIC_SEQ_CST);
+    }
+    end_grace_period(set);
+    pthread_mutex_unlock(&set->lock);
+    return true;
+}
+
+/*
+ * The last committed pattern, valid until given to mg_set_release. A
+ * scratch belongs to the pattern it was created from.
+ */
+MgPattern *mg_set_acquire(MgSet *set)
+{
+    __atomic_add_fetch(&set->acquiring, 1, __ATOMIC_SEQ_CST);
+    MgPattern *p = __atomic_load_n(&set->current, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&p->refs, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_sub_fetch(&set->acquiring, 1, __ATOMIC_SEQ_CST) == 0
+        && __atomic_load_n(&set->nretired, __ATOMIC_SEQ_CST) > 0
+        && pthread_mutex_trylock(&set->lock) == 0) {  // else a later call ends it
+        end_grace_period(set);
+        pthread_mutex_unlock(&set->lock);
+    }
+    return p;
+}
+
+void mg_set_release(MgPattern *p)
+{
+    if (__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        mg_free(p);
+}
+
+/* Frees the set; the patterns still acquired stay valid until released */
+void mg_set_free(MgSet *set)
+{
+    if (set == NULL)
+        return;
+    for (int i = 0; i < set->nretired; i++)
+        mg_set_release(set->retired[i]);
+    free(set->retired);
+    if (set->current != NULL)
+        mg_set_release(set->current);
+    patternset_free(set->patterns);
+    pthread_mutex_destroy(&set->lock);
+    free(set);
+}
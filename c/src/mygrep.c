@@ -1,23 +1,478 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>  // printf
 #include <stdlib.h>
-#include <string.h>  // strlen
+#include <string.h>  // strcmp, strerror
+#include <unistd.h>  // STDOUT_FILENO
 
 #include "algorithm.h"
+#include "approx.h"
 #include "automaton.h"
+#include "codegen.h"
+#include "daemon.h"
+#include "follow.h"
+#include "histogram.h"
+#include "index.h"
 #include "parser.h"
+#include "reader.h"
+#include "scanner.h"
+#include "search.h"
+#include "speculate.h"
+#include "table.h"
+#include "trigram.h"
+#include "writer.h"
 
-int main(int argc, char* argv[])
+static const int MAX_JOBS = 1024;      // --jobs
+static const int MAX_IO_DEPTH = 4096;  // --io-depth, an io_uring queue
+
+static const char USAGE[] =
+    "Usage: mygrep [options] <pattern> [file...]\n"
+    "       mygrep [options] -e <pattern> [--and|--or|--not] -e ... [file...]\n"
+    "       mygrep index <dir>\n"
+    "       mygrep daemon <socket>\n"
+    "  --emit-c <prefix>       write a C matcher to <prefix>.c, .h and .mk\n"
+    "  --daemon <socket>       run the search on the daemon listening on <socket>\n"
+    "  -F, --follow            report the lines appended to the files\n"
+    "  -k <n>                  match the lines within n edits of the pattern\n"
+    "  -e <pattern>            a pattern of a combination, --or by default\n"
+    "  --and, --or, --not      join the next pattern, or negate it (and not)\n"
+    "  -v                      print the lines that do not match\n"
+    "  -i                      ignore the case of letters\n"
+    "  --index <dir>           search the files indexed in <dir>\n"
+    "  --profile-states <out>  write per-state visit counts to <out>\n"
+    "  --state-layout <in>     number states by the visit counts of <in>\n"
+    "  --io-depth <n>          number of files read ahead (default 8)\n"
+    "  --io <backend>          auto, io_uring or threads\n"
+    "  --construction <name>   thompson (default) or derivatives, to build the DFA\n"
+    "  --jobs <n>              threads walking each line of 1 MiB or more\n"
+    "  --latency               print scan latencies on exit and on SIGUSR1\n";
+
+typedef struct Options {
+    char* pattern;
+    char** files;
+    int nfiles;
+    char* profile_out;  // --profile-states
+    char* layout_in;    // --state-layout
+    int io_depth;
+    ReaderBackend io_backend;
+    Construction construction;
+    char* index_dir;  // --index
+    char* daemon;     // --daemon
+    char* emit_c;     // --emit-c
+    bool follow;
+    int jobs;    // --jobs
+    int errors;  // -k
+    Clause* clauses;  // -e, or the pattern
+    int nclauses;
+    bool invert;  // -v
+    bool fold;    // -i
+    bool latency;  // --latency
+} Options;
+
+static void usage(void)
 {
-    AST* ast = parse(".*");
-    ast_print(ast, 0);
-    NFA* nfa = thompson(ast);
-    if (nfa_accept(nfa, "a"))
-        printf("Accepted\n");
-    else
-        printf("Rejected\n");
+    fputs(USAGE, stderr);
+    exit(EXIT_FAILURE);
+}
+
+/* Value of a numeric option, which must be an integer in [min, max] */
+static int parse_count(const char* arg, int min, int max)
+{
+    char* end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || value < min || value > max)
+        usage();
+    return (int)value;
+}
+
+static Options parse_options(int argc, char* argv[])
+{
+    Options opts = {NULL, NULL, 0, NULL, NULL, READER_DEFAULT_DEPTH, ReaderAuto,
+                    ConstructionThompson, NULL, NULL, NULL, false, 1, 0, NULL, 0, false,
+                    false, false};
+    Clause next = {NULL, false, BoolOr};  // the next -e
+    bool joined = false;                  // by --and, --or or --not
+    int i = 1;
+    for (; i < argc
+           && (strncmp(argv[i], "--", 2) == 0 || strcmp(argv[i], "-F") == 0
+               || strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-e") == 0
+               || strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "-i") == 0);
+         i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-F") == 0 || strcmp(argv[i], "--follow") == 0)
+            opts.follow = true;
+        else if (strcmp(argv[i], "-v") == 0)
+            opts.invert = true;
+        else if (strcmp(argv[i], "-i") == 0)
+            opts.fold = true;
+        else if (strcmp(argv[i], "--latency") == 0)
+            opts.latency = true;
+        else if (strcmp(argv[i], "--and") == 0 || strcmp(argv[i], "--or") == 0) {
+            next.op = strcmp(argv[i], "--and") == 0 ? BoolAnd : BoolOr;
+            joined = true;
+        } else if (strcmp(argv[i], "--not") == 0) {
+            if (!joined)
+                next.op = BoolAnd;  // A --not -e B is A and not B
+            next.negated = true;
+            joined = true;
+        } else if (i + 1 >= argc)
+            usage();
+        else if (strcmp(argv[i], "--profile-states") == 0)
+            opts.profile_out = argv[++i];
+        else if (strcmp(argv[i], "--state-layout") == 0)
+            opts.layout_in = argv[++i];
+        else if (strcmp(argv[i], "--index") == 0)
+            opts.index_dir = argv[++i];
+        else if (strcmp(argv[i], "--daemon") == 0)
+            opts.daemon = argv[++i];
+        else if (strcmp(argv[i], "--emit-c") == 0)
+            opts.emit_c = argv[++i];
+        else if (strcmp(argv[i], "-e") == 0) {
+            next.pattern = argv[++i];
+            opts.clauses = realloc(opts.clauses, (opts.nclauses + 1) * sizeof(Clause));
+            opts.clauses[opts.nclauses++] = next;
+            next = (Clause){NULL, false, BoolOr};
+            joined = false;
+        } else if (strcmp(argv[i], "-k") == 0)
+            opts.errors = parse_count(argv[++i], 0, APPROX_MAX_ERRORS);
+        else if (strcmp(argv[i], "--jobs") == 0)
+            opts.jobs = parse_count(argv[++i], 1, MAX_JOBS);
+        else if (strcmp(argv[i], "--io-depth") == 0)
+            opts.io_depth = parse_count(argv[++i], 1, MAX_IO_DEPTH);
+        else if (strcmp(argv[i], "--io") == 0) {
+            char* name = argv[++i];
+            if (strcmp(name, READER_BACKEND_STR[ReaderUring]) == 0)
+                opts.io_backend = ReaderUring;
+            else if (strcmp(name, READER_BACKEND_STR[ReaderThreads]) == 0)
+                opts.io_backend = ReaderThreads;
+            else if (strcmp(name, READER_BACKEND_STR[ReaderAuto]) != 0)
+                usage();
+        } else if (strcmp(argv[i], "--construction") == 0) {
+            char* name = argv[++i];
+            if (strcmp(name, CONSTRUCTION_STR[ConstructionDerivatives]) == 0)
+                opts.construction = ConstructionDerivatives;
+            else if (strcmp(name, CONSTRUCTION_STR[ConstructionThompson]) != 0)
+                usage();
+        } else
+            usage();
+    }
+    if (joined)
+        usage();
+    if (opts.nclauses == 0) {
+        if (i >= argc)
+            usage();
+        opts.clauses = malloc(sizeof(Clause));
+        opts.clauses[opts.nclauses++] = (Clause){argv[i++], false, BoolOr};
+    }
+    opts.pattern = (char*)opts.clauses[0].pattern;
+    opts.files = &argv[i];
+    opts.nfiles = argc - i;
+    return opts;
+}
+
+/* Renumbers the states of table from a profile written by --profile-states */
+static void load_layout(Table* table, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t* counts = table_read_counts(file, table);
+    fclose(file);
+    if (counts == NULL) {
+        fprintf(stderr, "%s: profile does not match the pattern.\n", path);
+        return;
+    }
+    table_reorder(table, counts);
+    free(counts);
+}
+
+static void save_profile(Table* table, const uint64_t* counts, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    table_write_counts(file, table, counts);
+    fclose(file);
+}
+
+/*
+ * Scans the files chunk by chunk while the reader loads the next chunks,
+ * false on errors. With --jobs, a chunk holds a segment per thread.
+ */
+static bool mygrep_files(Search* search, Options* opts)
+{
+    size_t chunk = opts->jobs > 1 ? opts->jobs * SPECULATE_MIN_SEGMENT : 0;
+    Reader* reader = reader_create(opts->files, opts->nfiles, opts->io_depth,
+                                   opts->io_backend, chunk);
+    if (reader == NULL) {
+        fprintf(stderr, "mygrep: cannot allocate the read buffers\n");
+        return false;
+    }
+    bool ok = true;
+    SearchStream stream;
+    Block* block;
+    while ((block = reader_next(reader)) != NULL) {
+        if (block->offset == 0) {
+            search->prefix = opts->nfiles > 1 ? block->path : NULL;
+            search_stream_begin(&stream, search, block->path);
+        }
+        if (block->error != 0) {
+            fprintf(stderr, "mygrep: %s: %s\n", block->path, strerror(block->error));
+            ok = false;
+        } else
+            search_stream_feed(&stream, block->data, block->len);
+        if (block->last)
+            ok &= search_stream_end(&stream);
+        reader_release(reader, block);
+    }
+    reader_free(reader);
+    return ok;
+}
+
+/* Scans only the indexed blocks that may contain a match */
+/* Scans a file missing from the index whole, as a stale one */
+static bool mygrep_unindexed(Search* search, Index* index, const char* path)
+{
+    IndexBlock block = {path, true, 0, 0};
+    size_t len;
+    char* data = index_load(index, block, &len);
+    if (data == NULL) {
+        fprintf(stderr, "mygrep: %s: cannot read file\n", path);
+        return false;
+    }
+    search->prefix = path;
+    bool ok = search_input(search, data, len, path);
+    free(data);
+    return ok;
+}
+
+static bool mygrep_index(Search* search, Options* opts)
+{
+    Index* index = index_open(opts->index_dir);
+    if (index == NULL) {
+        fprintf(stderr, "mygrep: %s: no valid index, run mygrep index %s\n",
+                opts->index_dir, opts->index_dir);
+        return false;
+    }
+    AST* ast = opts->fold ? parse_fold(opts->pattern) : parse(opts->pattern);
+    Query* query = trigram_query(ast);
     ast_free(ast);
-    DFA* dfa = brzozowski(nfa_determinize(nfa));
-    nfa_free(nfa, true);
-    dfa_free(dfa, true);
-    return 0;
-}
\ No newline at end of file
+    int count;
+    uint32_t* ids = index_candidates(index, query, &count);
+    query_free(query);
+    int nnew;
+    char** created = index_unindexed(index, &nnew);  // scanned in path order
+
+    bool ok = true;
+    const char* scanned = NULL;  // last stale file, scanned whole
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        IndexBlock block = index_block(index, ids[i]);
+        if (block.stale && block.path == scanned)
+            continue;
+        for (; next < nnew && strcmp(created[next], block.path) < 0; next++)
+            ok &= mygrep_unindexed(search, index, created[next]);
+        size_t len;
+        char* data = index_load(index, block, &len);
+        if (data == NULL) {
+            fprintf(stderr, "mygrep: %s: cannot read indexed file\n", block.path);
+            ok = false;
+            continue;
+        }
+        search->prefix = block.path;
+        if (block.stale) {
+            ok &= search_input(search, data, len, block.path);
+            scanned = block.path;
+        } else
+            search_text(search, data, len);
+        free(data);
+    }
+    for (; next < nnew; next++)
+        ok &= mygrep_unindexed(search, index, created[next]);
+    for (int i = 0; i < nnew; i++)
+        free(created[i]);
+    free(created);
+    free(ids);
+    index_close(index);
+    return ok;
+}
+
+/* Scanners of the followed files, each resuming where its last chunk ended */
+typedef struct Followers {
+    Search* search;
+    Scanner** scanners;
+    char** prefixes;
+} Followers;
+
+static void mygrep_follow_event(FollowEvent event, int file, const char* data,
+                                size_t len, void* context)
+{
+    Followers* followers = context;
+    Scanner* scanner = followers->scanners[file];
+    followers->search->prefix = followers->prefixes[file];
+    if (event == FollowRestart)
+        scanner_finish(scanner, search_print, followers->search);
+    else
+        search_feed(followers->search, scanner, data, len);
+    writer_sync(followers->search->out);
+}
+
+/* Reports the lines appended to the files until interrupted */
+static bool mygrep_follow(Search* search, Options* opts)
+{
+    Follower* follower = follower_create(opts->files, opts->nfiles);
+    if (follower == NULL) {
+        perror("mygrep: inotify");
+        return false;
+    }
+    Followers followers = {search, calloc(opts->nfiles, sizeof(Scanner*)), NULL};
+    followers.prefixes = opts->nfiles > 1 ? opts->files : calloc(1, sizeof(char*));
+    for (int i = 0; i < opts->nfiles; i++) {
+        followers.scanners[i] = scanner_create(search->table, search->counts);
+        followers.scanners[i]->threads = search->threads;
+    }
+
+    bool ok = follower_run(follower, mygrep_follow_event, &followers);
+
+    for (int i = 0; i < opts->nfiles; i++)
+        scanner_free(followers.scanners[i]);
+    free(followers.scanners);
+    if (opts->nfiles == 1)
+        free(followers.prefixes);
+    follower_free(follower);
+    return ok;
+}
+
+// Scan latencies per file and per chunk, with --latency
+static Histogram* latencies[2];
+
+static void print_latencies(void)
+{
+    for (int i = 0; i < 2; i++)
+        histogram_print(stderr, latencies[i]);
+}
+
+/* Prints the latencies on every SIGUSR1, which the other threads block */
+static void* print_on_signal(void* context)
+{
+    sigset_t* set = context;
+    int signal;
+    while (sigwait(set, &signal) == 0)
+        print_latencies();
+    return NULL;
+}
+
+static void watch_latencies(void)
+{
+    static sigset_t set;
+    latencies[0] = histogram_create("file scans");
+    latencies[1] = histogram_create("chunk scans");
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);  // inherited by the threads created next
+    pthread_t thread;
+    pthread_create(&thread, NULL, print_on_signal, &set);
+    pthread_detach(thread);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "index") == 0)
+        return index_build(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (argc == 3 && strcmp(argv[1], "daemon") == 0)
+        return daemon_serve(argv[2], 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    Options opts = parse_options(argc, argv);
+    bool combined = opts.nclauses > 1 || opts.clauses[0].negated || opts.invert;
+    if ((opts.errors > 0 || combined) && (opts.index_dir != NULL || opts.daemon != NULL))
+        usage();  // both look for the exact pattern
+    if (opts.fold && opts.daemon != NULL)
+        usage();  // its cache is keyed by the pattern alone
+    if (opts.errors > 0 && combined)
+        usage();
+    if (opts.daemon != NULL) {
+        // The request only holds the pattern and the files
+        if (opts.follow || opts.index_dir != NULL || opts.profile_out != NULL
+            || opts.layout_in != NULL || opts.emit_c != NULL || opts.latency
+            || opts.jobs != 1 || opts.construction != ConstructionThompson
+            || opts.io_backend != ReaderAuto || opts.io_depth != READER_DEFAULT_DEPTH)
+            usage();
+        int status = daemon_forward(opts.daemon, opts.pattern, opts.files, opts.nfiles);
+        if (status >= 0) {
+            free(opts.clauses);
+            return status;
+        }
+        // No daemon: search locally
+    }
+    for (int i = 0; i < opts.nclauses; i++) {
+        if (!parse_check(opts.clauses[i].pattern)) {
+            fprintf(stderr, "mygrep: %s: invalid postfix pattern\n",
+                    opts.clauses[i].pattern);
+            free(opts.clauses);
+            return EXIT_FAILURE;
+        }
+    }
+    Table* table = opts.errors > 0
+                       ? regex_compile_approx(opts.pattern, opts.errors, opts.fold)
+                       : regex_compile_clauses(opts.clauses, opts.nclauses, opts.invert,
+                                               opts.fold, opts.construction);
+    free(opts.clauses);
+    if (table == NULL) {
+        fprintf(stderr, "mygrep: %s: more than %d positions for -k\n", opts.pattern,
+                APPROX_MAX_POSITIONS);
+        return EXIT_FAILURE;
+    }
+    if (opts.layout_in != NULL)
+        load_layout(table, opts.layout_in);
+    if (opts.emit_c != NULL) {
+        bool ok = codegen_emit(table, opts.pattern, opts.emit_c);
+        table_free(table);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    uint64_t* counts = NULL;
+    if (opts.profile_out != NULL)
+        counts = calloc(table->size, sizeof(uint64_t));
+
+    if (opts.latency)
+        watch_latencies();
+    Writer* out = writer_create(STDOUT_FILENO);
+    Search search = {table, counts, out, stderr, NULL, opts.jobs, latencies[0], latencies[1]};
+    bool ok = true;
+    if (opts.follow) {
+        if (opts.nfiles == 0)
+            usage();
+        ok = mygrep_follow(&search, &opts);
+    } else if (opts.index_dir != NULL)
+        ok = mygrep_index(&search, &opts);
+    else if (opts.nfiles == 0) {
+        size_t len;
+        char* text = read_all(stdin, &len);
+        ok = search_input(&search, text, len, "(standard input)");
+        free(text);
+    } else
+        ok = mygrep_files(&search, &opts);
+
+    ok &= writer_sync(out);
+    writer_free(out);
+    if (opts.latency)
+        print_latencies();
+    if (counts != NULL) {
+        save_profile(table, counts, opts.profile_out);
+        free(counts);
+    }
+    table_free(table);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -22,7 +22,7 @@ const float HASHTABLE_GROWTH_FACTOR = 2;
 
 static inline int hash_int(int capacity, int key)
 {
-    return (int)(capacity * key * 1.61803398875) % capacity;
+    return (int)(((unsigned int)key * 2654435761u) % (unsigned int)capacity);
 }
 
 static int hash_string(int capacity, char* key)
@@ -70,7 +70,7 @@ static int bucket(int capacity, MultiType key)
         case IntType:
             return hash_int(capacity, key.value.i);
         case CharType:
-            return (int)key.value.c % capacity;
+            return (unsigned char)key.value.c % capacity;
         case StringType:
             return hash_string(capacity, key.value.s);
         case HtblType:
@@ -138,6 +138,8 @@ HashTable* hashtable_create(int capacity)
         fprintf(stderr, "Capacity must be a positive integer. \n");
         exit(EXIT_FAILURE);
     }
+    if (capacity == 0)
+        capacity = 1;
     HashTable* h = (HashTable*)malloc(sizeof(HashTable));
     h->capacity = capacity;
     h->size = 0;
@@ -196,7 +198,7 @@ void hashtable_remove(HashTable* h, MultiType key)
         free(entry);
         h->size--;
     }
-    if (h->size < (1 - HASHTABLE_LOAD_FACTOR) * h->capacity)
+    if (h->capacity > 2 && h->size < (1 - HASHTABLE_LOAD_FACTOR) * h->capacity)
         hashtable_resize(h, ceil(h->capacity / HASHTABLE_GROWTH_FACTOR));
 }
 
@@ -239,12 +241,11 @@ void hashtable_print(HashTable* h)
     }
 }
 
-/* Performs a shallow copy */
+/* Performs a shallow copy (entries are duplicated, keys and values are not) */
 HashTable* hashtable_copy(HashTable* h)
 {
     HashTable* h_copy = hashtable_create(h->capacity);
-    h_copy->size = h->size;
-    memcpy(h_copy->array, h->array, h->capacity * sizeof(Entry*));
+    hashtable_update(h_copy, h);
     return h_copy;
 }
 
@@ -0,0 +1,93 @@
+/**
+ * Log-linear latency histograms, read while other threads record.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "histogram.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const double PERCENTILES[] = {50, 90, 99, 99.9};
+
+Histogram *histogram_create(const char *name)
+{
+    Histogram *h = calloc(1, sizeof(Histogram));
+    h->name = name;
+    return h;
+}
+
+static int bucket_of(uint64_t ns)
+{
+    if (ns >> HISTOGRAM_SUB_BITS == 0)
+        return ns;
+    int exponent = 63 - __builtin_clzll(ns);  // at least HISTOGRAM_SUB_BITS
+    int sub = ns >> (exponent - HISTOGRAM_SUB_BITS) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return (exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS | sub;
+}
+
+/* Highest value of the bucket */
+static uint64_t bucket_max(int bucket)
+{
+    if (bucket >> HISTOGRAM_SUB_BITS == 0)
+        return bucket;
+    int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(bucket & ((1 << HISTOGRAM_SUB_BITS) - 1))
+                   | 1 << HISTOGRAM_SUB_BITS;
+    return ((low + 1) << shift) - 1;
+}
+
+void histogram_record(Histogram *h, uint64_t ns)
+{
+    __atomic_add_fetch(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ns > max
+           && !__atomic_compare_exchange_n(&h->max, &max, ns, true, __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED))
+        ;
+}
+
+/* Upper bound of the bucket holding the given percentile, 0 when empty */
+uint64_t histogram_percentile(const Histogram *h, double percentile)
+{
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    uint64_t rank = (uint64_t)(percentile / 100 * count + 0.5), seen = 0;
+    if (rank == 0)
+        rank = 1;
+    for (int b = 0; b < HISTOGRAM_BUCKETS && count > 0; b++) {
+        seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+            return bucket_max(b) < max ? bucket_max(b) : max;
+        }
+    }
+    return 0;
+}
+
+/* Prints the count, percentiles and maximum on a line */
+void histogram_print(FILE *file, const Histogram *h)
+{
+    fprintf(file, "mygrep: %s: %llu", h->name,
+            (unsigned long long)__atomic_load_n(&h->count, __ATOMIC_RELAXED));
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(double); i++)
+        fprintf(file, " p%g %.3f ms", PERCENTILES[i],
+                histogram_percentile(h, PERCENTILES[i]) / 1e6);
+    fprintf(file, " max %.3f ms\n", __atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1e6);
+}
+
+void histogram_free(Histogram *h)
+{
+    free(h);
+}
+
+/* Monotonic time in nanoseconds */
+uint64_t clock_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
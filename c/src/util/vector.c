@@ -21,6 +21,8 @@ static void vector_resize(Vector *v, int new_capacity)
         fprintf(stderr, "Capacity must be greater than vector size.\n");
         exit(EXIT_FAILURE);
     }
+    if (new_capacity < 1)
+        new_capacity = 1;
     v->array = realloc(v->array, new_capacity * sizeof(MultiType));
     v->capacity = new_capacity;
 }
@@ -34,7 +36,7 @@ Vector *vector_create(int capacity)
     Vector *v = (Vector *)malloc(sizeof(Vector));
     v->capacity = capacity;
     v->size = 0;
-    v->array = calloc(capacity, sizeof(int));
+    v->array = calloc(capacity > 0 ? capacity : 1, sizeof(MultiType));
     return v;
 }
 
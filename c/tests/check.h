@@ -0,0 +1,29 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+/**
+ * Assertions of the test programs, built and run by make test. A failed
+ * check prints its location and message and the test goes on; check_exit
+ * then reports the test and gives its exit status.
+ */
+static int check_failures = 0;
+
+#define CHECK(cond, ...)                                         \
+    do {                                                         \
+        if (!(cond)) {                                           \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);      \
+            fprintf(stderr, __VA_ARGS__);                        \
+            fputc('\n', stderr);                                 \
+            check_failures++;                                    \
+        }                                                        \
+    } while (0)
+
+static inline int check_exit(const char *name)
+{
+    printf("%s: %s\n", name, check_failures == 0 ? "ok" : "FAILED");
+    return check_failures == 0 ? 0 : 1;
+}
+
+#endif  // CHECK_H
@@ -0,0 +1,162 @@
+"""
+Differential fuzzer of mygrep: random postfix patterns are searched in
+random lines with both DFA constructions, and the lines they print are
+compared with those accepted by a plain epsilon-NFA simulation of the
+pattern, which shares no code with the C engine.
+
+    python3 tests/fuzz.py ./mygrep [seed] [patterns]
+"""
+
+import random
+import subprocess
+import sys
+import tempfile
+
+CONSTRUCTIONS = ["thompson", "derivatives"]
+
+
+def is_dot(c):
+    """Characters matched by ".": ASCII letters and digits, any other code point"""
+    return c.isascii() and c.isalnum() or not c.isascii()
+
+
+def pattern(depth):
+    """A random postfix pattern"""
+    if depth == 0 or random.random() < 0.25:
+        return random.choice("aabbcé.")
+    op = random.choice("@@||*?{" if depth <= 2 else "@@||*?")
+    if op in "@|":
+        return pattern(depth - 1) + pattern(depth - 1) + op
+    if op == "{":
+        m = random.choice([0, 1, 2, 3, 5, 17])
+        n = random.choice([None, m, m + 1, m + 3, m + 18])
+        bounds = "{%d}" % m if n == m else "{%d,%s}" % (m, "" if n is None else n)
+        return pattern(depth - 1) + bounds
+    return pattern(depth - 1) + op
+
+
+class NFA:
+    """Epsilon-NFA built by Thompson's construction, fragments being (start, end)"""
+
+    def __init__(self, regex):
+        self.epsilons, self.edges, self.size = {}, {}, 0
+        self.start, self.end = self.build(self.parse(regex))
+
+    def state(self):
+        self.size += 1
+        return self.size - 1
+
+    def parse(self, regex):
+        stack, i = [], 0
+        while i < len(regex):
+            c = regex[i]
+            if c in "@|":
+                right = stack.pop()
+                stack.append((c, stack.pop(), right))
+            elif c == "*":
+                stack.append(("*", stack.pop()))
+            elif c == "?":
+                stack.append(("|", ("",), stack.pop()))
+            elif c == "{":
+                j = regex.index("}", i)
+                bounds = regex[i + 1:j].split(",")
+                m = int(bounds[0])
+                n = m if len(bounds) == 1 else int(bounds[1]) if bounds[1] else None
+                stack.append(("{", stack.pop(), m, n))
+                i = j
+            else:
+                stack.append((c,))
+            i += 1
+        return stack[0]
+
+    def build(self, node):
+        kind = node[0]
+        if kind == "@":
+            s1, e1 = self.build(node[1])
+            s2, e2 = self.build(node[2])
+            self.epsilons.setdefault(e1, []).append(s2)
+            return s1, e2
+        if kind == "|":
+            start, end = self.state(), self.state()
+            for child in node[1:]:
+                s, e = self.build(child)
+                self.epsilons.setdefault(start, []).append(s)
+                self.epsilons.setdefault(e, []).append(end)
+            return start, end
+        if kind == "*":
+            loop = self.state()
+            s, e = self.build(node[1])
+            self.epsilons.setdefault(loop, []).append(s)
+            self.epsilons.setdefault(e, []).append(loop)
+            return loop, loop
+        if kind == "{":
+            _, child, m, n = node
+            tail = ("*", child) if n is None else ("",)
+            for _ in range(0 if n is None else n - m):
+                tail = ("|", ("",), ("@", child, tail))
+            for _ in range(m):
+                tail = ("@", child, tail)
+            return self.build(tail)
+        start = self.state()
+        if kind == "":
+            return start, start
+        end = self.state()
+        test = is_dot if kind == "." else kind.__eq__
+        self.edges.setdefault(start, []).append((test, end))
+        return start, end
+
+    def closure(self, states):
+        todo = list(states)
+        while todo:
+            for t in self.epsilons.get(todo.pop(), []):
+                if t not in states:
+                    states.add(t)
+                    todo.append(t)
+        return states
+
+    def accepts(self, line):
+        states = self.closure({self.start})
+        for c in line:
+            states = self.closure({t for s in states for test, t in self.edges.get(s, [])
+                                   if test(c)})
+        return self.end in states
+
+
+def lines():
+    found = {""}
+    for _ in range(400):
+        found.add("".join(random.choice("abcé x") for _ in range(random.randint(0, 7))))
+    for _ in range(200):
+        run = random.choice(["a", "ab", "abc", "b", "ba", "aé"])
+        found.add("".join(random.choice(run) for _ in range(random.randint(10, 60))))
+    return sorted(found)
+
+
+def main():
+    binary = sys.argv[1]
+    random.seed(int(sys.argv[2]) if len(sys.argv) > 2 else 0)
+    count = int(sys.argv[3]) if len(sys.argv) > 3 else 200
+    text = lines()
+    with tempfile.NamedTemporaryFile("w", encoding="utf-8", suffix=".txt") as data:
+        data.write("\n".join(text) + "\n")
+        data.flush()
+        bad = 0
+        for _ in range(count):
+            regex = pattern(random.randint(1, 5))
+            nfa = NFA(regex)
+            expected = [line for line in text if nfa.accepts(line)]
+            for construction in CONSTRUCTIONS:
+                run = subprocess.run([binary, "--construction", construction, regex,
+                                      data.name], capture_output=True, encoding="utf-8")
+                got = run.stdout.splitlines()
+                if got != expected or run.stderr:
+                    bad += 1
+                    print("MISMATCH %s with %s: %d lines, %d expected %s"
+                          % (regex, construction, len(got), len(expected),
+                             run.stderr.strip()))
+    print("%d patterns, %d mismatches" % (count, bad))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
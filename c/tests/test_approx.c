@@ -0,0 +1,134 @@
+/**
+ * Regression tests of -k: lines within k edits of a pattern, checked on
+ * hand-computed cases and, for literal patterns, against the Levenshtein
+ * distance of every short line.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "algorithm.h"
+#include "check.h"
+#include "table.h"
+
+/* Whether line is within k edits of regex */
+static bool approx_matches(const char *regex, int k, const char *line)
+{
+    Table *table = regex_compile_approx(regex, k, false);
+    bool match = table_accept(table, line, strlen(line));
+    table_free(table);
+    return match;
+}
+
+static void check_lines(const char *regex, int k, const char *const *matching,
+                        const char *const *others)
+{
+    for (int i = 0; matching[i] != NULL; i++)
+        CHECK(approx_matches(regex, k, matching[i]), "%s -k %d should match \"%s\"",
+              regex, k, matching[i]);
+    for (int i = 0; others[i] != NULL; i++)
+        CHECK(!approx_matches(regex, k, others[i]), "%s -k %d should not match \"%s\"",
+              regex, k, others[i]);
+}
+
+/* Edit distance of a and b, by the usual dynamic programming */
+static int levenshtein(const char *a, const char *b)
+{
+    int n = strlen(a), m = strlen(b);
+    int *row = malloc((m + 1) * sizeof(int));
+    for (int j = 0; j <= m; j++)
+        row[j] = j;
+    for (int i = 1; i <= n; i++) {
+        int diagonal = row[0];
+        row[0] = i;
+        for (int j = 1; j <= m; j++) {
+            int above = row[j];
+            int best = diagonal + (a[i - 1] != b[j - 1]);
+            if (above + 1 < best)
+                best = above + 1;
+            if (row[j - 1] + 1 < best)
+                best = row[j - 1] + 1;
+            row[j] = best;
+            diagonal = above;
+        }
+    }
+    int distance = row[m];
+    free(row);
+    return distance;
+}
+
+/* Every line of up to 5 bytes of "abx " against the literal word, as -k */
+static void check_levenshtein(const char *word, int k)
+{
+    char regex[32] = {word[0]};
+    for (int i = 1; word[i] != '\0'; i++) {
+        size_t len = strlen(regex);
+        regex[len] = word[i];
+        regex[len + 1] = '@';
+    }
+    Table *table = regex_compile_approx(regex, k, false);
+    const char letters[] = "abx ";
+    char line[6];
+    for (int len = 0; len <= 5; len++) {
+        int total = 1;
+        for (int i = 0; i < len; i++)
+            total *= 4;
+        for (int code = 0; code < total; code++) {
+            for (int i = 0, c = code; i < len; i++, c /= 4)
+                line[i] = letters[c % 4];
+            line[len] = '\0';
+            bool expected = levenshtein(word, line) <= k;
+            CHECK(table_accept(table, line, len) == expected,
+                  "%s -k %d on \"%s\": distance %d", regex, k, line,
+                  levenshtein(word, line));
+        }
+    }
+    table_free(table);
+}
+
+int main(void)
+{
+    // Substitution, insertion and deletion of one byte, but not of two
+    check_lines("abc@@", 1,
+                (const char *[]){"abc", "abx", "xbc", "abbc", "abcx", "ac", "ab", NULL},
+                (const char *[]){"", "a", "xbx", "abcde", "ba", "cba", NULL});
+    check_lines("abc@@", 2,
+                (const char *[]){"a", "c", "xbx", "abcde", "xabcx", "ba", NULL},
+                (const char *[]){"", "xyz", "abcdef", "xxbxx", NULL});
+    // A byte outside the pattern alphabet is an edit like any other
+    check_lines("ab@", 1, (const char *[]){"a ", " b", "a b", NULL},
+                (const char *[]){"  ", " a", NULL});
+
+    // The empty line is as far as the shortest line of the pattern
+    check_lines("a", 1, (const char *[]){"", "a", "b", "ab", NULL},
+                (const char *[]){"bb", NULL});
+    check_lines("ab@", 1, (const char *[]){"a", "b", NULL},
+                (const char *[]){"", NULL});
+    check_lines("ab@", 2, (const char *[]){"", "xx", NULL},
+                (const char *[]){"xxx", NULL});
+    check_lines("ab@*", 1, (const char *[]){"", "a", "abab", "aba", NULL},
+                (const char *[]){"bbb", "baba", NULL});
+
+    // Bounded repeats, whose copies are positions of their own
+    check_lines("a{3}", 1, (const char *[]){"aa", "aaa", "aaaa", "aba", "aab", NULL},
+                (const char *[]){"a", "aaaaa", "abb", NULL});
+    check_lines("a{2,3}b@", 1,
+                (const char *[]){"ab", "aab", "aaab", "aaaab", "aaa", "aax", NULL},
+                (const char *[]){"b", "aaaaab", "bbab", NULL});
+    check_lines("a{2,3}b@", 2, (const char *[]){"b", "a", "aaaaab", NULL},
+                (const char *[]){"", "bbbb", "aaaaaab", NULL});
+    check_lines("ab@{17}", 1,
+                (const char *[]){"ababababababababababababababababab",
+                                 "ababababababababababababababababa",
+                                 "ababababababababbbabababababababab", NULL},
+                (const char *[]){"abababababababababababababababab",
+                                 "abababababababababababababababababab", NULL});
+
+    for (int k = 1; k <= 2; k++) {
+        const char *words[] = {"a", "ab", "abc", "abca", "bab"};
+        for (int i = 0; i < 5; i++)
+            check_levenshtein(words[i], k);
+    }
+    return check_exit("approx");
+}
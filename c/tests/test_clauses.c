@@ -0,0 +1,48 @@
+/**
+ * Regression tests of boolean combinations: lines holding bytes no pattern
+ * reads, NUL included, take the value of the combination on a line no
+ * clause matches.
+ */
+
+#include <stdbool.h>
+
+#include "algorithm.h"
+#include "check.h"
+#include "table.h"
+
+static void check_line(Table *table, const char *name, const char *line, size_t len,
+                       bool expected)
+{
+    CHECK(table_accept(table, line, len) == expected,
+          "%s should %smatch the %zu bytes of \"%s\"", name, expected ? "" : "not ", len,
+          line);
+}
+
+int main(void)
+{
+    Clause ab[] = {{"ab@", false, BoolOr}};
+    Clause a_not_b[] = {{"a", false, BoolOr}, {"b", true, BoolAnd}};
+    Clause not_a[] = {{"a", true, BoolOr}};
+    for (int c = ConstructionThompson; c <= ConstructionDerivatives; c++) {
+        Table *table = regex_compile_clauses(ab, 1, true, false, c);
+        check_line(table, "-v ab@", "ab", 2, false);
+        check_line(table, "-v ab@", "x\0y", 3, true);
+        check_line(table, "-v ab@", "\0", 1, true);
+        check_line(table, "-v ab@", "a b", 3, true);
+        check_line(table, "-v ab@", "zz", 2, true);
+        table_free(table);
+
+        table = regex_compile_clauses(a_not_b, 2, false, false, c);
+        check_line(table, "a --not b", "a", 1, true);
+        check_line(table, "a --not b", "a\0", 2, false);
+        check_line(table, "a --not b", "\0", 1, false);
+        table_free(table);
+
+        table = regex_compile_clauses(not_a, 1, false, false, c);
+        check_line(table, "--not a", "a", 1, false);
+        check_line(table, "--not a", "\0a", 2, true);
+        check_line(table, "--not a", "", 0, true);
+        table_free(table);
+    }
+    return check_exit("clauses");
+}
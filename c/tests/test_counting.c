@@ -0,0 +1,138 @@
+/**
+ * Regression tests of counted repetitions x{m,n}: lines of m, n and n + 1
+ * copies, unbounded and empty counts, counts near PARSE_MAX_REPEAT, counts
+ * in boolean combinations, and the bounds the parser refuses.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "algorithm.h"
+#include "check.h"
+#include "parser.h"
+#include "table.h"
+
+/* Line made of count copies of unit */
+static char *repeat(const char *unit, int count)
+{
+    size_t len = strlen(unit);
+    char *line = malloc(len * count + 1);
+    for (int i = 0; i < count; i++)
+        memcpy(line + len * i, unit, len);
+    line[len * count] = '\0';
+    return line;
+}
+
+/* Whether the table accepts count copies of unit */
+static bool copies_match(Table *table, const char *unit, int count)
+{
+    char *line = repeat(unit, count);
+    bool match = table_accept(table, line, strlen(line));
+    free(line);
+    return match;
+}
+
+/*
+ * Checks that the table matches the lines of exactly min to max copies of
+ * unit, max -1 for no bound, or the other lines when inverted, around the
+ * bounds. The table is freed.
+ */
+static void check_table(Table *table, const char *name, const char *unit, int min,
+                        int max, bool inverted)
+{
+    int counts[] = {0, 1, min - 1, min, min + 1, max - 1, max, max + 1, max + 64};
+    for (int i = 0; i < 9; i++) {
+        if (counts[i] < 0)
+            continue;
+        bool expected = (counts[i] >= min && (max < 0 || counts[i] <= max)) != inverted;
+        CHECK(copies_match(table, unit, counts[i]) == expected,
+              "%s: %d copies should %smatch", name, counts[i], expected ? "" : "not ");
+    }
+    table_free(table);
+}
+
+/* Checks regex, unit{min,max}, with both constructions */
+static void check_bounds(const char *regex, const char *unit, int min, int max)
+{
+    char name[128];
+    for (int c = ConstructionThompson; c <= ConstructionDerivatives; c++) {
+        snprintf(name, sizeof(name), "%s with %s", regex, CONSTRUCTION_STR[c]);
+        check_table(regex_compile(regex, c), name, unit, min, max, false);
+    }
+}
+
+/* Same, in the combinations -v regex, .* --not regex and regex --or c */
+static void check_combinations(const char *regex, const char *unit, int min, int max)
+{
+    Clause alone[] = {{regex, false, BoolOr}};
+    Clause negated[] = {{".*", false, BoolOr}, {regex, true, BoolAnd}};
+    Clause either[] = {{regex, false, BoolOr}, {"c", false, BoolOr}};
+    char name[128];
+    for (int c = ConstructionThompson; c <= ConstructionDerivatives; c++) {
+        snprintf(name, sizeof(name), "-v %s with %s", regex, CONSTRUCTION_STR[c]);
+        check_table(regex_compile_clauses(alone, 1, true, false, c), name, unit, min, max,
+                    true);
+        snprintf(name, sizeof(name), ".* --not %s with %s", regex, CONSTRUCTION_STR[c]);
+        check_table(regex_compile_clauses(negated, 2, false, false, c), name, unit, min,
+                    max, true);
+        snprintf(name, sizeof(name), "%s --or c with %s", regex, CONSTRUCTION_STR[c]);
+        check_table(regex_compile_clauses(either, 2, false, false, c), name, unit, min,
+                    max, false);
+    }
+}
+
+int main(void)
+{
+    // Unrolled counts
+    check_bounds("a{3}", "a", 3, 3);
+    check_bounds("a{2,5}", "a", 2, 5);
+    check_bounds("ab@{2,3}", "ab", 2, 3);
+    check_bounds("ab@{0,4}", "ab", 0, 4);
+    check_bounds("a{0,}", "a", 0, -1);
+    check_bounds("a{4,}", "a", 4, -1);
+    check_bounds("a{0}", "a", 0, 0);
+
+    // Counts beyond SIMPLIFY_MAX_UNROLL, confirmed by the counting automaton
+    check_bounds("a{17}", "a", 17, 17);
+    check_bounds("[ab]{20,40}", "b", 20, 40);
+    check_bounds("a{100,}", "a", 100, -1);
+    check_bounds("a{0,300}", "a", 0, 300);
+
+    // Counted bodies of several states, with a count vector per state
+    check_bounds("ab@{1,1000}", "ab", 1, 1000);
+    check_bounds("ab@{20,40}", "ab", 20, 40);
+    check_bounds("ab@c|{17,20}", "c", 17, 20);
+    check_bounds("a?b?@{20,25}", "ab", 0, 25);  // empty copies make up the count
+    check_bounds("é{100}", "é", 100, 100);
+    check_bounds("a{20}b@{30}", "aaaaaaaaaaaaaaaaaaaab", 30, 30);
+
+    // Combined counts, confirmed by the exact combination of the clauses
+    check_combinations("a{3}", "a", 3, 3);
+    check_combinations("a{1,300}", "a", 1, 300);
+    check_combinations("a{1,5000}", "a", 1, 5000);
+    check_combinations("ab@{20,40}", "ab", 20, 40);
+    check_combinations("a{100,}", "a", 100, -1);
+
+    // Near the largest count
+    char regex[32];
+    snprintf(regex, sizeof(regex), "a{%d}", PARSE_MAX_REPEAT);
+    check_bounds(regex, "a", PARSE_MAX_REPEAT, PARSE_MAX_REPEAT);
+    snprintf(regex, sizeof(regex), "a{%d,%d}", PARSE_MAX_REPEAT - 1, PARSE_MAX_REPEAT);
+    check_bounds(regex, "a", PARSE_MAX_REPEAT - 1, PARSE_MAX_REPEAT);
+    snprintf(regex, sizeof(regex), "a{%d,}", PARSE_MAX_REPEAT);
+    check_bounds(regex, "a", PARSE_MAX_REPEAT, -1);
+
+    // Malformed bounds and counts above PARSE_MAX_REPEAT are refused
+    const char *valid[] = {"a{0}", "a{0,}", "a{0,0}", "a{2,2}", "a{65535}",
+                           "a{0,65535}", "a{65535,}", NULL};
+    const char *invalid[] = {"a{}", "a{,3}", "a{3,2}", "a{-1}", "a{65536}",
+                             "a{0,65536}", "a{65536,}", "a{99999999999}", "a{2",
+                             "{2}", NULL};
+    for (int i = 0; valid[i] != NULL; i++)
+        CHECK(parse_check(valid[i]), "%s should be valid", valid[i]);
+    for (int i = 0; invalid[i] != NULL; i++)
+        CHECK(!parse_check(invalid[i]), "%s should be refused", invalid[i]);
+    return check_exit("counting");
+}
@@ -0,0 +1,173 @@
+/**
+ * Regression tests of nfa_determinize against the plain subset construction
+ * it replaced, kept here as the reference: both must number the same
+ * subsets, so they build as many states, and accept the same language.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "algorithm.h"
+#include "automaton.h"
+#include "check.h"
+#include "hashtable.h"
+#include "parser.h"
+#include "simplify.h"
+#include "vector.h"
+
+/* Targets of state on letter a, NULL when there are none */
+static Set *targets(NFA *nfa, MultiType state, char a)
+{
+    MultiType row = hashtable_get(nfa->_transitions, state);
+    if (row.type == NullType)
+        return NULL;
+    MultiType set = hashtable_get((HashTable *)row.value.p, multi_char(a));
+    return set.type == NullType ? NULL : set.value.p;
+}
+
+static Set *closure(NFA *nfa, Set *states)
+{
+    Set *closure = hashtable_create(states->capacity);
+    Vector *stack = hashtable_to_vector(states);
+    while (stack->size > 0) {
+        MultiType q = vector_pop(stack);
+        if (hashtable_contains(closure, q))
+            continue;
+        hashtable_set(closure, q, q);
+        Set *next = targets(nfa, q, EPSILON);
+        for (int b = 0; next != NULL && b < next->capacity; b++) {
+            for (Entry *e = next->array[b]; e != NULL; e = e->next)
+                vector_push(stack, e->key);
+        }
+    }
+    vector_free(stack);
+    return closure;
+}
+
+static Set *step(NFA *nfa, Set *states, char a)
+{
+    Set *next = hashtable_create(2);
+    for (int b = 0; b < states->capacity; b++) {
+        for (Entry *e = states->array[b]; e != NULL; e = e->next) {
+            Set *t = targets(nfa, e->key, a);
+            if (t != NULL)
+                hashtable_update(next, t);
+        }
+    }
+    Set *result = closure(nfa, next);
+    hashtable_free(next, false);
+    return result;
+}
+
+static bool is_final(NFA *nfa, Set *states)
+{
+    for (int b = 0; b < states->capacity; b++) {
+        for (Entry *e = states->array[b]; e != NULL; e = e->next) {
+            if (hashtable_contains(nfa->final, e->key))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* The subset construction over SYMBOLS before the compact one */
+static DFA *reference_determinize(NFA *nfa)
+{
+    DFA *dfa = dfa_create(multi_int(0));
+    HashTable *ids = hashtable_create(2);  // (subset -> state)
+    Vector *stack = vector_create(2);
+    Set *initial = closure(nfa, nfa->initial);
+    hashtable_set(ids, multi_htbl(initial), multi_int(0));
+    vector_push(stack, multi_htbl(initial));
+    while (stack->size > 0) {
+        Set *states = vector_pop(stack).value.p;
+        MultiType state = hashtable_get(ids, multi_htbl(states));
+        if (is_final(nfa, states))
+            hashtable_set(dfa->final, state, state);
+        for (int i = 0; SYMBOLS[i] != '\0'; i++) {
+            Set *p = step(nfa, states, SYMBOLS[i]);
+            MultiType next = hashtable_get(ids, multi_htbl(p));
+            if (next.type == NullType) {
+                next = multi_int(ids->size);
+                hashtable_set(ids, multi_htbl(p), next);
+                vector_push(stack, multi_htbl(p));
+            } else
+                hashtable_free(p, false);
+            dfa_set_transition(dfa, state, SYMBOLS[i], next);
+        }
+    }
+    vector_free(stack);
+    hashtable_free(ids, true);
+    return dfa;
+}
+
+/*
+ * Whether a and b, complete over SYMBOLS with states 0..n-1, accept the
+ * same words: no pair of states reached by a same word differs on being
+ * final.
+ */
+static bool same_language(DFA *a, DFA *b)
+{
+    int na = a->_transitions->size, nb = b->_transitions->size;
+    bool *seen = calloc((size_t)na * nb, sizeof(bool));
+    int *stack = malloc((size_t)na * nb * sizeof(int)), top = 0;
+    int start = a->initial.value.i * nb + b->initial.value.i;
+    seen[start] = true;
+    stack[top++] = start;
+    bool same = true;
+    while (top > 0 && same) {
+        int pair = stack[--top], p = pair / nb, q = pair % nb;
+        same = hashtable_contains(a->final, multi_int(p))
+               == hashtable_contains(b->final, multi_int(q));
+        for (int i = 0; SYMBOLS[i] != '\0'; i++) {
+            int next = dfa_delta(a, multi_int(p), SYMBOLS[i]).value.i * nb
+                       + dfa_delta(b, multi_int(q), SYMBOLS[i]).value.i;
+            if (!seen[next]) {
+                seen[next] = true;
+                stack[top++] = next;
+            }
+        }
+    }
+    free(seen);
+    free(stack);
+    return same;
+}
+
+static void check_pattern(const char *regex)
+{
+    AST *ast = ast_unroll(ast_simplify(parse(regex)));
+    NFA *nfa = thompson(ast);
+    ast_free(ast);
+    DFA *expected = reference_determinize(nfa);
+    DFA *dfa = nfa_determinize(nfa);
+    CHECK(dfa->_transitions->size == expected->_transitions->size,
+          "%s: %d states, %d expected", regex, dfa->_transitions->size,
+          expected->_transitions->size);
+    CHECK(same_language(dfa, expected), "%s: the languages differ", regex);
+    dfa_free(dfa, true);
+    dfa_free(expected, true);
+    nfa_free(nfa, true);
+}
+
+int main(void)
+{
+    const char *patterns[] = {
+        "ab@b*@",
+        "ab|*",
+        "ab@*c@",
+        "ab|*a@ab|@ab|@ab|@",
+        ".*a@.{6}@",
+        "abc@@def@@|ghi@@|ab@*|",
+        "[a-zà-ÿ]*",
+        "[^a]{2,6}",
+        ".*[^a]{2,6}@[0-9]{4,8}@.*@",
+        "é.@ß|*",
+        "a?b?@c?@a*@",
+        "[^]",
+        NULL,
+    };
+    for (int i = 0; patterns[i] != NULL; i++)
+        check_pattern(patterns[i]);
+    return check_exit("determinize");
+}
@@ -0,0 +1,20 @@
+/**
+ * Regression tests of the classes the parser accepts: a class may only name
+ * characters a line can match, and must match at least one.
+ */
+
+#include "check.h"
+#include "parser.h"
+
+int main(void)
+{
+    const char *valid[] = {"[a]", "[a-z]", "[^a]", "[^]", "[0-9A-F]", "[é-ÿ]",
+                           "[a-zà-ÿ]", "[^a-zA-Z0-9]", "[0-z]", NULL};
+    const char *invalid[] = {"[]", "[ ]", "[ -]", "[a ]", "[-]", "[a-]", "[!-~]",
+                             "[^ ]", "[.]", "[z-a]", "[a", NULL};
+    for (int i = 0; valid[i] != NULL; i++)
+        CHECK(parse_check(valid[i]), "%s should be valid", valid[i]);
+    for (int i = 0; invalid[i] != NULL; i++)
+        CHECK(!parse_check(invalid[i]), "%s should be refused", invalid[i]);
+    return check_exit("parser");
+}
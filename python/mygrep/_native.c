@@ -0,0 +1,247 @@
+/**
+ * CPython binding of the C engine (libmygrep), built by `make python` in
+ * ../../c. Inputs are taken through the buffer protocol, so bytes, bytearray
+ * and mmap objects are scanned in place, and the GIL is released while
+ * scanning.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>  // strcmp
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libmygrep.h"
+
+typedef struct PatternObject {
+    PyObject_HEAD
+    MgPattern *pattern;
+} PatternObject;
+
+/* Bounds of the matching lines, collected without the GIL */
+typedef struct Lines {
+    size_t *bounds;  // start, len pairs
+    size_t size;
+    size_t capacity;
+    bool failed;  // out of memory, the scan stopped
+} Lines;
+
+static bool collect_line(const char *line, size_t len, uint64_t offset,
+                         void *context)
+{
+    (void)line;
+    Lines *lines = context;
+    if (lines->size == lines->capacity) {
+        size_t capacity = lines->capacity == 0 ? 64 : 2 * lines->capacity;
+        size_t *bounds = realloc(lines->bounds, 2 * capacity * sizeof(size_t));
+        if (bounds == NULL) {
+            lines->failed = true;
+            return false;
+        }
+        lines->bounds = bounds;
+        lines->capacity = capacity;
+    }
+    lines->bounds[2 * lines->size] = offset;
+    lines->bounds[2 * lines->size + 1] = len;
+    lines->size++;
+    return true;
+}
+
+/* Matching lines of a buffer, as a list of bytes */
+static PyObject *scan_buffer(MgPattern *pattern, const char *data, size_t len)
+{
+    Lines lines = {NULL, 0, 0, false};
+    MgScratch *scratch = mg_scratch_create(pattern);
+    if (scratch == NULL)
+        return PyErr_NoMemory();
+    Py_BEGIN_ALLOW_THREADS
+    if (mg_scan(pattern, scratch, data, len, collect_line, &lines))
+        mg_scan_end(pattern, scratch, collect_line, &lines);
+    Py_END_ALLOW_THREADS
+    lines.failed |= mg_scratch_failed(scratch);
+    mg_scratch_free(scratch);
+    if (lines.failed) {
+        free(lines.bounds);
+        return PyErr_NoMemory();
+    }
+
+    PyObject *list = PyList_New(lines.size);
+    for (size_t i = 0; list != NULL && i < lines.size; i++) {
+        PyObject *line = PyBytes_FromStringAndSize(data + lines.bounds[2 * i],
+                                                   lines.bounds[2 * i + 1]);
+        if (line == NULL)
+            Py_CLEAR(list);
+        else
+            PyList_SET_ITEM(list, i, line);
+    }
+    free(lines.bounds);
+    return list;
+}
+
+static PyObject *pattern_match(PatternObject *self, PyObject *args)
+{
+    Py_buffer buffer;
+    if (!PyArg_ParseTuple(args, "y*", &buffer))
+        return NULL;
+    bool match;
+    Py_BEGIN_ALLOW_THREADS
+    match = mg_match(self->pattern, buffer.buf, buffer.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&buffer);
+    return PyBool_FromLong(match);
+}
+
+static PyObject *pattern_find(PatternObject *self, PyObject *args)
+{
+    Py_buffer buffer;
+    if (!PyArg_ParseTuple(args, "y*", &buffer))
+        return NULL;
+    size_t start, end;
+    bool found;
+    Py_BEGIN_ALLOW_THREADS
+    found = mg_find(self->pattern, buffer.buf, buffer.len, &start, &end);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&buffer);
+    if (!found)
+        Py_RETURN_NONE;
+    return Py_BuildValue("(nn)", (Py_ssize_t)start, (Py_ssize_t)end);
+}
+
+static PyObject *pattern_scan(PatternObject *self, PyObject *args)
+{
+    Py_buffer buffer;
+    if (!PyArg_ParseTuple(args, "y*", &buffer))
+        return NULL;
+    PyObject *list = scan_buffer(self->pattern, buffer.buf, buffer.len);
+    PyBuffer_Release(&buffer);
+    return list;
+}
+
+/* Same as scan on a file, mapped in memory */
+static PyObject *pattern_scan_file(PatternObject *self, PyObject *args)
+{
+    PyObject *name, *path;
+    if (!PyArg_ParseTuple(args, "O", &name) || !PyUnicode_FSConverter(name, &path))
+        return NULL;
+    int fd = open(PyBytes_AS_STRING(path), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, name);
+        if (fd >= 0)
+            close(fd);
+        Py_DECREF(path);
+        return NULL;
+    }
+    char *data = "";
+    if (st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, name);
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+    PyObject *list = scan_buffer(self->pattern, data, st.st_size);
+    if (st.st_size > 0)
+        munmap(data, st.st_size);
+    return list;
+}
+
+static void pattern_dealloc(PatternObject *self)
+{
+    mg_free(self->pattern);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMethodDef PATTERN_METHODS[] = {
+    {"match", (PyCFunction)pattern_match, METH_VARARGS,
+     "match(buffer) -> bool: whether the whole buffer is accepted"},
+    {"find", (PyCFunction)pattern_find, METH_VARARGS,
+     "find(buffer) -> (start, end) of the first matching line, or None"},
+    {"scan", (PyCFunction)pattern_scan, METH_VARARGS,
+     "scan(buffer) -> list of the matching lines, as bytes"},
+    {"scan_file", (PyCFunction)pattern_scan_file, METH_VARARGS,
+     "scan_file(path) -> list of the matching lines of a file, as bytes"},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject PATTERN_TYPE = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mygrep._native.Pattern",
+    .tp_basicsize = sizeof(PatternObject),
+    .tp_dealloc = (destructor)pattern_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Pattern compiled by the C engine",
+    .tp_methods = PATTERN_METHODS,
+};
+
+static PyObject *native_compile(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    (void)module;
+    static char *keywords[] = {"pattern", "construction", NULL};
+    const char *regex, *name = "thompson";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|s", keywords, &regex, &name))
+        return NULL;
+    MgConstruction construction;
+    if (strcmp(name, "thompson") == 0)
+        construction = MG_THOMPSON;
+    else if (strcmp(name, "derivatives") == 0)
+        construction = MG_DERIVATIVES;
+    else {
+        PyErr_Format(PyExc_ValueError, "%s: unknown construction", name);
+        return NULL;
+    }
+    const char *error = NULL;
+    MgPattern *pattern;
+    Py_BEGIN_ALLOW_THREADS
+    pattern = mg_compile_with(regex, construction, &error);
+    Py_END_ALLOW_THREADS
+    if (pattern == NULL) {
+        PyErr_Format(PyExc_ValueError, "%s: %s", regex, error);
+        return NULL;
+    }
+    PatternObject *self = PyObject_New(PatternObject, &PATTERN_TYPE);
+    if (self == NULL) {
+        mg_free(pattern);
+        return NULL;
+    }
+    self->pattern = pattern;
+    return (PyObject *)self;
+}
+
+static PyMethodDef NATIVE_METHODS[] = {
+    {"compile", (PyCFunction)(void (*)(void))native_compile, METH_VARARGS | METH_KEYWORDS,
+     "compile(pattern, construction='thompson') -> Pattern, for a regex in\n"
+     "postfix form, its DFA built by 'thompson' or 'derivatives'"},
+    {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef NATIVE_MODULE = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "mygrep._native",
+    .m_doc = "C engine of mygrep",
+    .m_size = -1,
+    .m_methods = NATIVE_METHODS,
+};
+
+PyMODINIT_FUNC PyInit__native(void)
+{
+    if (PyType_Ready(&PATTERN_TYPE) < 0)
+        return NULL;
+    PyObject *module = PyModule_Create(&NATIVE_MODULE);
+    if (module == NULL)
+        return NULL;
+    Py_INCREF(&PATTERN_TYPE);
+    if (PyModule_AddObject(module, "Pattern", (PyObject *)&PATTERN_TYPE) < 0) {
+        Py_DECREF(&PATTERN_TYPE);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
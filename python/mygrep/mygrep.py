@@ -4,6 +4,11 @@ import sys
 from .core.parser import parse
 from .core.algorithm import thompson, brzozowski
 
+try:
+    from . import _native  # C engine, built by `make python` in ../c
+except ImportError:
+    _native = None
+
 
 def mygrep(pattern: str, text: TextIO) -> None:
     """
@@ -13,6 +18,12 @@ def mygrep(pattern: str, text: TextIO) -> None:
         pattern: la chaîne à chercher
         text: le texte à lire
     """
+    if _native is not None:
+        data = text.buffer.read() if hasattr(text, "buffer") else text.read().encode()
+        for line in _native.compile(pattern).scan(data):
+            print(line.decode(errors="replace"))
+        return
+
     ast = parse(pattern)
     nfa = thompson(ast)
     dfa = brzozowski(nfa.determinize())
@@ -26,7 +37,10 @@ def main(argc: int, argv: List[str]) -> None:
     """
     Traitement des arguments de la ligne de commande.
     """
-    if argc == 3:
+    if argc == 3 and _native is not None:
+        for line in _native.compile(argv[1]).scan_file(argv[2]):
+            print(line.decode(errors="replace"))
+    elif argc == 3:
         with open(argv[2], "r") as file:
             mygrep(argv[1], file)
     elif argc == 2: